@@ -0,0 +1,1029 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2020 by wangwenx190 (Yuhang Zhao)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Measures the loader against the stub MDK and prints the results as JSON.
+//
+//   mdkloader_bench [--samples N] [--output file.json] [--stub path] [--stub-next path]
+//
+// Cold loads, the load contention, the forked workers, the memory footprint and the huge page
+// text runs are done in a forked child per sample, so that every sample starts without the
+// library mapped. Elsewhere only one sample is taken, in process.
+
+#include "mdkloader.h"
+#include "mdk/Player.h"
+#include "mdk/PlayerPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// Counts the allocations of the whole process, the media info run reports them per call. Every
+// replaceable form is replaced, so that each one is released by its counterpart.
+std::atomic<uint64_t> allocationCount = {0};
+
+namespace {
+
+void *allocate(size_t size, size_t alignment = 0) noexcept
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    size = size ? size : 1;
+    if (!alignment) {
+        return std::malloc(size);
+    }
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+}
+
+void release(void *memory, size_t alignment = 0) noexcept
+{
+#ifdef _WIN32
+    if (alignment) {
+        return _aligned_free(memory);
+    }
+#endif
+    (void)alignment;
+    std::free(memory);
+}
+
+void *allocateOrThrow(size_t size, size_t alignment = 0)
+{
+    if (void *memory = allocate(size, alignment)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+} // namespace
+
+void *operator new(size_t size) { return allocateOrThrow(size); }
+void *operator new[](size_t size) { return allocateOrThrow(size); }
+void *operator new(size_t size, std::align_val_t alignment) { return allocateOrThrow(size, size_t(alignment)); }
+void *operator new[](size_t size, std::align_val_t alignment) { return allocateOrThrow(size, size_t(alignment)); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocate(size, size_t(alignment));
+}
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocate(size, size_t(alignment));
+}
+
+void operator delete(void *memory) noexcept { release(memory); }
+void operator delete[](void *memory) noexcept { release(memory); }
+void operator delete(void *memory, size_t) noexcept { release(memory); }
+void operator delete[](void *memory, size_t) noexcept { release(memory); }
+void operator delete(void *memory, const std::nothrow_t &) noexcept { release(memory); }
+void operator delete[](void *memory, const std::nothrow_t &) noexcept { release(memory); }
+void operator delete(void *memory, std::align_val_t alignment) noexcept { release(memory, size_t(alignment)); }
+void operator delete[](void *memory, std::align_val_t alignment) noexcept { release(memory, size_t(alignment)); }
+void operator delete(void *memory, size_t, std::align_val_t alignment) noexcept
+{
+    release(memory, size_t(alignment));
+}
+void operator delete[](void *memory, size_t, std::align_val_t alignment) noexcept
+{
+    release(memory, size_t(alignment));
+}
+void operator delete(void *memory, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    release(memory, size_t(alignment));
+}
+void operator delete[](void *memory, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    release(memory, size_t(alignment));
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedNanoseconds(const Clock::time_point &since, const Clock::time_point &until = Clock::now())
+{
+    return std::chrono::duration<double, std::nano>(until - since).count();
+}
+
+struct Summary
+{
+    double median = 0;
+    double min = 0;
+    double max = 0;
+    size_t samples = 0;
+};
+
+Summary summarize(std::vector<double> values)
+{
+    Summary summary;
+    if (values.empty()) {
+        return summary;
+    }
+    std::sort(values.begin(), values.end());
+    summary.median = values[values.size() / 2];
+    summary.min = values.front();
+    summary.max = values.back();
+    summary.samples = values.size();
+    return summary;
+}
+
+#ifndef _WIN32
+// Runs measure in a forked child and copies its plain old data result back.
+template<typename Result, typename Measure>
+bool runInChild(Measure measure, Result &result)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        const Result value = measure();
+        const ssize_t written = write(fds[1], &value, sizeof(value));
+        _exit(written == sizeof(value) ? 0 : 1);
+    }
+    close(fds[1]);
+    const bool ok = (pid >= 0) && (read(fds[0], &result, sizeof(result)) == sizeof(result));
+    close(fds[0]);
+    if (pid > 0) {
+        waitpid(pid, nullptr, 0);
+    }
+    return ok;
+}
+#endif
+
+// Runs measure in a process of its own and returns its result.
+template<typename Measure>
+double runIsolated(Measure measure)
+{
+#ifdef _WIN32
+    const double value = measure();
+    mdkloader_cleanup();
+    return value;
+#else
+    double value = -1;
+    return runInChild(measure, value) ? value : -1;
+#endif
+}
+
+template<typename Measure>
+Summary sampleIsolated(const int samples, Measure measure)
+{
+    std::vector<double> values;
+#ifdef _WIN32
+    (void) samples;
+    values.push_back(runIsolated(measure));
+#else
+    for (int i = 0; i < samples; ++i) {
+        const double value = runIsolated(measure);
+        if (value >= 0) {
+            values.push_back(value);
+        }
+    }
+#endif
+    return summarize(values);
+}
+
+#ifndef _WIN32
+// Microseconds from fork() until the worker has made its first call into MDK.
+// With prefork the parent has done the loading, otherwise every worker loads.
+double forkWorker(const char *path, const bool prefork)
+{
+    if (prefork && !mdkloader_prefork(path, nullptr)) {
+        return -1;
+    }
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    const auto start = Clock::now();
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        const bool ready = mdkloader_load(path) && (MDK_version() > 0);
+        const double value = ready ? elapsedNanoseconds(start) / 1000.0 : -1;
+        const ssize_t written = write(fds[1], &value, sizeof(value));
+        _exit(written == sizeof(value) ? 0 : 1);
+    }
+    close(fds[1]);
+    double value = -1;
+    if ((pid < 0) || (read(fds[0], &value, sizeof(value)) != sizeof(value))) {
+        value = -1;
+    }
+    close(fds[0]);
+    if (pid > 0) {
+        waitpid(pid, nullptr, 0);
+    }
+    return value;
+}
+#endif
+
+#ifdef __linux__
+// Resident kilobytes of the whole process.
+int64_t residentKilobytes()
+{
+    FILE *const file = std::fopen("/proc/self/smaps_rollup", "r");
+    if (!file) {
+        return -1;
+    }
+    long long value = -1;
+    char line[256];
+    while (std::fgets(line, sizeof(line), file)) {
+        if (std::sscanf(line, "Rss: %lld kB", &value) == 1) {
+            break;
+        }
+    }
+    std::fclose(file);
+    return value;
+}
+
+struct Footprint
+{
+    const char *flags = nullptr;
+    bool valid = false;
+    mdkloaderMemoryUsage loadDelta = {}; // kilobytes
+    int libraries = 0;
+    mdkloaderMemoryUsage libraryRss = {}; // kilobytes, summed over the libraries
+    int64_t retainedAfterCleanup = 0; // kilobytes
+};
+
+// What loading with openFlags costs, and what is left after mdkloader_cleanup().
+Footprint measureFootprint(const char *path, const char *name, const int openFlags)
+{
+    Footprint footprint;
+    const bool ok = runInChild([path, openFlags] {
+        Footprint result;
+        // The child maps the pages of the loader and libc it touches since fork() one
+        // by one, which would be counted as well. A plain round does that first.
+        mdkloaderLibraryMemory warmup[4];
+        mdkloader_load(path);
+        mdkloader_memoryUsage(warmup, 4);
+        mdkloader_cleanup();
+        const int64_t before = residentKilobytes();
+        mdkloaderLoadOptions options = {};
+        options.measureMemory = true;
+        options.openFlags = openFlags;
+        mdkloaderLoadReport report;
+        result.valid = mdkloader_load_ex(path, &options, nullptr) && (MDK_version() > 0)
+                       && mdkloader_loadReport(&report);
+        if (result.valid) {
+            result.loadDelta = {report.rssDelta.fileRss / 1024, report.rssDelta.anonRss / 1024};
+            std::vector<mdkloaderLibraryMemory> libraries(mdkloader_memoryUsage(nullptr, 0));
+            result.libraries = mdkloader_memoryUsage(libraries.data(),
+                                                     static_cast<int>(libraries.size()));
+            for (const mdkloaderLibraryMemory &library : libraries) {
+                result.libraryRss.fileRss += library.rss.fileRss / 1024;
+                result.libraryRss.anonRss += library.rss.anonRss / 1024;
+            }
+            mdkloader_cleanup();
+            result.retainedAfterCleanup = residentKilobytes() - before;
+        }
+        return result;
+    }, footprint);
+    if (!ok) {
+        footprint = {};
+    }
+    footprint.flags = name;
+    return footprint;
+}
+#endif
+
+// Median nanoseconds per call of 15 batches of iterations calls.
+template<typename Call>
+double nanosecondsPerCall(const int iterations, Call call)
+{
+    std::vector<double> batches;
+    for (int batch = 0; batch < 15; ++batch) {
+        const auto start = Clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            call();
+        }
+        batches.push_back(elapsedNanoseconds(start) / iterations);
+    }
+    return summarize(batches).median;
+}
+
+// Keeps the results of the measured calls alive, at the cost of one store.
+volatile bool sink = false;
+
+template<typename T>
+void consume(const T &value)
+{
+    sink = (value != T{});
+}
+
+struct ForwardingResult
+{
+    const char *api = nullptr;
+    double wrapper = 0;
+    double direct = 0;
+};
+
+template<typename Wrapper, typename Direct>
+void measureForwarding(std::vector<ForwardingResult> &results,
+                       const char *api,
+                       Wrapper wrapper,
+                       Direct direct)
+{
+    constexpr int iterations = 200000;
+    ForwardingResult result;
+    result.api = api;
+    result.wrapper = nanosecondsPerCall(iterations, wrapper);
+    result.direct = nanosecondsPerCall(iterations, direct);
+    results.push_back(result);
+}
+
+// Calls through the exported forwarding functions compared to calls through
+// the pointers of mdkloader_api(). The latter cost the same as calling MDK
+// linked directly, which also jumps through a resolved address in the GOT.
+std::vector<ForwardingResult> measureAllForwarding(const mdkloaderAPI *api)
+{
+    std::vector<ForwardingResult> results;
+    mdkAudioCodecParameters acp;
+    mdkVideoCodecParameters vcp;
+    mdkStringMapEntry entry = {};
+    measureForwarding(
+        results, "MDK_javaVM", [] { consume(MDK_javaVM(nullptr)); }, [api] {
+            consume(api->MDK_javaVM(nullptr));
+        });
+    measureForwarding(
+        results, "MDK_setLogLevel", [] { MDK_setLogLevel(MDK_LogLevel_Info); }, [api] {
+            api->MDK_setLogLevel(MDK_LogLevel_Info);
+        });
+    measureForwarding(
+        results, "MDK_logLevel", [] { consume(MDK_logLevel()); }, [api] {
+            consume(api->MDK_logLevel());
+        });
+    measureForwarding(
+        results, "MDK_setLogHandler", [] { MDK_setLogHandler({}); }, [api] {
+            api->MDK_setLogHandler({});
+        });
+    measureForwarding(
+        results,
+        "MDK_setGlobalOptionString",
+        [] { MDK_setGlobalOptionString("key", "value"); },
+        [api] { api->MDK_setGlobalOptionString("key", "value"); });
+    measureForwarding(
+        results,
+        "MDK_setGlobalOptionInt32",
+        [] { MDK_setGlobalOptionInt32("key", 1); },
+        [api] { api->MDK_setGlobalOptionInt32("key", 1); });
+    measureForwarding(
+        results,
+        "MDK_setGlobalOptionPtr",
+        [] { MDK_setGlobalOptionPtr("key", nullptr); },
+        [api] { api->MDK_setGlobalOptionPtr("key", nullptr); });
+    measureForwarding(
+        results,
+        "MDK_strdup",
+        [] { std::free(MDK_strdup("value")); },
+        [api] { std::free(api->MDK_strdup("value")); });
+    measureForwarding(
+        results, "MDK_version", [] { consume(MDK_version()); }, [api] {
+            consume(api->MDK_version());
+        });
+    measureForwarding(
+        results,
+        "MDK_AudioStreamCodecParameters",
+        [&acp] { MDK_AudioStreamCodecParameters(nullptr, &acp); },
+        [api, &acp] { api->MDK_AudioStreamCodecParameters(nullptr, &acp); });
+    measureForwarding(
+        results,
+        "MDK_AudioStreamMetadata",
+        [&entry] { consume(MDK_AudioStreamMetadata(nullptr, &entry)); },
+        [api, &entry] { consume(api->MDK_AudioStreamMetadata(nullptr, &entry)); });
+    measureForwarding(
+        results,
+        "MDK_VideoStreamCodecParameters",
+        [&vcp] { MDK_VideoStreamCodecParameters(nullptr, &vcp); },
+        [api, &vcp] { api->MDK_VideoStreamCodecParameters(nullptr, &vcp); });
+    measureForwarding(
+        results,
+        "MDK_VideoStreamMetadata",
+        [&entry] { consume(MDK_VideoStreamMetadata(nullptr, &entry)); },
+        [api, &entry] { consume(api->MDK_VideoStreamMetadata(nullptr, &entry)); });
+    measureForwarding(
+        results,
+        "MDK_MediaMetadata",
+        [&entry] { consume(MDK_MediaMetadata(nullptr, &entry)); },
+        [api, &entry] { consume(api->MDK_MediaMetadata(nullptr, &entry)); });
+    measureForwarding(
+        results,
+        "mdkPlayerAPI_new+mdkPlayerAPI_delete",
+        [] {
+            const mdkPlayerAPI *player = mdkPlayerAPI_new();
+            mdkPlayerAPI_delete(&player);
+        },
+        [api] {
+            const mdkPlayerAPI *player = api->mdkPlayerAPI_new();
+            api->mdkPlayerAPI_delete(&player);
+        });
+    measureForwarding(
+        results,
+        "MDK_foreignGLContextDestroyed",
+        [] { MDK_foreignGLContextDestroyed(); },
+        [api] { api->MDK_foreignGLContextDestroyed(); });
+    measureForwarding(
+        results,
+        "mdkVideoFrameAPI_new+mdkVideoFrameAPI_delete",
+        [] {
+            mdkVideoFrameAPI *frame = mdkVideoFrameAPI_new(1920, 1080, MDK_PixelFormat_RGBA);
+            mdkVideoFrameAPI_delete(&frame);
+        },
+        [api] {
+            mdkVideoFrameAPI *frame = api->mdkVideoFrameAPI_new(1920, 1080, MDK_PixelFormat_RGBA);
+            api->mdkVideoFrameAPI_delete(&frame);
+        });
+    return results;
+}
+
+#ifdef __linux__
+// One call of most MDK APIs, code spread over the library as the iTLB sees it.
+void callEveryAPI()
+{
+    mdkAudioCodecParameters acp;
+    mdkVideoCodecParameters vcp;
+    mdkStringMapEntry entry = {};
+    consume(MDK_javaVM(nullptr));
+    MDK_setLogLevel(MDK_LogLevel_Info);
+    consume(MDK_logLevel());
+    MDK_setGlobalOptionInt32("key", 1);
+    std::free(MDK_strdup("value"));
+    consume(MDK_version());
+    MDK_AudioStreamCodecParameters(nullptr, &acp);
+    consume(MDK_AudioStreamMetadata(nullptr, &entry));
+    MDK_VideoStreamCodecParameters(nullptr, &vcp);
+    consume(MDK_VideoStreamMetadata(nullptr, &entry));
+    consume(MDK_MediaMetadata(nullptr, &entry));
+    const mdkPlayerAPI *player = mdkPlayerAPI_new();
+    mdkPlayerAPI_delete(&player);
+    mdkVideoFrameAPI *frame = mdkVideoFrameAPI_new(64, 64, MDK_PixelFormat_RGBA);
+    mdkVideoFrameAPI_delete(&frame);
+}
+
+struct HugePageTextResult
+{
+    bool hugePageText = false;
+    bool valid = false;
+    int64_t moved = 0; // bytes
+    int64_t itlbMisses = -1; // -1 if perf_event_open() isn't permitted
+    double nsPerRound = 0;
+};
+
+// iTLB load misses of this thread in user space, -1 if they can't be counted.
+int openITLBMissCounter()
+{
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_ITLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+// iTLB misses of rounds of calls into MDK, loaded with or without its code
+// moved onto huge pages.
+HugePageTextResult measureHugePageText(const char *path, const bool hugePageText)
+{
+    HugePageTextResult result;
+    const bool ok = runInChild([path, hugePageText] {
+        HugePageTextResult child;
+        mdkloaderLoadOptions options = {};
+        options.hugePageText = hugePageText;
+        mdkloaderLoadReport report;
+        child.valid = mdkloader_load_ex(path, &options, nullptr) && mdkloader_loadReport(&report);
+        if (!child.valid) {
+            return child;
+        }
+        child.moved = report.hugePageText;
+        constexpr int rounds = 100000;
+        for (int i = 0; i < 1000; ++i) {
+            callEveryAPI();
+        }
+        const int counter = openITLBMissCounter();
+        if (counter >= 0) {
+            ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        const auto start = Clock::now();
+        for (int i = 0; i < rounds; ++i) {
+            callEveryAPI();
+        }
+        child.nsPerRound = elapsedNanoseconds(start) / rounds;
+        if (counter >= 0) {
+            ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t misses = 0;
+            if (read(counter, &misses, sizeof(misses)) == sizeof(misses)) {
+                child.itlbMisses = static_cast<int64_t>(misses);
+            }
+            close(counter);
+        }
+        return child;
+    }, result);
+    if (!ok) {
+        result = {};
+    }
+    result.hugePageText = hugePageText;
+    return result;
+}
+#endif
+
+struct MediaInfoResult
+{
+    double copyNs = 0; // Player::mediaInfo() rebuilt after a media change, and one metadata lookup
+    double pollNs = 0; // Player::mediaInfo() from the snapshot, and the same lookup
+    double viewNs = 0; // Player::mediaInfoView() and the same lookup
+    double copyAllocations = 0; // per call
+    double pollAllocations = 0;
+    double viewAllocations = 0;
+};
+
+// A probing service: query the MediaInfo of a prepared media and read a few fields.
+MediaInfoResult measureMediaInfo()
+{
+    MediaInfoResult result;
+    mdk::Player player;
+    player.setMedia("stub://probe?metadata=16");
+    player.prepare();
+    const auto deadline = Clock::now() + std::chrono::seconds(5);
+    while (!player.mediaInfoView() && (Clock::now() < deadline)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!player.mediaInfoView()) {
+        return result;
+    }
+    constexpr int iterations = 20000;
+    const auto poll = [&player] {
+        const mdk::MediaInfo &info = player.mediaInfo();
+        consume(info.video.empty() ? 0 : info.video[0].codec.width);
+        const auto it = info.metadata.find("title");
+        consume(it != info.metadata.cend());
+    };
+    // The stub keeps the prepared media on setMedia(), only the snapshot is invalidated.
+    const auto copy = [&player, &poll] {
+        player.setMedia("stub://probe?metadata=16");
+        poll();
+    };
+    const auto view = [&player] {
+        const mdk::MediaInfoView info = player.mediaInfoView();
+        consume(info.video().empty() ? 0 : info.video()[0].codec().width);
+        consume(!info.metadata()["title"].empty());
+    };
+    const auto allocationsPerCall = [](const auto &call) {
+        const uint64_t before = allocationCount.load(std::memory_order_relaxed);
+        for (int i = 0; i < iterations; ++i) {
+            call();
+        }
+        return static_cast<double>(allocationCount.load(std::memory_order_relaxed) - before)
+               / iterations;
+    };
+    result.copyNs = nanosecondsPerCall(iterations, copy);
+    result.pollNs = nanosecondsPerCall(iterations, poll);
+    result.viewNs = nanosecondsPerCall(iterations, view);
+    result.copyAllocations = allocationsPerCall(copy);
+    result.pollAllocations = allocationsPerCall(poll);
+    result.viewAllocations = allocationsPerCall(view);
+    return result;
+}
+
+struct ChannelSwitchResult
+{
+    int openMs = 0; // latency of opening a channel in the stub
+    Summary coldUs; // a new Player configured, setMedia() and prepare() until the prepare callback
+    Summary missUs; // PlayerPool::lease() of a channel which wasn't prefetched, until it's ready
+    Summary hitNs; // PlayerPool::lease() of a prefetched channel which is ready
+    Summary recycleUs; // returning a playing Player to the pool
+};
+
+// Zapping through channels, each new one taking openMs to open.
+ChannelSwitchResult measureChannelSwitch(const int samples, const int openMs)
+{
+    ChannelSwitchResult result;
+    result.openMs = openMs;
+    const auto channel = [openMs](const int index) {
+        return "stub://channel" + std::to_string(index) + "?open_ms=" + std::to_string(openMs);
+    };
+    const auto waitUntil = [](const auto &ready) {
+        const auto deadline = Clock::now() + std::chrono::seconds(5);
+        while (!ready() && (Clock::now() < deadline)) {
+            std::this_thread::yield();
+        }
+        return ready();
+    };
+    const std::vector<std::string> decoders = {"FFmpeg"};
+    std::vector<double> cold;
+    for (int i = 0; i < samples; ++i) {
+        std::atomic<bool> prepared = {false};
+        const auto start = Clock::now();
+        mdk::Player player;
+        player.setVideoDecoders(decoders);
+        player.setBufferRange(0, 1000);
+        player.setMedia(channel(i).c_str());
+        player.prepare(0, [&prepared](int64_t, bool *) {
+            prepared.store(true, std::memory_order_release);
+            return true;
+        });
+        waitUntil([&prepared] { return prepared.load(std::memory_order_acquire); });
+        cold.push_back(elapsedNanoseconds(start) / 1000.0);
+    }
+    mdk::PlayerPool::Config config;
+    config.videoDecoders = decoders;
+    config.bufferMin = 0;
+    mdk::PlayerPool pool(2, config);
+    std::vector<double> miss, hit, recycle;
+    for (int i = 0; i < samples; ++i) {
+        auto start = Clock::now();
+        mdk::PlayerPool::Lease lease = pool.lease(channel(2 * i));
+        waitUntil([&lease] { return lease.status() == mdk::PlayerPool::Ready; });
+        miss.push_back(elapsedNanoseconds(start) / 1000.0);
+        // Watching this channel, the next one is prepared meanwhile.
+        lease->setState(mdk::State::Playing);
+        const std::string next = channel(2 * i + 1);
+        pool.prefetch(next);
+        waitUntil([&pool, &next] { return pool.status(next) == mdk::PlayerPool::Ready; });
+        start = Clock::now();
+        mdk::PlayerPool::Lease nextLease = pool.lease(next);
+        hit.push_back(elapsedNanoseconds(start));
+        start = Clock::now();
+        lease.reset();
+        recycle.push_back(elapsedNanoseconds(start) / 1000.0);
+    }
+    result.coldUs = summarize(cold);
+    result.missUs = summarize(miss);
+    result.hitNs = summarize(hit);
+    result.recycleUs = summarize(recycle);
+    return result;
+}
+
+// VideoFrame create/delete pairs per second, summed over threadCount threads.
+double videoFrameThroughput(const unsigned threadCount)
+{
+    constexpr auto duration = std::chrono::milliseconds(300);
+    std::atomic_bool start = {false};
+    std::atomic<uint64_t> pairs = {0};
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < threadCount; ++i) {
+        threads.emplace_back([&start, &pairs, duration] {
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            uint64_t count = 0;
+            const auto end = Clock::now() + duration;
+            while (Clock::now() < end) {
+                for (int i = 0; i < 64; ++i) {
+                    mdkVideoFrameAPI *frame = mdkVideoFrameAPI_new(1920, 1080, MDK_PixelFormat_RGBA);
+                    mdkVideoFrameAPI_delete(&frame);
+                }
+                count += 64;
+            }
+            pairs += count;
+        });
+    }
+    start.store(true, std::memory_order_release);
+    for (auto &&thread : threads) {
+        thread.join();
+    }
+    return static_cast<double>(pairs) / std::chrono::duration<double>(duration).count();
+}
+
+// Time from releasing threadCount threads, which all call mdkloader_load() at
+// once, until the last one got its result.
+double loadContention(const char *path, const unsigned threadCount)
+{
+    std::atomic_bool start = {false};
+    std::atomic_uint ready = {0};
+    std::vector<Clock::time_point> done(threadCount);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < threadCount; ++i) {
+        threads.emplace_back([&, i] {
+            ++ready;
+            while (!start.load(std::memory_order_acquire)) {
+            }
+            mdkloader_load(path);
+            done[i] = Clock::now();
+        });
+    }
+    while (ready.load() != threadCount) {
+        std::this_thread::yield();
+    }
+    const auto begin = Clock::now();
+    start.store(true, std::memory_order_release);
+    for (auto &&thread : threads) {
+        thread.join();
+    }
+    return elapsedNanoseconds(begin, *std::max_element(done.begin(), done.end())) / 1000.0;
+}
+
+struct ReloadResult
+{
+    unsigned threads = 0;
+    int reloads = 0;
+    int failedReloads = 0;
+    double reloadsPerSecond = 0;
+    double callsPerSecond = 0;
+    uint64_t wrongVersions = 0;
+};
+
+// Readers keep calling into MDK and create/delete Players while the library
+// is swapped back and forth. A Player deleted by the wrong build aborts the
+// stub, a call answered by neither build is counted.
+ReloadResult reloadStress(const char *path, const char *nextPath, const int reloads)
+{
+    ReloadResult result;
+    result.threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    mdkloader_load(path);
+    const int version = mdkloader_api()->MDK_version();
+    mdkloader_reload(nextPath);
+    const int nextVersion = mdkloader_api()->MDK_version();
+    std::atomic_bool stop = {false};
+    std::atomic<uint64_t> calls = {0};
+    std::atomic<uint64_t> wrongVersions = {0};
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < result.threads; ++i) {
+        threads.emplace_back([&] {
+            uint64_t count = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                const mdkPlayerAPI *player = mdkPlayerAPI_new();
+                const int current = MDK_version();
+                if ((current != version) && (current != nextVersion)) {
+                    ++wrongVersions;
+                }
+                mdkPlayerAPI_delete(&player);
+                count += 3;
+            }
+            calls += count;
+        });
+    }
+    const auto start = Clock::now();
+    for (int i = 0; i < reloads; ++i) {
+        if (!mdkloader_reload((i % 2) ? nextPath : path)) {
+            ++result.failedReloads;
+        }
+    }
+    const double seconds = elapsedNanoseconds(start) / 1e9;
+    stop.store(true);
+    for (auto &&thread : threads) {
+        thread.join();
+    }
+    const double totalSeconds = elapsedNanoseconds(start) / 1e9;
+    mdkloader_cleanup();
+    result.reloads = reloads;
+    result.reloadsPerSecond = reloads / seconds;
+    result.callsPerSecond = static_cast<double>(calls) / totalSeconds;
+    result.wrongVersions = wrongVersions;
+    return result;
+}
+
+void printSummary(FILE *out, const char *name, const Summary &summary, const bool last = false)
+{
+    std::fprintf(out,
+                 "    \"%s\": {\"median\": %.3f, \"min\": %.3f, \"max\": %.3f, \"samples\": %zu}%s\n",
+                 name,
+                 summary.median,
+                 summary.min,
+                 summary.max,
+                 summary.samples,
+                 last ? "" : ",");
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    int samples = 10;
+    const char *output = nullptr;
+    const char *path = MDKLOADER_BENCH_STUB;
+    const char *nextPath = MDKLOADER_BENCH_STUB_NEXT;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = (i + 1) < argc;
+        if (!std::strcmp(argv[i], "--samples") && hasValue) {
+            samples = std::max(1, std::atoi(argv[++i]));
+        } else if (!std::strcmp(argv[i], "--output") && hasValue) {
+            output = argv[++i];
+        } else if (!std::strcmp(argv[i], "--stub") && hasValue) {
+            path = argv[++i];
+        } else if (!std::strcmp(argv[i], "--stub-next") && hasValue) {
+            nextPath = argv[++i];
+        } else {
+            std::fprintf(stderr,
+                         "Usage: %s [--samples N] [--output file.json] [--stub path] [--stub-next path]\n",
+                         argv[0]);
+            return 1;
+        }
+    }
+
+    // Everything which needs the library not to be loaded yet comes first.
+    const auto coldLoad = [path](const MDKLoader_BindingMode binding) {
+        return [path, binding] {
+            mdkloaderLoadOptions options = {};
+            options.binding = binding;
+            const auto start = Clock::now();
+            mdkloader_load_ex(path, &options, nullptr);
+            return elapsedNanoseconds(start) / 1000.0;
+        };
+    };
+    const Summary cold = sampleIsolated(samples, coldLoad(MDKLoader_BindingMode_Default));
+    const Summary coldEager = sampleIsolated(samples, coldLoad(MDKLoader_BindingMode_Eager));
+    const Summary coldLazy = sampleIsolated(samples, coldLoad(MDKLoader_BindingMode_Lazy));
+    constexpr unsigned contentionThreads = 64;
+    const Summary contention = sampleIsolated(samples, [path] {
+        return loadContention(path, contentionThreads);
+    });
+#ifndef _WIN32
+    const Summary forkLoading = sampleIsolated(samples, [path] { return forkWorker(path, false); });
+    const Summary forkPrefork = sampleIsolated(samples, [path] { return forkWorker(path, true); });
+#endif
+#ifdef __linux__
+    const std::vector<Footprint> footprints = {
+        measureFootprint(path, "RTLD_LOCAL", RTLD_LOCAL),
+        measureFootprint(path, "RTLD_GLOBAL", RTLD_GLOBAL),
+        measureFootprint(path, "RTLD_LOCAL|RTLD_NODELETE", RTLD_LOCAL | RTLD_NODELETE),
+        measureFootprint(path, "RTLD_GLOBAL|RTLD_NODELETE", RTLD_GLOBAL | RTLD_NODELETE),
+    };
+    const HugePageTextResult smallPages = measureHugePageText(path, false);
+    const HugePageTextResult hugePages = measureHugePageText(path, true);
+#endif
+
+    // Warm: the file is in the page cache and was mapped before.
+    std::vector<double> warmSamples;
+    for (int i = 0; i < samples; ++i) {
+        const auto start = Clock::now();
+        const bool loaded = mdkloader_load(path);
+        warmSamples.push_back(elapsedNanoseconds(start) / 1000.0);
+        if (!loaded) {
+            std::fprintf(stderr, "Failed to load %s\n", path);
+            return 1;
+        }
+        mdkloader_cleanup();
+    }
+    const Summary warm = summarize(warmSamples);
+
+    mdkloader_load(path);
+    const double loadedLoad = nanosecondsPerCall(200000, [path] { consume(mdkloader_load(path)); });
+    const double isLoaded = nanosecondsPerCall(1000000, [] { consume(mdkloader_isLoaded()); });
+    const std::vector<ForwardingResult> forwarding = measureAllForwarding(mdkloader_api());
+    const unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+    const double framesSingle = videoFrameThroughput(1);
+    const double framesMulti = videoFrameThroughput(threadCount);
+    const MediaInfoResult mediaInfo = measureMediaInfo();
+    const ChannelSwitchResult channelSwitch = measureChannelSwitch(samples, 20);
+    mdkloader_cleanup();
+
+    const ReloadResult reload = reloadStress(path, nextPath, 200);
+
+    FILE *out = output ? std::fopen(output, "w") : stdout;
+    if (!out) {
+        std::fprintf(stderr, "Failed to open %s\n", output);
+        return 1;
+    }
+    std::fprintf(out,
+                 "{\n  \"benchmark\": \"mdkloader\",\n  \"build_type\": \"%s\",\n  \"stub\": \"%s\",\n",
+                 MDKLOADER_BENCH_BUILD_TYPE,
+                 path);
+    std::fprintf(out, "  \"load_us\": {\n");
+    printSummary(out, "cold", cold);
+    printSummary(out, "cold_eager", coldEager);
+    printSummary(out, "cold_lazy", coldLazy);
+    printSummary(out, "warm", warm, true);
+    std::fprintf(out, "  },\n");
+    std::fprintf(out,
+                 "  \"load_contention_us\": {\n    \"threads\": %u,\n",
+                 contentionThreads);
+    printSummary(out, "time_to_ready", contention, true);
+    std::fprintf(out, "  },\n");
+#ifndef _WIN32
+    std::fprintf(out, "  \"fork_worker_us\": {\n");
+    printSummary(out, "load_in_worker", forkLoading);
+    printSummary(out, "prefork", forkPrefork, true);
+    std::fprintf(out, "  },\n");
+#endif
+#ifdef __linux__
+    std::fprintf(out, "  \"footprint_kb\": [\n");
+    for (size_t i = 0; i < footprints.size(); ++i) {
+        const Footprint &footprint = footprints[i];
+        std::fprintf(out,
+                     "    {\"flags\": \"%s\", \"loaded\": %s, \"load_file\": %lld, \"load_anon\": %lld, "
+                     "\"libraries\": %d, \"library_file\": %lld, \"library_anon\": %lld, "
+                     "\"retained_after_cleanup\": %lld}%s\n",
+                     footprint.flags,
+                     footprint.valid ? "true" : "false",
+                     static_cast<long long>(footprint.loadDelta.fileRss),
+                     static_cast<long long>(footprint.loadDelta.anonRss),
+                     footprint.libraries,
+                     static_cast<long long>(footprint.libraryRss.fileRss),
+                     static_cast<long long>(footprint.libraryRss.anonRss),
+                     static_cast<long long>(footprint.retainedAfterCleanup),
+                     (i + 1) < footprints.size() ? "," : "");
+    }
+    std::fprintf(out, "  ],\n");
+    std::fprintf(out, "  \"huge_page_text\": [\n");
+    for (const HugePageTextResult *result : {&smallPages, &hugePages}) {
+        char misses[32] = "null";
+        if (result->itlbMisses >= 0) {
+            std::snprintf(misses, sizeof(misses), "%lld", static_cast<long long>(result->itlbMisses));
+        }
+        std::fprintf(out,
+                     "    {\"enabled\": %s, \"loaded\": %s, \"moved_bytes\": %lld, \"itlb_misses\": %s, "
+                     "\"ns_per_round\": %.3f}%s\n",
+                     result->hugePageText ? "true" : "false",
+                     result->valid ? "true" : "false",
+                     static_cast<long long>(result->moved),
+                     misses,
+                     result->nsPerRound,
+                     (result == &smallPages) ? "," : "");
+    }
+    std::fprintf(out, "  ],\n");
+#endif
+    std::fprintf(out, "  \"load_when_loaded_ns\": %.3f,\n", loadedLoad);
+    std::fprintf(out, "  \"isLoaded_ns\": %.3f,\n", isLoaded);
+    std::fprintf(out, "  \"forwarding_ns\": [\n");
+    for (size_t i = 0; i < forwarding.size(); ++i) {
+        const ForwardingResult &result = forwarding[i];
+        std::fprintf(out,
+                     "    {\"api\": \"%s\", \"wrapper\": %.3f, \"direct\": %.3f, \"overhead\": %.3f}%s\n",
+                     result.api,
+                     result.wrapper,
+                     result.direct,
+                     result.wrapper - result.direct,
+                     (i + 1) < forwarding.size() ? "," : "");
+    }
+    std::fprintf(out, "  ],\n");
+    std::fprintf(out,
+                 "  \"videoframe_pairs_per_second\": {\"single_thread\": %.0f, \"threads\": %u, "
+                 "\"all_threads\": %.0f},\n",
+                 framesSingle,
+                 threadCount,
+                 framesMulti);
+    std::fprintf(out,
+                 "  \"media_info\": {\"copy_ns\": %.1f, \"poll_ns\": %.1f, \"view_ns\": %.1f, "
+                 "\"copy_allocations\": %.1f, \"poll_allocations\": %.1f, \"view_allocations\": %.1f},\n",
+                 mediaInfo.copyNs,
+                 mediaInfo.pollNs,
+                 mediaInfo.viewNs,
+                 mediaInfo.copyAllocations,
+                 mediaInfo.pollAllocations,
+                 mediaInfo.viewAllocations);
+    std::fprintf(out, "  \"channel_switch\": {\n    \"open_ms\": %d,\n", channelSwitch.openMs);
+    printSummary(out, "cold_us", channelSwitch.coldUs);
+    printSummary(out, "pool_miss_us", channelSwitch.missUs);
+    printSummary(out, "pool_hit_ns", channelSwitch.hitNs);
+    printSummary(out, "recycle_us", channelSwitch.recycleUs, true);
+    std::fprintf(out, "  },\n");
+    std::fprintf(out,
+                 "  \"reload_stress\": {\"threads\": %u, \"reloads\": %d, \"failed_reloads\": %d, "
+                 "\"reloads_per_second\": %.1f, \"calls_per_second\": %.0f, \"wrong_versions\": %llu}\n",
+                 reload.threads,
+                 reload.reloads,
+                 reload.failedReloads,
+                 reload.reloadsPerSecond,
+                 reload.callsPerSecond,
+                 static_cast<unsigned long long>(reload.wrongVersions));
+    std::fprintf(out, "}\n");
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    return ((reload.failedReloads == 0) && (reload.wrongVersions == 0)) ? 0 : 1;
+}
@@ -13,6 +13,13 @@
 #include <cstring>
 #include <unordered_map>
 #include <vector>
+#if (__cplusplus >= 201703L) || (defined(_MSVC_LANG) && (_MSVC_LANG >= 201703L))
+# define MDK_HAS_MEDIAINFO_VIEW 1
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <string_view>
+#endif
 
 MDK_NS_BEGIN
 
@@ -151,4 +158,236 @@ static void from_c(const mdkMediaInfo* cinfo, MediaInfo* info)
     }
 }
 
+
+#ifdef MDK_HAS_MEDIAINFO_VIEW
+/*!
+  \brief MediaInfoArena
+  Bump allocator for what a MediaInfoView has to copy, i.e. codec parameters and lookup keys
+  which are not null terminated. Memory is only released by the destructor, reset() makes
+  the blocks reusable, so an arena which is reset for every view stops allocating after warm up.
+ */
+class MediaInfoArena {
+public:
+    explicit MediaInfoArena(size_t blockSize = 4096) : block_size_(blockSize) {}
+    MediaInfoArena(const MediaInfoArena&) = delete;
+    MediaInfoArena& operator=(const MediaInfoArena&) = delete;
+
+    // align must be a power of 2, at most alignof(std::max_align_t)
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        for (; block_ < blocks_.size(); ++block_, used_ = 0) {
+            const size_t offset = (used_ + align - 1) & ~(align - 1);
+            if (offset + size <= blocks_[block_].size) {
+                used_ = offset + size;
+                return blocks_[block_].data.get() + offset;
+            }
+        }
+        const size_t blockSize = std::max(block_size_, size);
+        blocks_.push_back(Block{std::unique_ptr<char[]>(new char[blockSize]), blockSize});
+        used_ = size;
+        return blocks_[block_].data.get();
+    }
+
+    // null terminated copy
+    const char* copy(std::string_view value) {
+        auto data = static_cast<char*>(allocate(value.size() + 1, 1));
+        std::memcpy(data, value.data(), value.size());
+        data[value.size()] = 0;
+        return data;
+    }
+
+    void reset() {
+        block_ = 0;
+        used_ = 0;
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    std::vector<Block> blocks_;
+    size_t block_ = 0;
+    size_t used_ = 0;
+    const size_t block_size_;
+};
+
+namespace detail {
+inline std::string_view to_view(const char* value) { return value ? std::string_view(value) : std::string_view(); }
+} // namespace detail
+
+/*!
+  \brief MetadataView
+  Metadata of a media or a stream, looked up in MDK per key instead of copied into a map.
+  Keys and values point into MDK.
+ */
+template<typename C>
+class MetadataView {
+public:
+    using Lookup = bool(*)(const C*, mdkStringMapEntry*);
+
+    MetadataView(const C* info, Lookup lookup, MediaInfoArena* arena) : info_(info), lookup_(lookup), arena_(arena) {}
+
+    // false if there is no such key, value is not touched then
+    bool find(const char* key, std::string_view* value) const {
+        if (!info_ || !key)
+            return false;
+        mdkStringMapEntry entry{};
+        entry.key = key;
+        if (!lookup_(info_, &entry))
+            return false;
+        if (value)
+            *value = detail::to_view(entry.value);
+        return true;
+    }
+    // The key is copied into the arena to be null terminated.
+    bool find(std::string_view key, std::string_view* value) const {
+        return info_ && find(arena_->copy(key), value);
+    }
+    // empty if there is no such key
+    std::string_view operator[](const char* key) const {
+        std::string_view value;
+        find(key, &value);
+        return value;
+    }
+    std::string_view operator[](std::string_view key) const {
+        std::string_view value;
+        find(key, &value);
+        return value;
+    }
+    // f(std::string_view key, std::string_view value) for every entry, in the order of MDK
+    template<typename F>
+    void forEach(F&& f) const {
+        if (!info_)
+            return;
+        mdkStringMapEntry entry{};
+        while (lookup_(info_, &entry))
+            f(detail::to_view(entry.key), detail::to_view(entry.value));
+    }
+
+private:
+    const C* info_;
+    Lookup lookup_;
+    MediaInfoArena* arena_;
+};
+
+/*!
+  \brief InfoRange
+  The streams or chapters of a MediaInfoView, iterated as views over the arrays of MDK.
+ */
+template<typename View, typename C>
+class InfoRange {
+public:
+    class iterator {
+    public:
+        iterator(const C* item, MediaInfoArena* arena) : item_(item), arena_(arena) {}
+        View operator*() const { return View(item_, arena_); }
+        iterator& operator++() { ++item_; return *this; }
+        bool operator==(const iterator& other) const { return item_ == other.item_; }
+        bool operator!=(const iterator& other) const { return item_ != other.item_; }
+    private:
+        const C* item_;
+        MediaInfoArena* arena_;
+    };
+
+    InfoRange(const C* items, int count, MediaInfoArena* arena) : items_(items), count_(items ? count : 0), arena_(arena) {}
+    iterator begin() const { return iterator(items_, arena_); }
+    iterator end() const { return iterator(items_ + count_, arena_); }
+    size_t size() const { return size_t(count_); }
+    bool empty() const { return count_ <= 0; }
+    View operator[](size_t i) const { return View(items_ + i, arena_); }
+
+private:
+    const C* items_;
+    int count_;
+    MediaInfoArena* arena_;
+};
+
+class ChapterView {
+public:
+    ChapterView(const mdkChapterInfo* info, MediaInfoArena*) : info_(info) {}
+    int64_t start_time() const { return info_->start_time; }
+    int64_t end_time() const { return info_->end_time; }
+    std::string_view title() const { return detail::to_view(info_->title); }
+private:
+    const mdkChapterInfo* info_;
+};
+
+class AudioStreamView {
+public:
+    AudioStreamView(const mdkAudioStreamInfo* info, MediaInfoArena* arena) : info_(info), arena_(arena) {}
+    int index() const { return info_->index; }
+    int64_t start_time() const { return info_->start_time; }
+    int64_t duration() const { return info_->duration; }
+    int64_t frames() const { return info_->frames; }
+    MetadataView<mdkAudioStreamInfo> metadata() const { return MetadataView<mdkAudioStreamInfo>(info_, &MDK_AudioStreamMetadata, arena_); }
+    // queried from MDK on every call and copied into the arena
+    const AudioCodecParameters& codec() const {
+        auto c = new (arena_->allocate(sizeof(mdkAudioCodecParameters), alignof(mdkAudioCodecParameters))) mdkAudioCodecParameters{};
+        MDK_AudioStreamCodecParameters(info_, c);
+        return *reinterpret_cast<const AudioCodecParameters*>(c);
+    }
+    const mdkAudioStreamInfo* c() const { return info_; }
+private:
+    const mdkAudioStreamInfo* info_;
+    MediaInfoArena* arena_;
+};
+
+class VideoStreamView {
+public:
+    VideoStreamView(const mdkVideoStreamInfo* info, MediaInfoArena* arena) : info_(info), arena_(arena) {}
+    int index() const { return info_->index; }
+    int64_t start_time() const { return info_->start_time; }
+    int64_t duration() const { return info_->duration; }
+    int64_t frames() const { return info_->frames; }
+    int rotation() const { return info_->rotation; }
+    MetadataView<mdkVideoStreamInfo> metadata() const { return MetadataView<mdkVideoStreamInfo>(info_, &MDK_VideoStreamMetadata, arena_); }
+    // queried from MDK on every call and copied into the arena
+    const VideoCodecParameters& codec() const {
+        auto c = new (arena_->allocate(sizeof(mdkVideoCodecParameters), alignof(mdkVideoCodecParameters))) mdkVideoCodecParameters{};
+        MDK_VideoStreamCodecParameters(info_, c);
+        return *reinterpret_cast<const VideoCodecParameters*>(c);
+    }
+    const mdkVideoStreamInfo* c() const { return info_; }
+private:
+    const mdkVideoStreamInfo* info_;
+    MediaInfoArena* arena_;
+};
+
+/*!
+  \brief MediaInfoView
+  MediaInfo without copying: borrows the structs of MDK in place, metadata is looked up per key.
+  Nothing is allocated except by codec() and lookups with std::string_view keys, which use the arena.
+  Valid as long as the mdkMediaInfo it was created from, see Player::mediaInfoView(). arena can't be null.
+ */
+class MediaInfoView {
+public:
+    MediaInfoView() = default;
+    MediaInfoView(const mdkMediaInfo* info, MediaInfoArena* arena) : info_(info), arena_(arena) {}
+
+    explicit operator bool() const { return info_ != nullptr; }
+    int64_t start_time() const { return info_ ? info_->start_time : 0; } // ms
+    int64_t duration() const { return info_ ? info_->duration : 0; }
+    int64_t bit_rate() const { return info_ ? info_->bit_rate : 0; }
+    int64_t size() const { return info_ ? info_->size : 0; }
+    std::string_view format() const { return info_ ? detail::to_view(info_->format) : std::string_view(); }
+    int streams() const { return info_ ? info_->streams : 0; }
+
+    MetadataView<mdkMediaInfo> metadata() const { return MetadataView<mdkMediaInfo>(info_, &MDK_MediaMetadata, arena_); }
+    InfoRange<ChapterView, mdkChapterInfo> chapters() const {
+        return InfoRange<ChapterView, mdkChapterInfo>(info_ ? info_->chapters : nullptr, info_ ? info_->nb_chapters : 0, arena_);
+    }
+    InfoRange<AudioStreamView, mdkAudioStreamInfo> audio() const {
+        return InfoRange<AudioStreamView, mdkAudioStreamInfo>(info_ ? info_->audio : nullptr, info_ ? info_->nb_audio : 0, arena_);
+    }
+    InfoRange<VideoStreamView, mdkVideoStreamInfo> video() const {
+        return InfoRange<VideoStreamView, mdkVideoStreamInfo>(info_ ? info_->video : nullptr, info_ ? info_->nb_video : 0, arena_);
+    }
+    const mdkMediaInfo* c() const { return info_; }
+
+private:
+    const mdkMediaInfo* info_ = nullptr;
+    MediaInfoArena* arena_ = nullptr;
+};
+#endif // MDK_HAS_MEDIAINFO_VIEW
+
 MDK_NS_END
\ No newline at end of file
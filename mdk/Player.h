@@ -13,13 +13,49 @@
 #include "RenderAPI.h"
 #include "c/Player.h"
 #include "VideoFrame.h"
+#include <atomic>
 #include <cinttypes>
 #include <cstdlib>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
+#ifdef MDKLOADER_ENABLE_TRACE
+#include "../mdkloader.h"
+#endif
 
 MDK_NS_BEGIN
 
+#ifdef MDKLOADER_ENABLE_TRACE
+namespace detail {
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name_(name) { mdkloader_traceBegin(name_); }
+    ~TraceScope() { mdkloader_traceEnd(name_); }
+private:
+    const char* name_;
+};
+} // namespace detail
+# define MDK_TRACE_SCOPE(name) const MDK_NS_PREPEND(detail::TraceScope) mdk_trace_scope(name)
+#else
+# define MDK_TRACE_SCOPE(name)
+#endif
+
+#ifdef MDKLOADER_ENABLE_USDT
+namespace detail {
+class ProbeScope {
+public:
+    explicit ProbeScope(const char* name) : name_(name) { MDK_PROBE(callback__entry, name_); }
+    ~ProbeScope() { MDK_PROBE(callback__return, name_); }
+private:
+    const char* name_;
+};
+} // namespace detail
+# define MDK_PROBE_SCOPE(name) const MDK_NS_PREPEND(detail::ProbeScope) mdk_probe_scope(name)
+#else
+# define MDK_PROBE_SCOPE(name)
+#endif
+
 /*!
   \brief PrepareCallback
   \param position in callback is the actual position, or <0 (TODO: error code as position) if prepare() failed.
@@ -45,7 +81,31 @@ public:
 
     Player(const Player&) = delete;
     Player& operator=(const Player&) = delete;
-    Player() : p(mdkPlayerAPI_new()) {}
+    Player() : p(mdkPlayerAPI_new()) {
+        if (!p)
+            return;
+        // Installed once, MDK adds a status callback per call. They invalidate the MediaInfo snapshot and
+        // forward to the callbacks set by user, which are only swapped afterwards.
+        mdkCurrentMediaChangedCallback current;
+        current.cb = [](void* opaque){
+            auto player = (Player*)opaque;
+            player->info_cache_.version.fetch_add(1, std::memory_order_release);
+            if (player->current_cb_)
+                player->current_cb_();
+        };
+        current.opaque = this;
+        MDK_CALL(p, currentMediaChanged, current);
+        mdkMediaStatusChangedCallback status;
+        status.cb = [](MDK_MediaStatus value, void* opaque){
+            auto player = (Player*)opaque;
+            const int previous = player->info_cache_.status.exchange(value, std::memory_order_relaxed);
+            if ((value & MDK_MediaStatus_Loaded) && !(previous & MDK_MediaStatus_Loaded))
+                player->info_cache_.version.fetch_add(1, std::memory_order_release);
+            return player->status_cb_ ? player->status_cb_(MediaStatus(value)) : true;
+        };
+        status.opaque = this;
+        MDK_CALL(p, onMediaStatusChanged, status);
+    }
     ~Player() {
         mdkPlayerAPI_delete(&p);
     }
@@ -97,13 +157,6 @@ public:
  */
     void currentMediaChanged(std::function<void()> cb) { // call before setMedia()
         current_cb_ = cb;
-        mdkCurrentMediaChangedCallback callback;
-        callback.cb = [](void* opaque){
-            auto f = (std::function<void()>*)opaque;
-            (*f)();
-        };
-        callback.opaque = current_cb_ ? (void*)&current_cb_ : nullptr;
-        MDK_CALL(p, currentMediaChanged, callback);
     }
 
     // backends can be: AudioQueue(Apple only), OpenSL(Android only), ALSA(linux only), XAudio2(Windows only), OpenAL
@@ -158,9 +211,12 @@ public:
   For accurate seek(no flag SeekFlag::Fast), the first frame is the nearest frame whose timestamp <= startPosition, but the position passed to callback is the key frame position <= startPosition
  */
     void prepare(int64_t startPosition = 0, PrepareCallback cb = nullptr, SeekFlag flags = SeekFlag::FromStart) {
+        MDK_TRACE_SCOPE("Player::prepare");
         prepare_cb_ = cb;
         mdkPrepareCallback callback;
         callback.cb = [](int64_t position, bool* boost, void* opaque){
+            MDK_TRACE_SCOPE("Player prepare callback");
+            MDK_PROBE_SCOPE("prepare");
             auto f = (PrepareCallback*)opaque;
             return (*f)(position, boost);
         };
@@ -168,11 +224,38 @@ public:
         MDK_CALL(p, prepare, startPosition, callback, MDKSeekFlag(flags));
     }
 
+/*!
+  \brief mediaInfo
+  An immutable snapshot, rebuilt only after currentMediaChanged or after MediaStatus gained Loaded. Polling it
+  from any thread costs two atomic loads. The reference stays valid until the snapshot after the next one is
+  published, i.e. until the second media change after this call. Use mediaInfoSnapshot() to keep one longer.
+ */
     const MediaInfo& mediaInfo() const {
-        from_c(MDK_CALL(p, mediaInfo), &info_);
-        return info_;
+        const uint64_t version = info_cache_.version.load(std::memory_order_acquire);
+        if (info_cache_.built.load(std::memory_order_acquire) == version)
+            return *info_cache_.current.load(std::memory_order_acquire);
+        return *updateMediaInfo();
     }
 
+    std::shared_ptr<const MediaInfo> mediaInfoSnapshot() const {
+        const uint64_t version = info_cache_.version.load(std::memory_order_acquire);
+        if (info_cache_.built.load(std::memory_order_acquire) != version)
+            return updateMediaInfo();
+        std::lock_guard<std::mutex> lock(info_cache_.mutex);
+        return info_cache_.snapshot;
+    }
+#ifdef MDK_HAS_MEDIAINFO_VIEW
+/*!
+  \brief mediaInfoView
+  mediaInfo() without copying, see MediaInfoView. Valid until the media changes, and until the next
+  mediaInfoView() call which recycles the arena of this Player. Not thread safe.
+ */
+    MediaInfoView mediaInfoView() const {
+        info_arena_.reset();
+        return MediaInfoView(MDK_CALL(p, mediaInfo), &info_arena_);
+    }
+#endif
+
 /*!
   \brief setState
   Request a new state. It's async and may take effect later.
@@ -213,18 +296,11 @@ public:
     }
 /*!
   \brief onMediaStatusChanged
-  Add a callback to be invoked when MediaStatus is changed
-  \param cb null to clear callbacks. return true
+  Set the callback to be invoked when MediaStatus is changed, replacing the previous one
+  \param cb null to clear the callback. return true
  */
     Player& onMediaStatusChanged(std::function<bool(MediaStatus)> cb) {
         status_cb_ = cb;
-        mdkMediaStatusChangedCallback callback;
-        callback.cb = [](MDK_MediaStatus value, void* opaque){
-            auto f = (std::function<bool(MediaStatus)>*)opaque;
-            return (*f)(MediaStatus(value));
-        };
-        callback.opaque = status_cb_ ? (void*)&status_cb_ : nullptr;
-        MDK_CALL(p, onMediaStatusChanged, callback);
         return *this;
     }
 
@@ -288,9 +364,11 @@ public:
   So for a foreign context, if renderer's surface/window/widget is invisible or minimized, snapshot may do nothing because of system or gui toolkit painting optimization.
 */
     void snapshot(SnapshotRequest* request, SnapshotCallback cb, void* vo_opaque = nullptr) {
+        MDK_TRACE_SCOPE("Player::snapshot");
         snapshot_cb_ = cb;
         mdkSnapshotCallback callback;
         callback.cb = [](mdkSnapshotRequest* req, double frameTime, void* opaque){
+            MDK_TRACE_SCOPE("Player snapshot callback");
             auto f = (SnapshotCallback*)opaque;
             auto file = (*f)((SnapshotRequest*)req, frameTime);
             if (file.empty())
@@ -482,9 +560,12 @@ NOTE:
   \param cb callback to be invoked when seek finished(ret >= 0), error occured(ret < 0, usually -1) or skipped because of unfinished previous seek(ret == -2)
  */
     bool seek(int64_t pos, SeekFlag flags, std::function<void(int64_t)> cb = nullptr) {
+        MDK_TRACE_SCOPE("Player::seek");
         seek_cb_ = cb;
         mdkSeekCallback callback;
         callback.cb = [](int64_t ms, void* opaque){
+            MDK_TRACE_SCOPE("Player seek callback");
+            MDK_PROBE_SCOPE("seek");
             auto f = (std::function<void(int64_t)>*)opaque;
             (*f)(ms);
         };
@@ -579,6 +660,8 @@ NOTE:
             static CallbackToken k = 1;
             event_cb_[k] = cb;
             callback.cb = [](const mdkMediaEvent* me, void* opaque){
+                MDK_TRACE_SCOPE("Player event callback");
+                MDK_PROBE_SCOPE("event");
                 auto f = (std::function<bool(const MediaEvent&)>*)opaque;
                 MediaEvent e;
                 e.error = me->error;
@@ -674,6 +757,31 @@ NOTE:
         return *this;
     }
 private:
+    std::shared_ptr<const MediaInfo> updateMediaInfo() const {
+        std::lock_guard<std::mutex> lock(info_cache_.mutex);
+        const uint64_t version = info_cache_.version.load(std::memory_order_acquire);
+        if (info_cache_.built.load(std::memory_order_relaxed) != version) {
+            auto info = std::make_shared<MediaInfo>();
+            from_c(MDK_CALL(p, mediaInfo), info.get());
+            info_cache_.previous = std::move(info_cache_.snapshot);
+            info_cache_.snapshot = std::move(info);
+            info_cache_.current.store(info_cache_.snapshot.get(), std::memory_order_release);
+            info_cache_.built.store(version, std::memory_order_release);
+        }
+        return info_cache_.snapshot;
+    }
+
+    // Readers see current once built matches version, the callbacks bump version.
+    struct MediaInfoCache {
+        std::mutex mutex; // serializes rebuilds, guards the shared pointers
+        std::atomic<uint64_t> version{1};
+        std::atomic<uint64_t> built{0};
+        std::atomic<const MediaInfo*> current{nullptr};
+        std::atomic<int> status{0};
+        std::shared_ptr<const MediaInfo> snapshot;
+        std::shared_ptr<const MediaInfo> previous; // keeps references from mediaInfo() valid across one change
+    };
+
     const mdkPlayerAPI* p = nullptr;
     std::function<void()> current_cb_ = nullptr;
     std::function<bool(int64_t ms)> timeout_cb_ = nullptr;
@@ -691,7 +799,10 @@ private:
     std::map<CallbackToken, std::function<void(int)>> loop_cb_; // rb tree, elements never destroyed
     std::map<CallbackToken,CallbackToken> loop_cb_key_;
 
-    mutable MediaInfo info_;
+    mutable MediaInfoCache info_cache_;
+#ifdef MDK_HAS_MEDIAINFO_VIEW
+    mutable MediaInfoArena info_arena_;
+#endif
 };
 
 
@@ -701,6 +812,8 @@ inline Player& Player::onFrame(std::function<int(VideoFrame&, int/*track*/)> cb)
     video_cb_ = cb;
     mdkVideoCallback callback;
     callback.cb = [](mdkVideoFrameAPI** pFrame/*in/out*/, int track, void* opaque){
+        MDK_TRACE_SCOPE("Player video frame callback");
+        MDK_PROBE_SCOPE("frame");
         VideoFrame frame;
         frame.attach(*pFrame);
         auto f = (std::function<int(VideoFrame&, int)>*)opaque;
@@ -0,0 +1,278 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2020 by wangwenx190 (Yuhang Zhao)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include "Player.h"
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+MDK_NS_BEGIN
+
+/*!
+  \brief PlayerPool
+  A fixed set of Players for switching channels without the latency of creating a Player and loading a media.
+  Players are created and configured once, then reused. prefetch() prepares a likely next channel in a spare
+  Player, which waits paused at its first frame. lease() hands that Player out without any call into MDK, or
+  starts preparing the channel in the least recently prefetched spare Player if it wasn't prefetched.
+  A Lease returns its Player when it's destroyed: the media is stopped, the callbacks set by the holder are
+  removed, and the Player becomes the first spare to be reused.
+  The pool MUST outlive its leases. Renderers of a leased Player are not released, call
+  setVideoSurfaceSize(-1, -1) in the right context before returning it if needed.
+ */
+class PlayerPool {
+    struct Slot;
+public:
+    enum Status {
+        Idle, // no media
+        Preparing,
+        Ready, // paused at the first frame
+        Failed, // prepare() failed
+    };
+
+    struct Config {
+        std::vector<std::string> videoDecoders; // setVideoDecoders(), empty for the default
+        std::vector<std::string> audioDecoders; // setAudioDecoders(), empty for the default
+        int64_t bufferMin = 1000; // setBufferRange()
+        int64_t bufferMax = 2000;
+        bool bufferDrop = false;
+        bool boost = true; // set in PrepareCallback, renders the first frame as soon as possible
+        std::function<void(Player&)> setup; // called for every new Player after the above, can be null
+    };
+
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease(Lease&& other) noexcept : pool_(other.pool_), slot_(other.slot_) { other.slot_ = nullptr; }
+        Lease& operator=(Lease&& other) noexcept {
+            if (this != &other) {
+                reset();
+                pool_ = other.pool_;
+                slot_ = other.slot_;
+                other.slot_ = nullptr;
+            }
+            return *this;
+        }
+        ~Lease() { reset(); }
+
+        explicit operator bool() const { return slot_ != nullptr; }
+        Player* get() const { return slot_ ? slot_->player.get() : nullptr; }
+        Player* operator->() const { return get(); }
+        Player& operator*() const { return *get(); }
+        // of the prepare() started by the pool. Ready means setState(State::Playing) shows the first frame at once.
+        Status status() const { return slot_ ? statusOf(slot_->state.load(std::memory_order_acquire)) : Idle; }
+        // returns the Player to the pool
+        void reset() {
+            if (slot_)
+                pool_->recycle(slot_);
+            slot_ = nullptr;
+        }
+
+    private:
+        friend class PlayerPool;
+        Lease(PlayerPool* pool, Slot* slot) : pool_(pool), slot_(slot) {}
+
+        PlayerPool* pool_ = nullptr;
+        Slot* slot_ = nullptr;
+    };
+
+    explicit PlayerPool(size_t size) : PlayerPool(size, Config()) {}
+    PlayerPool(size_t size, const Config& config) : boost_(config.boost) {
+        for (size_t i = 0; i < size; ++i) {
+            std::unique_ptr<Slot> slot(new Slot());
+            slot->player.reset(new Player());
+            Player& player = *slot->player;
+            if (!config.videoDecoders.empty())
+                player.setVideoDecoders(config.videoDecoders);
+            if (!config.audioDecoders.empty())
+                player.setAudioDecoders(config.audioDecoders);
+            player.setBufferRange(config.bufferMin, config.bufferMax, config.bufferDrop);
+            if (config.setup)
+                config.setup(player);
+            slot->position = spare_.insert(spare_.end(), slot.get());
+            slots_.push_back(std::move(slot));
+        }
+        prepared_.reserve(size);
+    }
+    PlayerPool(const PlayerPool&) = delete;
+    PlayerPool& operator=(const PlayerPool&) = delete;
+
+    size_t size() const { return slots_.size(); }
+
+    size_t spare() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return spare_.size();
+    }
+
+    Status status(const std::string& url) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto it = prepared_.find(url);
+        return it == prepared_.cend() ? Idle : statusOf(it->second->state.load(std::memory_order_acquire));
+    }
+
+/*!
+  \brief prefetch
+  Prepare url in a spare Player in the background, unless it's prepared already. The least recently prefetched
+  spare Player is reused, so prefetch the likely next channels in increasing order of likelihood, e.g. the most
+  likely last.
+  \return false if every Player is leased
+ */
+    bool prefetch(const std::string& url) {
+        Slot* slot = nullptr;
+        uint64_t state = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const auto it = prepared_.find(url);
+            if (it != prepared_.cend()) {
+                slot = it->second;
+                if (statusOf(slot->state.load(std::memory_order_acquire)) == Failed)
+                    state = reserve(slot, url);
+            } else {
+                if (spare_.empty())
+                    return false;
+                slot = take();
+                state = reserve(slot, url);
+                prepared_.emplace(url, slot);
+            }
+            spare_.splice(spare_.end(), spare_, slot->position);
+        }
+        if (state)
+            load(slot, url, state);
+        return true;
+    }
+
+/*!
+  \brief lease
+  Hand out a Player for url, prepared by prefetch() if it was called for url, otherwise preparing now.
+  The Player is paused, call setState(State::Playing). O(1), unless url has to be prepared.
+  \return an empty Lease if every Player is leased
+ */
+    Lease lease(const std::string& url) {
+        Slot* slot = nullptr;
+        uint64_t state = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const auto it = prepared_.find(url);
+            if (it != prepared_.cend()) {
+                slot = it->second;
+                prepared_.erase(it);
+                state = slot->state.load(std::memory_order_acquire);
+                if (statusOf(state) == Failed)
+                    state = reserve(slot, url);
+            } else {
+                if (spare_.empty())
+                    return Lease();
+                slot = take();
+                state = reserve(slot, url);
+            }
+            leased_.splice(leased_.end(), spare_, slot->position);
+        }
+        // Also if prefetched, the prefetch() may not have called into MDK yet and must not race with the holder.
+        load(slot, url, state);
+        return Lease(this, slot);
+    }
+
+private:
+    struct Slot {
+        std::string url; // prepared or preparing, empty if idle
+        std::atomic<uint64_t> state{Idle}; // generation * 4 + Status
+        std::list<Slot*>::iterator position; // in spare_ or leased_
+        std::mutex mutex; // serializes load() of concurrent prefetch() and lease() calls
+        uint64_t started = 0; // generation load() called prepare() for, guarded by mutex
+        std::unique_ptr<Player> player; // destroyed first, its prepare callback refers to the slot
+    };
+
+    static Status statusOf(uint64_t state) { return Status(state & 3); }
+
+    // The least recently prefetched spare, forgetting its media.
+    Slot* take() {
+        Slot* slot = spare_.front();
+        if (!slot->url.empty())
+            prepared_.erase(slot->url);
+        return slot;
+    }
+
+    // Called with mutex_ held. A new generation makes callbacks of the previous prepare() no-ops, if MDK still
+    // runs them after stopping.
+    uint64_t reserve(Slot* slot, const std::string& url) {
+        const uint64_t state = (slot->state.load(std::memory_order_relaxed) | 3) + 1 + Preparing;
+        slot->state.store(state, std::memory_order_release);
+        slot->url = url;
+        return state;
+    }
+
+    // Called without mutex_ held, like recycle(). Nothing to do if the generation of state has been loaded
+    // already, or superseded by a later reserve() or recycle().
+    void load(Slot* slot, const std::string& url, uint64_t state) {
+        const uint64_t generation = state >> 2;
+        std::lock_guard<std::mutex> lock(slot->mutex);
+        if (slot->started == generation || slot->state.load(std::memory_order_acquire) >> 2 != generation)
+            return;
+        slot->started = generation;
+        state = generation * 4 + Preparing;
+        Player& player = *slot->player;
+        player.setState(State::Stopped);
+        player.setMedia(url.c_str());
+        const bool boost = boost_;
+        player.prepare(0, [slot, state, boost](int64_t position, bool* pBoost) {
+            uint64_t expected = state;
+            if (slot->state.compare_exchange_strong(expected, state - Preparing + (position < 0 ? Failed : Ready),
+                                                    std::memory_order_acq_rel))
+                *pBoost = boost;
+            return true;
+        });
+    }
+
+    void recycle(Slot* slot) {
+        // Outside the lock, callbacks of the holder may be running until the media is stopped.
+        Player& player = *slot->player;
+        player.setState(State::Stopped);
+        player.onStateChanged(nullptr);
+        player.onMediaStatusChanged(nullptr);
+        player.currentMediaChanged(nullptr);
+        player.onEvent(nullptr);
+        player.onFrame<VideoFrame>(nullptr);
+        player.setRenderCallback(nullptr);
+        player.setMedia("");
+        slot->state.store((slot->state.load(std::memory_order_relaxed) | 3) + 1 + Idle, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(mutex_);
+        slot->url.clear();
+        spare_.splice(spare_.begin(), leased_, slot->position);
+    }
+
+    const bool boost_;
+    std::vector<std::unique_ptr<Slot>> slots_;
+    mutable std::mutex mutex_;
+    std::list<Slot*> spare_; // least recently prefetched first
+    std::list<Slot*> leased_;
+    std::unordered_map<std::string, Slot*> prepared_; // spares by url
+};
+
+MDK_NS_END
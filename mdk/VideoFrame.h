@@ -64,6 +64,7 @@ public:
  */
     VideoFrame(int width, int height, PixelFormat format, int* strides/*in/out*/ = nullptr, uint8_t const** const data/*in/out*/ = nullptr) {
         p = mdkVideoFrameAPI_new(width, height, MDK_PixelFormat(format));
+        MDK_PROBE(videoframe__new, (void*)p, width, height, int(format));
         if (data)
             MDK_CALL(p, setBuffers, data, strides);
     }
@@ -71,13 +72,17 @@ public:
     VideoFrame(mdkVideoFrameAPI* pp) : p(pp) {}
 
     ~VideoFrame() {
-        if (owner_)
+        if (owner_ && p) {
+            MDK_PROBE(videoframe__delete, (void*)p);
             mdkVideoFrameAPI_delete(&p);
+        }
     }
 
     void attach(mdkVideoFrameAPI* api) {
-        if (owner_)
+        if (owner_ && p) {
+            MDK_PROBE(videoframe__delete, (void*)p);
             mdkVideoFrameAPI_delete(&p);
+        }
         p = api;
         owner_ = false;
     }
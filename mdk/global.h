@@ -24,6 +24,14 @@
 
 #define MDK_CALL(p, FN, ...) (assert(p->FN && "NOT IMPLEMENTED"), p->FN(p->object, ##__VA_ARGS__))
 
+// USDT probes of the provider mdkloader, nops unless MDKLOADER_ENABLE_USDT is defined.
+#ifdef MDKLOADER_ENABLE_USDT
+#include <sys/sdt.h>
+# define MDK_PROBE(name, ...) STAP_PROBEV(mdkloader, name, __VA_ARGS__)
+#else
+# define MDK_PROBE(name, ...)
+#endif
+
 MDK_NS_BEGIN
 constexpr double TimestampEOS = DBL_MAX;
 constexpr double TimeScaleForInt = 1000.0; // ms
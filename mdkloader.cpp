@@ -26,195 +26,3646 @@
 #define MDK_WINDOWS
 #else
 #define MDK_UNIX
+#ifdef __linux__
+#define MDK_LINUX
 #endif
+#endif
+
+#include "mdkloader.h"
+#include "mdk/c/MediaInfo.h"
+#include "mdk/c/Player.h"
+#include "mdk/c/VideoFrame.h"
+#include "mdk/c/global.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#ifdef MDK_WINDOWS
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <pthread.h>
+#endif
+#ifdef MDK_LINUX
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#endif
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef MDKLOADER_ENABLE_USDT
+#include <sys/sdt.h>
+#endif
+
+namespace {
+
+#ifndef MDK_HANDLE
+#ifdef MDK_WINDOWS
+#define MDK_HANDLE HMODULE
+#else
+#define MDK_HANDLE void *
+#endif
+#endif
+
+#ifndef MDKLOADER_GETPROCADDRESS
+#ifdef MDK_WINDOWS
+#define MDKLOADER_GETPROCADDRESS GetProcAddress
+#else
+#define MDKLOADER_GETPROCADDRESS dlsym
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MDKLOADER_PRINTF_FORMAT(formatIndex, firstArg) \
+    __attribute__((format(printf, formatIndex, firstArg)))
+#define MDKLOADER_NOINLINE __attribute__((noinline))
+// Inlined into the caller together with everything it calls, whatever the
+// inliner budget of this large translation unit has left.
+#define MDKLOADER_HOT_PATH __attribute__((always_inline, flatten))
+#else
+#define MDKLOADER_PRINTF_FORMAT(formatIndex, firstArg)
+#define MDKLOADER_NOINLINE __declspec(noinline)
+#define MDKLOADER_HOT_PATH __forceinline
+#endif
+
+// USDT probes of the provider mdkloader, nops unless the library is built with
+// MDKLOADER_ENABLE_USDT. See the README for the list.
+#ifndef MDKLOADER_PROBE
+#ifdef MDKLOADER_ENABLE_USDT
+#define MDKLOADER_PROBE(name, ...) STAP_PROBEV(mdkloader, name, __VA_ARGS__)
+#else
+#define MDKLOADER_PROBE(name, ...)
+#endif
+#endif
+
+void writeToStderr(MDKLoader_LogLevel, const char *message, void *)
+{
+    std::fprintf(stderr, "MDKLoader: %s\n", message);
+}
+
+// Messages are rare, a lock keeps the callback and its opaque pointer consistent.
+std::mutex logSinkMutex;
+mdkloaderLogSink logSink = {writeToStderr, nullptr, MDKLoader_LogLevel_Warning};
+
+// Formats into a stack buffer, nothing is allocated and nothing is formatted
+// unless the sink wants the message. Long messages are truncated.
+MDKLOADER_PRINTF_FORMAT(2, 3)
+void logMessage(const MDKLoader_LogLevel level, const char *format, ...)
+{
+    std::lock_guard<std::mutex> locker(logSinkMutex);
+    if (!logSink.cb || (level > logSink.level)) {
+        return;
+    }
+    char message[512];
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    logSink.cb(level, message, logSink.opaque);
+}
+
+// Copies as much of source as fits, always null terminated.
+void copyString(char *destination, const size_t size, const char *source)
+{
+    std::snprintf(destination, size, "%s", source ? source : "");
+}
+
+// Every MDK API forwarded by this library, as (funcName, resultType, argumentTypes...).
+#define MDKLOADER_FOREACH_MDKAPI(F) \
+    /* global.h */ \
+    F(MDK_javaVM, void *, void *) \
+    F(MDK_setLogLevel, void, MDK_LogLevel) \
+    F(MDK_logLevel, MDK_LogLevel) \
+    F(MDK_setLogHandler, void, mdkLogHandler) \
+    F(MDK_setGlobalOptionString, void, const char *, const char *) \
+    F(MDK_setGlobalOptionInt32, void, const char *, int) \
+    F(MDK_setGlobalOptionPtr, void, const char *, void *) \
+    F(MDK_strdup, char *, const char *) \
+    F(MDK_version, int) \
+    /* MediaInfo.h */ \
+    F(MDK_AudioStreamCodecParameters, void, const mdkAudioStreamInfo *, mdkAudioCodecParameters *) \
+    F(MDK_AudioStreamMetadata, bool, const mdkAudioStreamInfo *, mdkStringMapEntry *) \
+    F(MDK_VideoStreamCodecParameters, void, const mdkVideoStreamInfo *, mdkVideoCodecParameters *) \
+    F(MDK_VideoStreamMetadata, bool, const mdkVideoStreamInfo *, mdkStringMapEntry *) \
+    F(MDK_MediaMetadata, bool, const mdkMediaInfo *, mdkStringMapEntry *) \
+    /* Player.h */ \
+    F(mdkPlayerAPI_new, const mdkPlayerAPI *) \
+    F(mdkPlayerAPI_delete, void, const struct mdkPlayerAPI **) \
+    F(MDK_foreignGLContextDestroyed, void) \
+    /* VideoFrame.h */ \
+    F(mdkVideoFrameAPI_new, mdkVideoFrameAPI *, int, int, enum MDK_PixelFormat) \
+    F(mdkVideoFrameAPI_delete, void, struct mdkVideoFrameAPI **)
+
+#ifndef MDKLOADER_GENERATE_MDKAPI
+#define MDKLOADER_GENERATE_MDKAPI(funcName, resultType, ...) \
+    using _MDKLOADER_MDKAPI_##funcName = resultType (*)(__VA_ARGS__); \
+    std::atomic<_MDKLOADER_MDKAPI_##funcName> m_lp##funcName = {nullptr};
+#endif
+
+#ifndef MDKLOADER_GENERATE_MDKAPI_INDEX
+#define MDKLOADER_GENERATE_MDKAPI_INDEX(funcName, ...) MDKAPI_##funcName,
+#endif
+
+#ifndef MDKLOADER_GENERATE_MDKAPI_NAME
+#define MDKLOADER_GENERATE_MDKAPI_NAME(funcName, ...) #funcName,
+#endif
+
+#ifndef MDKLOADER_GENERATE_MDKAPI_HASH
+#define MDKLOADER_GENERATE_MDKAPI_HASH(funcName, ...) gnuHash(#funcName),
+#endif
+
+// Missing symbols are also listed in the load report.
+#ifndef MDKLOADER_RESOLVE_ERROR
+#define MDKLOADER_RESOLVE_ERROR(table, funcName) \
+    if (!table->m_lp##funcName) { \
+        logMessage(MDKLoader_LogLevel_Warning, "Failed to resolve symbol %s", #funcName); \
+    }
+#endif
+
+#ifndef MDKLOADER_RESOLVE_MDKAPI
+#define MDKLOADER_RESOLVE_MDKAPI(funcName, ...) \
+    if (lazy) { \
+        table->m_lp##funcName.store(&MDKAPISignature<MDKAPITable::_MDKLOADER_MDKAPI_##funcName>:: \
+                                        lazyBind<&MDKAPITable::m_lp##funcName, MDKAPI_##funcName>, \
+                                    std::memory_order_relaxed); \
+    } else if (!table->m_lp##funcName) { \
+        table->m_lp##funcName.store(reinterpret_cast<MDKAPITable::_MDKLOADER_MDKAPI_##funcName>( \
+                                        resolver.resolve(MDKAPI_##funcName)), \
+                                    std::memory_order_relaxed); \
+        MDKLOADER_RESOLVE_ERROR(table, funcName) \
+    } \
+    if (table->m_lp##funcName) { \
+        table->resolvedMask |= (MDKAPIMask(1) << MDKAPI_##funcName); \
+    }
+#endif
+
+#ifndef MDKLOADER_GENERATE_DIRECT_MDKAPI
+#define MDKLOADER_GENERATE_DIRECT_MDKAPI(funcName, ...) \
+    if (table->binding == MDKLoader_BindingMode_Lazy) { \
+        table->m_lp##funcName.store(reinterpret_cast<MDKAPITable::_MDKLOADER_MDKAPI_##funcName>( \
+                                        resolver.resolve(MDKAPI_##funcName)), \
+                                    std::memory_order_relaxed); \
+    } \
+    table->api.funcName = table->m_lp##funcName.load(std::memory_order_relaxed);
+#endif
+
+// Compiles to nothing unless the library is built with MDKLOADER_ENABLE_STATS.
+#ifndef MDKLOADER_COUNT_MDKAPI_CALL
+#ifdef MDKLOADER_ENABLE_STATS
+#define MDKLOADER_COUNT_MDKAPI_CALL(funcName) const CallTimer callTimer(MDKAPI_##funcName);
+#else
+#define MDKLOADER_COUNT_MDKAPI_CALL(funcName)
+#endif
+#endif
+
+// Compiles to nothing unless the library is built with MDKLOADER_ENABLE_TRACE.
+#ifndef MDKLOADER_TRACE_MDKAPI_CALL
+#ifdef MDKLOADER_ENABLE_TRACE
+#define MDKLOADER_TRACE_MDKAPI_CALL(funcName) const TraceScope traceScope(#funcName);
+#else
+#define MDKLOADER_TRACE_MDKAPI_CALL(funcName)
+#endif
+#endif
+
+// Compiles to nothing unless the library is built with MDKLOADER_ENABLE_USDT.
+#ifndef MDKLOADER_PROBE_MDKAPI_CALL
+#ifdef MDKLOADER_ENABLE_USDT
+#define MDKLOADER_PROBE_MDKAPI_CALL(funcName) const ProbeScope probeScope(MDKAPI_##funcName);
+#else
+#define MDKLOADER_PROBE_MDKAPI_CALL(funcName)
+#endif
+#endif
+
+// Compiles to nothing unless the library is built with MDKLOADER_ENABLE_CAPTURE.
+#ifndef MDKLOADER_CAPTURE_MDKAPI_CALL
+#ifdef MDKLOADER_ENABLE_CAPTURE
+#define MDKLOADER_CAPTURE_MDKAPI_CALL(funcName, ...) \
+    CaptureMDKAPI<MDKAPITable::_MDKLOADER_MDKAPI_##funcName, MDKAPI_##funcName>::record(__VA_ARGS__);
+#else
+#define MDKLOADER_CAPTURE_MDKAPI_CALL(funcName, ...)
+#endif
+#endif
+
+// The slots only ever hold code addresses of a library which was mapped before
+// the table got published, so the acquire load of the table itself is enough
+// and reading a slot can be relaxed.
+#ifndef MDKLOADER_EXECUTE_MDKAPI
+#define MDKLOADER_EXECUTE_MDKAPI(funcName, ...) \
+    MDKLOADER_COUNT_MDKAPI_CALL(funcName) \
+    MDKLOADER_TRACE_MDKAPI_CALL(funcName) \
+    MDKLOADER_PROBE_MDKAPI_CALL(funcName) \
+    MDKLOADER_CAPTURE_MDKAPI_CALL(funcName, __VA_ARGS__) \
+    const ReadGuard guard; \
+    const MDKAPITable *const table = guard.table(); \
+    if (const auto func = table ? table->m_lp##funcName.load(std::memory_order_relaxed) : nullptr) { \
+        func(__VA_ARGS__); \
+    }
+#endif
+
+#ifndef MDKLOADER_EXECUTE_MDKAPI_RETURN
+#define MDKLOADER_EXECUTE_MDKAPI_RETURN(funcName, defVal, ...) \
+    MDKLOADER_COUNT_MDKAPI_CALL(funcName) \
+    MDKLOADER_TRACE_MDKAPI_CALL(funcName) \
+    MDKLOADER_PROBE_MDKAPI_CALL(funcName) \
+    MDKLOADER_CAPTURE_MDKAPI_CALL(funcName, __VA_ARGS__) \
+    const ReadGuard guard; \
+    const MDKAPITable *const table = guard.table(); \
+    const auto func = table ? table->m_lp##funcName.load(std::memory_order_relaxed) : nullptr; \
+    return func ? func(__VA_ARGS__) : defVal;
+#endif
+
+enum MDKAPIIndex { MDKLOADER_FOREACH_MDKAPI(MDKLOADER_GENERATE_MDKAPI_INDEX) MDKAPI_Count };
+
+constexpr const char *mdkapiNames[MDKAPI_Count] = {
+    MDKLOADER_FOREACH_MDKAPI(MDKLOADER_GENERATE_MDKAPI_NAME)};
+
+// What a forwarding function returns without MDK or without the symbol, the
+// wrappers and lazy binding alike.
+template<int index, typename Result>
+constexpr Result mdkapiDefault = Result{};
+template<>
+constexpr MDK_LogLevel mdkapiDefault<MDKAPI_MDK_logLevel, MDK_LogLevel> = MDK_LogLevel_Debug;
+template<>
+constexpr int mdkapiDefault<MDKAPI_MDK_version, int> = MDK_VERSION;
+
+// One bit per MDKAPIIndex, set once the slot is usable.
+using MDKAPIMask = uint64_t;
+static_assert(MDKAPI_Count <= (sizeof(MDKAPIMask) * 8), "MDKAPIMask is too small.");
+constexpr MDKAPIMask allMDKAPIMask = (MDKAPI_Count == (sizeof(MDKAPIMask) * 8))
+                                        ? ~MDKAPIMask(0)
+                                        : ((MDKAPIMask(1) << MDKAPI_Count) - 1);
+
+// The hash function of the DT_GNU_HASH section.
+constexpr uint32_t gnuHash(const char *name)
+{
+    uint32_t hash = 5381;
+    for (; *name; ++name) {
+        hash = (hash << 5) + hash + static_cast<uint8_t>(*name);
+    }
+    return hash;
+}
+
+constexpr uint32_t mdkapiHashes[MDKAPI_Count] = {
+    MDKLOADER_FOREACH_MDKAPI(MDKLOADER_GENERATE_MDKAPI_HASH)};
+
+static_assert(sizeof(mdkloaderAPI) == (MDKAPI_Count * sizeof(void (*)())),
+              "mdkloaderAPI is out of sync with MDKLOADER_FOREACH_MDKAPI.");
+
+#ifdef MDKLOADER_ENABLE_STATS
+// Counters of the calls made by one thread. Only the owning thread writes
+// them, so they are updated without atomic read-modify-write, and the
+// alignment keeps two threads from ever sharing a cache line. Blocks are
+// never freed, the counts of exited threads stay in the totals and their
+// blocks are reused by new threads.
+struct alignas(64) ThreadCallStats
+{
+    struct alignas(64) Counters
+    {
+        std::atomic<uint64_t> calls = {0};
+        std::atomic<uint64_t> totalTime = {0};
+        std::atomic<uint64_t> histogram[MDKLOADER_STATS_BUCKETS] = {};
+    };
+
+    Counters counters[MDKAPI_Count];
+    std::atomic_bool inUse = {false};
+    ThreadCallStats *next = nullptr;
+};
+
+std::atomic<ThreadCallStats *> threadCallStatsList = {nullptr};
+
+ThreadCallStats *acquireThreadCallStats()
+{
+    for (ThreadCallStats *stats = threadCallStatsList.load(std::memory_order_acquire); stats;
+         stats = stats->next) {
+        bool expected = false;
+        if (!stats->inUse.load(std::memory_order_relaxed)
+            && stats->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return stats;
+        }
+    }
+    auto stats = new ThreadCallStats;
+    stats->inUse.store(true, std::memory_order_relaxed);
+    ThreadCallStats *head = threadCallStatsList.load(std::memory_order_relaxed);
+    do {
+        stats->next = head;
+    } while (!threadCallStatsList.compare_exchange_weak(head,
+                                                        stats,
+                                                        std::memory_order_release,
+                                                        std::memory_order_relaxed));
+    return stats;
+}
+
+struct ThreadCallStatsOwner
+{
+    ~ThreadCallStatsOwner()
+    {
+        if (stats) {
+            stats->inUse.store(false, std::memory_order_release);
+        }
+    }
+
+    ThreadCallStats *stats = nullptr;
+};
+
+thread_local ThreadCallStatsOwner threadCallStats;
+
+// Bucket i counts the calls which took [2^i, 2^(i+1)) nanoseconds.
+int histogramBucket(const uint64_t ns)
+{
+    int bucket = 0;
+    for (uint64_t v = ns >> 1; v && (bucket < (MDKLOADER_STATS_BUCKETS - 1)); v >>= 1) {
+        ++bucket;
+    }
+    return bucket;
+}
+
+void addRelaxed(std::atomic<uint64_t> &counter, const uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+class CallTimer
+{
+public:
+    explicit CallTimer(const MDKAPIIndex index)
+        : m_index(index), m_start(std::chrono::steady_clock::now())
+    {}
+
+    ~CallTimer()
+    {
+        const auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                  std::chrono::steady_clock::now() - m_start)
+                                                  .count());
+        if (!threadCallStats.stats) {
+            threadCallStats.stats = acquireThreadCallStats();
+        }
+        ThreadCallStats::Counters &counters = threadCallStats.stats->counters[m_index];
+        addRelaxed(counters.calls, 1);
+        addRelaxed(counters.totalTime, ns);
+        addRelaxed(counters.histogram[histogramBucket(ns)], 1);
+    }
+
+    CallTimer(const CallTimer &) = delete;
+    CallTimer &operator=(const CallTimer &) = delete;
+
+private:
+    const MDKAPIIndex m_index;
+    const std::chrono::steady_clock::time_point m_start;
+};
+#endif
+
+#ifdef MDKLOADER_ENABLE_TRACE
+// One begin or end event. name must be a string literal, it is only read
+// when the trace is written.
+struct TraceEvent
+{
+    int64_t time; // nanoseconds since traceEpoch
+    const char *name;
+    uint32_t thread;
+    char phase; // 'B' or 'E', as in the Chrome trace event format
+};
+
+// Single producer, single consumer ring: the owning thread appends, the flush
+// consumes under traceFlushMutex. Events are dropped while the ring is full,
+// recording never blocks and never allocates. Like the stats blocks, rings
+// are never freed and get reused by new threads.
+struct alignas(64) TraceRing
+{
+    explicit TraceRing(const size_t capacity) : events(new TraceEvent[capacity]), mask(capacity - 1)
+    {}
+
+    const std::unique_ptr<TraceEvent[]> events;
+    const size_t mask;
+    alignas(64) std::atomic<uint64_t> head = {0};
+    alignas(64) std::atomic<uint64_t> tail = {0};
+    std::atomic<uint64_t> dropped = {0};
+    std::atomic_bool inUse = {false};
+    TraceRing *next = nullptr;
+};
+
+std::atomic_bool traceEnabled = {false};
+std::atomic<size_t> traceRingCapacity = {0};
+std::atomic<TraceRing *> traceRings = {nullptr};
+std::mutex traceFlushMutex;
+const auto traceEpoch = std::chrono::steady_clock::now();
+
+uint32_t currentThreadId()
+{
+#ifdef MDK_WINDOWS
+    return static_cast<uint32_t>(GetCurrentThreadId());
+#elif defined(MDK_LINUX)
+    return static_cast<uint32_t>(syscall(SYS_gettid));
+#else
+    static std::atomic<uint32_t> nextThreadId = {1};
+    return nextThreadId++;
+#endif
+}
+
+TraceRing *acquireTraceRing()
+{
+    const size_t capacity = traceRingCapacity.load(std::memory_order_relaxed);
+    for (TraceRing *ring = traceRings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        bool expected = false;
+        if ((ring->mask == (capacity - 1)) && !ring->inUse.load(std::memory_order_relaxed)
+            && ring->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return ring;
+        }
+    }
+    auto ring = new TraceRing(capacity);
+    ring->inUse.store(true, std::memory_order_relaxed);
+    TraceRing *head = traceRings.load(std::memory_order_relaxed);
+    do {
+        ring->next = head;
+    } while (!traceRings.compare_exchange_weak(head,
+                                               ring,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed));
+    return ring;
+}
+
+struct ThreadTrace
+{
+    ~ThreadTrace()
+    {
+        if (ring) {
+            ring->inUse.store(false, std::memory_order_release);
+        }
+    }
+
+    TraceRing *ring = nullptr;
+    uint32_t id = currentThreadId();
+};
+
+thread_local ThreadTrace threadTrace;
+
+void recordTraceEvent(const char *name, const char phase)
+{
+    ThreadTrace &trace = threadTrace;
+    if (!trace.ring || ((trace.ring->mask + 1) != traceRingCapacity.load(std::memory_order_relaxed))) {
+        // First event of this thread, or the trace was restarted with another size.
+        if (trace.ring) {
+            trace.ring->inUse.store(false, std::memory_order_release);
+        }
+        trace.ring = acquireTraceRing();
+    }
+    TraceRing &ring = *trace.ring;
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if ((head - ring.tail.load(std::memory_order_acquire)) > ring.mask) {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    TraceEvent &event = ring.events[head & ring.mask];
+    event.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - traceEpoch)
+                     .count();
+    event.name = name;
+    event.thread = trace.id;
+    event.phase = phase;
+    ring.head.store(head + 1, std::memory_order_release);
+}
+#endif
+
+// Records a begin/end event pair around its lifetime. The end is recorded
+// even if the trace was stopped in between, so that the pairs stay balanced.
+class TraceScope
+{
+public:
+#ifdef MDKLOADER_ENABLE_TRACE
+    explicit TraceScope(const char *name)
+        : m_name(traceEnabled.load(std::memory_order_relaxed) ? name : nullptr)
+    {
+        if (m_name) {
+            recordTraceEvent(m_name, 'B');
+        }
+    }
+
+    ~TraceScope()
+    {
+        if (m_name) {
+            recordTraceEvent(m_name, 'E');
+        }
+    }
+#else
+    explicit TraceScope(const char *) {}
+#endif
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+#ifdef MDKLOADER_ENABLE_TRACE
+private:
+    const char *const m_name;
+#endif
+};
+
+#ifdef MDKLOADER_ENABLE_USDT
+// Fires mdkapi__entry and mdkapi__return around a forwarded call, with the
+// index and the name of the API.
+class ProbeScope
+{
+public:
+    explicit ProbeScope(const MDKAPIIndex index) : m_index(index)
+    {
+        MDKLOADER_PROBE(mdkapi__entry, static_cast<int>(m_index), mdkapiNames[m_index]);
+    }
+
+    ~ProbeScope()
+    {
+        MDKLOADER_PROBE(mdkapi__return, static_cast<int>(m_index), mdkapiNames[m_index]);
+    }
+
+    ProbeScope(const ProbeScope &) = delete;
+    ProbeScope &operator=(const ProbeScope &) = delete;
+
+private:
+    const MDKAPIIndex m_index;
+};
+#endif
+
+// The library handle and every resolved symbol live in one table which is
+// filled in completely before it is published. The only things that may change
+// afterwards are a lazily bound slot, which is patched exactly once from its
+// trampoline to the real symbol, and the bookkeeping guarded by
+// generationMutex.
+struct MDKAPITable
+{
+    MDK_HANDLE library = nullptr;
+    // Where the library was actually loaded from, to load it again after an idle unload.
+    std::string path;
+    MDKLoader_BindingMode binding = MDKLoader_BindingMode_Default;
+    int openFlags = 0;
+    bool hugePageText = false;
+    // The files of the libraries the load mapped, this one first. Linux only.
+    std::vector<std::string> libraries;
+    MDKAPIMask resolvedMask = 0;
+    bool resolved = false;
+    // Plain copy of the slots handed out by mdkloader_api(), filled once all
+    // symbols are bound.
+    mdkloaderAPI api = {};
+    std::atomic_bool apiReady = {false};
+
+    // Guarded by generationMutex. A replaced table is retired, and is only
+    // destroyed once no thread uses it anymore (graceElapsed) and every Player
+    // it created has been deleted.
+    mutable int livePlayers = 0;
+    mutable bool retired = false;
+    mutable bool graceElapsed = false;
+    // VideoFrames created by mdkVideoFrameAPI_new(), see frameShards. A
+    // retired table is kept for them like for its Players.
+    mutable std::atomic_int liveFrames = {0};
+    mutable std::atomic_bool pinned = {false};
+
+    MDKLOADER_FOREACH_MDKAPI(MDKLOADER_GENERATE_MDKAPI)
+};
+
+std::atomic<const MDKAPITable *> mdkTable = nullptr;
+// Serializes the slow path only. Concurrent first callers block here while one
+// of them loads the library, then they all observe the published table.
+std::mutex mdkLoadMutex;
+std::atomic<MDKLoader_LoadStatus> mdkLoadStatus = {MDKLoader_LoadStatus_NotLoaded};
+
+constexpr const char *ffmpegOptionKeys[MDKLoader_FFmpegLibrary_Count]
+    = {"avutil_lib", "avcodec_lib", "avformat_lib", "swresample_lib", "avfilter_lib"};
+// Guarded by mdkLoadMutex. Preloaded FFmpeg libraries are kept open until
+// mdkloader_cleanup(), and their paths are passed to every MDK loaded meanwhile.
+MDK_HANDLE ffmpegLibraries[MDKLoader_FFmpegLibrary_Count] = {};
+std::string ffmpegPaths[MDKLoader_FFmpegLibrary_Count];
+// Of the last attempt to create a table, guarded by mdkLoadMutex.
+mdkloaderLoadReport lastLoadReport = {};
+
+// Idle unloading, see mdkloader_setIdleUnload(). Every outermost ReadGuard
+// marks MDK as used, the watcher clears the mark once per tick.
+std::atomic_bool mdkUsed = {false};
+// Set while MDK is unloaded for being idle, the next ReadGuard loads it again
+// from idleReloadPath, which is guarded by mdkLoadMutex like the options.
+std::atomic_bool idleUnloaded = {false};
+std::string idleReloadPath;
+mdkloaderLoadOptions idleReloadOptions = {};
+
+const MDKAPITable *reloadAfterIdle();
+
+// Every thread calling into MDK through this library owns a slot, in which it
+// announces the table generation it is using for the duration of the call.
+// A replaced table is only destroyed after no slot refers to it anymore, i.e.
+// after every thread has passed a quiescent point outside the wrappers.
+struct alignas(64) ReaderSlot
+{
+    std::atomic<const MDKAPITable *> table = {nullptr};
+    std::atomic_bool inUse = {false};
+    ReaderSlot *next = nullptr;
+};
+
+// Slots are never freed, the ones of exited threads are reused.
+std::atomic<ReaderSlot *> readerSlots = {nullptr};
+
+// Where the writer can run a memory barrier on every thread of the process,
+// readers announce their table without one: membarrier() on Linux,
+// FlushProcessWriteBuffers() on Windows. Elsewhere readers fence themselves.
+bool registerProcessBarrier()
+{
+#if defined(MDK_WINDOWS)
+    return true;
+#elif defined(MDK_LINUX)
+    return syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+#else
+    return false;
+#endif
+}
+
+const bool processBarrier = registerProcessBarrier();
+
+// A full barrier on every running thread, or only on this one.
+void processWideBarrier()
+{
+    if (!processBarrier) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return;
+    }
+#if defined(MDK_WINDOWS)
+    FlushProcessWriteBuffers();
+#elif defined(MDK_LINUX)
+    syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+#endif
+}
+
+MDKLOADER_NOINLINE ReaderSlot *acquireReaderSlot()
+{
+    for (ReaderSlot *slot = readerSlots.load(std::memory_order_acquire); slot; slot = slot->next) {
+        bool expected = false;
+        if (!slot->inUse.load(std::memory_order_relaxed)
+            && slot->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return slot;
+        }
+    }
+    auto slot = new ReaderSlot;
+    slot->inUse.store(true, std::memory_order_relaxed);
+    ReaderSlot *head = readerSlots.load(std::memory_order_relaxed);
+    do {
+        slot->next = head;
+    } while (!readerSlots.compare_exchange_weak(head,
+                                                slot,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+    return slot;
+}
+
+struct ThreadReader
+{
+    ~ThreadReader()
+    {
+        if (slot) {
+            slot->table.store(nullptr, std::memory_order_release);
+            slot->inUse.store(false, std::memory_order_release);
+        }
+    }
+
+    ReaderSlot *slot = nullptr;
+    const MDKAPITable *table = nullptr;
+    int depth = 0;
+};
+
+thread_local ThreadReader threadReader;
+
+// Pins the current table for the lifetime of the guard. Nested guards, e.g. a
+// wrapper called from an MDK callback, keep using the generation of the
+// outermost one.
+class ReadGuard
+{
+public:
+    MDKLOADER_HOT_PATH ReadGuard() : m_reader(threadReader)
+    {
+        if (m_reader.depth++ > 0) {
+            return;
+        }
+        if (!m_reader.slot) {
+            m_reader.slot = acquireReaderSlot();
+        }
+        // Written only after the watcher cleared it, reading is almost free.
+        if (!mdkUsed.load(std::memory_order_relaxed)) {
+            mdkUsed.store(true, std::memory_order_relaxed);
+        }
+        const MDKAPITable *const table = mdkTable.load(std::memory_order_acquire);
+        // Announce first, then check the table is still current. Pairs with
+        // the barrier in waitForReaders(): either it sees the announcement,
+        // or this thread sees the table unpublished.
+        if (processBarrier && table) {
+            m_reader.slot->table.store(table, std::memory_order_relaxed);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            if (mdkTable.load(std::memory_order_acquire) == table) {
+                m_reader.table = table;
+                return;
+            }
+        }
+        m_reader.table = pin(m_reader.slot, table);
+    }
+
+    MDKLOADER_HOT_PATH ~ReadGuard()
+    {
+        if (--m_reader.depth == 0) {
+            m_reader.slot->table.store(nullptr, std::memory_order_release);
+            m_reader.table = nullptr;
+        }
+    }
+
+    ReadGuard(const ReadGuard &) = delete;
+    ReadGuard &operator=(const ReadGuard &) = delete;
+
+    const MDKAPITable *table() const { return m_reader.table; }
+
+    static bool isActive() { return threadReader.depth > 0; }
+
+private:
+    // The rest of the constructor, kept out of line so that the common case
+    // above stays small enough to be inlined into every wrapper.
+    MDKLOADER_NOINLINE static const MDKAPITable *pin(ReaderSlot *slot, const MDKAPITable *table);
+
+    ThreadReader &m_reader;
+};
+
+const MDKAPITable *ReadGuard::pin(ReaderSlot *slot, const MDKAPITable *table)
+{
+    for (;;) {
+        if (!table && idleUnloaded.load(std::memory_order_acquire)) {
+            // Announce nothing while waiting, the unload may be waiting
+            // for this thread to leave the old table.
+            slot->table.store(nullptr, std::memory_order_seq_cst);
+            table = reloadAfterIdle();
+        }
+        slot->table.store(table, std::memory_order_seq_cst);
+        const MDKAPITable *const current = mdkTable.load(std::memory_order_seq_cst);
+        if (current == table) {
+            return table;
+        }
+        table = current;
+    }
+}
+
+// Called after table has been unpublished.
+void waitForReaders(const MDKAPITable *table)
+{
+    processWideBarrier();
+    for (ReaderSlot *slot = readerSlots.load(std::memory_order_acquire); slot; slot = slot->next) {
+        while (slot->table.load(std::memory_order_seq_cst) == table) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// Guards the retired tables and the Player ownership below. Never held while
+// waiting for readers, the wrappers take it too.
+std::mutex generationMutex;
+std::vector<const MDKAPITable *> retiredTables;
+// Which generation created a Player, so that it is deleted by the same library.
+std::unordered_map<const mdkPlayerAPI *, const MDKAPITable *> playerOwners;
+
+// Same for the VideoFrames created by mdkVideoFrameAPI_new(). The ones MDK
+// creates, e.g. passed to callbacks or returned by to(), are not in here, and
+// deleting them doesn't count. Sharded by address, frames are created and
+// deleted on many threads at once. A shard lock is never held with another.
+struct alignas(64) FrameShard
+{
+    std::mutex mutex;
+    std::unordered_map<const mdkVideoFrameAPI *, const MDKAPITable *> owners;
+};
+
+constexpr size_t frameShardCount = 16;
+FrameShard frameShards[frameShardCount];
+
+FrameShard &frameShard(const mdkVideoFrameAPI *frame)
+{
+    // Frames are heap blocks, the low bits carry little.
+    return frameShards[(reinterpret_cast<uintptr_t>(frame) >> 6) % frameShardCount];
+}
+
+template<typename Func>
+struct MDKAPISignature;
+
+template<typename Result, typename... Args>
+struct MDKAPISignature<Result (*)(Args...)>
+{
+    // Installed into a slot by lazy binding. The first call resolves the real
+    // symbol, patches the slot so that later calls go straight to MDK, and
+    // then forwards the call.
+    template<auto slot, int index>
+    static Result lazyBind(Args... args)
+    {
+        const ReadGuard guard;
+        const MDKAPITable *const table = guard.table();
+        const auto func = table ? reinterpret_cast<Result (*)(Args...)>(
+                              MDKLOADER_GETPROCADDRESS(table->library, mdkapiNames[index]))
+                                : nullptr;
+        if (table) {
+            // Tables are only handed out as const, but none is created const.
+            (const_cast<MDKAPITable *>(table)->*slot).store(func, std::memory_order_relaxed);
+        }
+        if (!func) {
+            logMessage(MDKLoader_LogLevel_Warning, "Failed to resolve symbol %s", mdkapiNames[index]);
+            if constexpr (std::is_void_v<Result>) {
+                return;
+            } else {
+                return mdkapiDefault<index, Result>;
+            }
+        }
+        return func(args...);
+    }
+};
+
+// Every member of mdkPlayerAPI taking the player object, as (member). Calls of
+// them are captured with the op playerOpBase + PlayerAPIIndex.
+#define MDKLOADER_FOREACH_PLAYERAPI(F) \
+    F(setMute) F(setVolume) F(setMedia) F(setMediaForType) F(url) F(setPreloadImmediately) \
+    F(setNextMedia) F(currentMediaChanged) F(setAudioBackends) F(setAudioDecoders) \
+    F(setVideoDecoders) F(setTimeout) F(prepare) F(mediaInfo) F(setState) F(state) \
+    F(onStateChanged) F(waitFor) F(mediaStatus) F(onMediaStatusChanged) F(updateNativeSurface) \
+    F(createSurface) F(resizeSurface) F(showSurface) F(setVideoSurfaceSize) F(setVideoViewport) \
+    F(setAspectRatio) F(rotate) F(scale) F(renderVideo) F(setBackgroundColor) \
+    F(setRenderCallback) F(onVideo) F(onAudio) F(beforeVideoRender) F(afterVideoRender) \
+    F(position) F(seekWithFlags) F(seek) F(setPlaybackRate) F(playbackRate) F(buffered) \
+    F(switchBitrate) F(switchBitrateSingleConnection) F(onEvent) F(setBufferRange) F(snapshot) \
+    F(setProperty) F(getProperty) F(record) F(setLoopRange) F(setLoop) F(onLoop) F(setRange) \
+    F(setRenderAPI) F(renderAPI) F(mapPoint) F(onSync) F(setVideoEffect)
+
+#define MDKLOADER_GENERATE_PLAYERAPI_INDEX(member) PlayerAPI_##member,
+
+enum PlayerAPIIndex { MDKLOADER_FOREACH_PLAYERAPI(MDKLOADER_GENERATE_PLAYERAPI_INDEX) PlayerAPI_Count };
+
+// Capture files, see mdkloader_captureFlush() and mdkloader_replay(): the magic
+// and the number of dropped calls, then one record per call ordered by time.
+// Values are stored in host byte order, a capture is replayed on the machine
+// which recorded it.
+constexpr char captureMagic[8] = {'M', 'D', 'K', 'C', 'A', 'P', 1, 0};
+constexpr uint16_t playerOpBase = 64;
+static_assert(MDKAPI_Count <= playerOpBase, "Capture ops of MDK APIs and Player members overlap.");
+
+// The record header is op, thread, object, time and payload size, followed by
+// the arguments. object is the Player id for Player calls and the frame
+// address for VideoFrame calls, time is in nanoseconds.
+struct CaptureRecord
+{
+    uint16_t op;
+    uint16_t thread;
+    uint64_t object;
+    int64_t time;
+    uint32_t size;
+    const unsigned char *payload;
+};
+
+constexpr size_t captureRecordHeaderSize = 24;
+
+bool readCaptureRecord(const unsigned char *data, const size_t size, size_t &offset, CaptureRecord &record)
+{
+    if ((size - offset) < captureRecordHeaderSize) {
+        return false;
+    }
+    const unsigned char *const header = data + offset;
+    std::memcpy(&record.op, header, 2);
+    std::memcpy(&record.thread, header + 2, 2);
+    std::memcpy(&record.object, header + 4, 8);
+    std::memcpy(&record.time, header + 12, 8);
+    std::memcpy(&record.size, header + 20, 4);
+    if ((size - offset - captureRecordHeaderSize) < record.size) {
+        return false;
+    }
+    record.payload = header + captureRecordHeaderSize;
+    offset += captureRecordHeaderSize + record.size;
+    return true;
+}
+
+struct CaptureWriter
+{
+    template<typename T>
+    void put(const T &value)
+    {
+        const size_t size = data.size();
+        data.resize(size + sizeof(T));
+        std::memcpy(data.data() + size, &value, sizeof(T));
+    }
+
+    void putString(const char *value)
+    {
+        if (!value) {
+            put<uint32_t>(UINT32_MAX);
+            return;
+        }
+        const size_t length = std::strlen(value);
+        put(static_cast<uint32_t>(length));
+        data.insert(data.end(), value, value + length + 1);
+    }
+
+    std::vector<unsigned char> &data;
+};
+
+struct ReplayContext;
+
+// Decodes the arguments of one record. Strings point into the record, lists
+// and out parameters live as long as the reader.
+class CaptureReader
+{
+public:
+    CaptureReader(const CaptureRecord &record, ReplayContext *context)
+        : m_data(record.payload), m_size(record.size), m_object(record.object), m_context(context)
+    {}
+
+    template<typename T>
+    T get()
+    {
+        T value{};
+        if ((m_size - m_offset) >= sizeof(T)) {
+            std::memcpy(&value, m_data + m_offset, sizeof(T));
+            m_offset += sizeof(T);
+        } else {
+            m_ok = false;
+        }
+        return value;
+    }
+
+    const char *getString()
+    {
+        const auto length = get<uint32_t>();
+        if (!m_ok || (length == UINT32_MAX)) {
+            return nullptr;
+        }
+        if (((m_size - m_offset) <= length) || m_data[m_offset + length]) {
+            m_ok = false;
+            return nullptr;
+        }
+        const auto value = reinterpret_cast<const char *>(m_data + m_offset);
+        m_offset += length + 1;
+        return value;
+    }
+
+    const char **getStringList()
+    {
+        const auto count = get<uint32_t>();
+        if (!m_ok || (count == UINT32_MAX)) {
+            return nullptr;
+        }
+        std::vector<const char *> &list = m_lists.emplace_back();
+        for (uint32_t i = 0; m_ok && (i < count); ++i) {
+            list.push_back(getString());
+        }
+        list.push_back(nullptr);
+        return list.data();
+    }
+
+    int64_t *scratch() { return &m_scratch.emplace_back(0); }
+
+    bool ok() const { return m_ok; }
+    uint64_t object() const { return m_object; }
+    ReplayContext *context() const { return m_context; }
+
+private:
+    const unsigned char *const m_data;
+    const size_t m_size;
+    const uint64_t m_object;
+    ReplayContext *const m_context;
+    size_t m_offset = 0;
+    bool m_ok = true;
+    std::list<std::vector<const char *>> m_lists;
+    std::list<int64_t> m_scratch;
+};
+
+MDK_CallbackToken *replayToken(ReplayContext *context, uint64_t player, MDK_CallbackToken recorded);
+
+// Callbacks of a replayed call do nothing. Those returning bool answer like
+// MDK does without a callback: continue preparing, abort on timeout and keep
+// dispatching events. mdkSyncCallback drives the clock and can't be faked.
+template<typename Callback>
+constexpr bool replayCallbackResult = false;
+template<>
+constexpr bool replayCallbackResult<mdkPrepareCallback> = true;
+template<>
+constexpr bool replayCallbackResult<mdkMediaStatusChangedCallback> = true;
+template<>
+constexpr bool replayCallbackResult<mdkTimeoutCallback> = true;
+
+template<typename Callback>
+constexpr bool isReplayableCallback = true;
+template<>
+constexpr bool isReplayableCallback<mdkSyncCallback> = false;
+
+template<typename Callback, typename Function = decltype(Callback::cb)>
+struct ReplayCallback;
+
+template<typename Callback, typename Result, typename... Args>
+struct ReplayCallback<Callback, Result (*)(Args...)>
+{
+    static Result call(Args...)
+    {
+        if constexpr (std::is_same_v<Result, bool>) {
+            return replayCallbackResult<Callback>;
+        } else if constexpr (!std::is_void_v<Result>) {
+            return Result{};
+        }
+    }
+
+    static Callback make(const bool set)
+    {
+        static char opaque;
+        Callback callback = {};
+        if (set) {
+            callback.cb = &call;
+            callback.opaque = &opaque;
+        }
+        return callback;
+    }
+};
+
+// How an argument of type T is captured and replayed. Anything not listed is
+// a pointer to memory of the application, only its value is captured and the
+// call can't be replayed.
+template<typename T, typename = void>
+struct CaptureValue
+{
+    static constexpr bool replayable = false;
+    static void write(CaptureWriter &out, const T value)
+    {
+        out.put(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value)));
+    }
+    static T read(CaptureReader &in)
+    {
+        in.get<uint64_t>();
+        return T{};
+    }
+};
+
+template<typename T>
+struct CaptureValue<T, std::enable_if_t<std::is_arithmetic_v<T> || std::is_enum_v<T>>>
+{
+    static constexpr bool replayable = true;
+    static void write(CaptureWriter &out, const T value) { out.put(value); }
+    static T read(CaptureReader &in) { return in.get<T>(); }
+};
+
+template<>
+struct CaptureValue<const char *>
+{
+    static constexpr bool replayable = true;
+    static void write(CaptureWriter &out, const char *value) { out.putString(value); }
+    static const char *read(CaptureReader &in) { return in.getString(); }
+};
+
+// Null terminated, e.g. decoder names.
+template<>
+struct CaptureValue<const char **>
+{
+    static constexpr bool replayable = true;
+    static void write(CaptureWriter &out, const char **value)
+    {
+        if (!value) {
+            out.put<uint32_t>(UINT32_MAX);
+            return;
+        }
+        uint32_t count = 0;
+        while (value[count]) {
+            ++count;
+        }
+        out.put(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            out.putString(value[i]);
+        }
+    }
+    static const char **read(CaptureReader &in) { return in.getStringList(); }
+};
+
+// Out parameters, e.g. the bytes of buffered().
+template<>
+struct CaptureValue<int64_t *>
+{
+    static constexpr bool replayable = true;
+    static void write(CaptureWriter &out, const int64_t *value) { out.put<uint8_t>(value != nullptr); }
+    static int64_t *read(CaptureReader &in) { return in.get<uint8_t>() ? in.scratch() : nullptr; }
+};
+
+// Captured after the call, when MDK has filled in the token. Replay maps the
+// recorded token to the one MDK hands out then.
+template<>
+struct CaptureValue<MDK_CallbackToken *>
+{
+    static constexpr bool replayable = true;
+    static void write(CaptureWriter &out, const MDK_CallbackToken *value)
+    {
+        out.put<uint8_t>(value != nullptr);
+        out.put<uint64_t>(value ? *value : 0);
+    }
+    static MDK_CallbackToken *read(CaptureReader &in)
+    {
+        const bool present = in.get<uint8_t>();
+        const auto recorded = in.get<uint64_t>();
+        return present ? replayToken(in.context(), in.object(), recorded) : nullptr;
+    }
+};
+
+// Only whether a callback was set is captured, MDK takes one with a null
+// opaque for none.
+template<typename T>
+struct CaptureValue<T, std::void_t<decltype(std::declval<T &>().cb), decltype(std::declval<T &>().opaque)>>
+{
+    static constexpr bool replayable = isReplayableCallback<T>;
+    static void write(CaptureWriter &out, const T &value) { out.put<uint8_t>(value.opaque != nullptr); }
+    static T read(CaptureReader &in) { return ReplayCallback<T>::make(in.get<uint8_t>() != 0); }
+};
+
+template<typename... Args>
+constexpr bool isReplayable = (true && ... && CaptureValue<Args>::replayable);
+
+#ifdef MDKLOADER_ENABLE_CAPTURE
+// The records of one thread, in the format of the capture file. Only the
+// flush contends for the lock. Like the trace rings, buffers are never freed
+// and get reused by new threads.
+struct CaptureBuffer
+{
+    std::mutex mutex;
+    std::vector<unsigned char> data;
+    uint64_t dropped = 0;
+    uint16_t thread = 0;
+    std::atomic_bool inUse = {false};
+    CaptureBuffer *next = nullptr;
+};
+
+std::atomic_bool captureEnabled = {false};
+std::atomic<size_t> captureBufferCapacity = {0};
+std::atomic<CaptureBuffer *> captureBuffers = {nullptr};
+std::atomic<uint16_t> nextCaptureThread = {1};
+std::mutex captureFlushMutex;
+const auto captureEpoch = std::chrono::steady_clock::now();
+
+int64_t captureTime()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()
+                                                                - captureEpoch)
+        .count();
+}
+
+CaptureBuffer *acquireCaptureBuffer()
+{
+    for (CaptureBuffer *buffer = captureBuffers.load(std::memory_order_acquire); buffer;
+         buffer = buffer->next) {
+        bool expected = false;
+        if (!buffer->inUse.load(std::memory_order_relaxed)
+            && buffer->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            buffer->thread = nextCaptureThread++;
+            return buffer;
+        }
+    }
+    auto buffer = new CaptureBuffer;
+    buffer->thread = nextCaptureThread++;
+    buffer->inUse.store(true, std::memory_order_relaxed);
+    CaptureBuffer *head = captureBuffers.load(std::memory_order_relaxed);
+    do {
+        buffer->next = head;
+    } while (!captureBuffers.compare_exchange_weak(head,
+                                                   buffer,
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed));
+    return buffer;
+}
+
+struct ThreadCapture
+{
+    ~ThreadCapture()
+    {
+        if (buffer) {
+            buffer->inUse.store(false, std::memory_order_release);
+        }
+    }
+
+    CaptureBuffer *buffer = nullptr;
+};
+
+thread_local ThreadCapture threadCapture;
+
+// Args are the declared parameter types, not the deduced ones, so that a
+// literal 0 passed for a pointer is captured as one.
+template<typename... Args>
+void recordCall(const uint16_t op, const uint64_t object, const int64_t time, Args... args)
+{
+    ThreadCapture &capture = threadCapture;
+    if (!capture.buffer) {
+        capture.buffer = acquireCaptureBuffer();
+    }
+    CaptureBuffer &buffer = *capture.buffer;
+    std::lock_guard<std::mutex> locker(buffer.mutex);
+    const size_t start = buffer.data.size();
+    CaptureWriter out{buffer.data};
+    out.put(op);
+    out.put(buffer.thread);
+    out.put(object);
+    out.put(time);
+    out.put(uint32_t(0));
+    (CaptureValue<Args>::write(out, args), ...);
+    if (buffer.data.size() > captureBufferCapacity.load(std::memory_order_relaxed)) {
+        buffer.data.resize(start);
+        ++buffer.dropped;
+        return;
+    }
+    const auto size = static_cast<uint32_t>(buffer.data.size() - start - captureRecordHeaderSize);
+    std::memcpy(buffer.data.data() + start + 20, &size, sizeof(size));
+}
+
+template<typename Func, int index>
+struct CaptureMDKAPI;
+
+template<typename Result, typename... Args, int index>
+struct CaptureMDKAPI<Result (*)(Args...), index>
+{
+    static void record(Args... args)
+    {
+        if (captureEnabled.load(std::memory_order_relaxed)) {
+            recordCall<Args...>(index, 0, captureTime(), args...);
+        }
+    }
+};
+
+// mdkPlayerAPI_new() hands out this copy of the table of MDK. Its object
+// points back here, so that a thunk finds the original without a lookup.
+struct CapturedPlayer
+{
+    mdkPlayerAPI api = {};
+    const mdkPlayerAPI *original = nullptr;
+    uint64_t id = 0;
+};
+
+std::atomic<uint64_t> nextCapturedPlayerId = {1};
+// Guarded by generationMutex, keyed by the copy.
+std::unordered_map<const mdkPlayerAPI *, CapturedPlayer *> capturedPlayers;
+
+template<typename Member, Member member, int index>
+struct PlayerThunk;
+
+template<typename Result, typename... Args, Result (*mdkPlayerAPI::*member)(mdkPlayer *, Args...), int index>
+struct PlayerThunk<Result (*mdkPlayerAPI::*)(mdkPlayer *, Args...), member, index>
+{
+    // Recorded after the call, with the time it was made at, so that out
+    // parameters and tokens hold what MDK returned.
+    static Result call(mdkPlayer *object, Args... args)
+    {
+        const auto player = reinterpret_cast<const CapturedPlayer *>(object);
+        const mdkPlayerAPI *const original = player->original;
+        const int64_t time = captureEnabled.load(std::memory_order_relaxed) ? captureTime() : -1;
+        if constexpr (std::is_void_v<Result>) {
+            (original->*member)(original->object, args...);
+            if (time >= 0) {
+                recordCall<Args...>(playerOpBase + index, player->id, time, args...);
+            }
+        } else {
+            Result result = (original->*member)(original->object, args...);
+            if (time >= 0) {
+                recordCall<Args...>(playerOpBase + index, player->id, time, args...);
+            }
+            return result;
+        }
+    }
+};
+
+#define MDKLOADER_INTERPOSE_PLAYERAPI(member) \
+    if (original->member) { \
+        player->api.member = &PlayerThunk<decltype(&mdkPlayerAPI::member), \
+                                          &mdkPlayerAPI::member, \
+                                          PlayerAPI_##member>::call; \
+    }
+
+const CapturedPlayer *capturePlayer(const mdkPlayerAPI *original)
+{
+    auto player = new CapturedPlayer;
+    player->api = *original;
+    player->api.object = reinterpret_cast<mdkPlayer *>(player);
+    player->original = original;
+    player->id = nextCapturedPlayerId++;
+    MDKLOADER_FOREACH_PLAYERAPI(MDKLOADER_INTERPOSE_PLAYERAPI)
+    std::lock_guard<std::mutex> locker(generationMutex);
+    capturedPlayers.emplace(&player->api, player);
+    return player;
+}
+
+std::unique_ptr<CapturedPlayer> releaseCapturedPlayer(const mdkPlayerAPI *value)
+{
+    std::lock_guard<std::mutex> locker(generationMutex);
+    const auto it = capturedPlayers.find(value);
+    if (it == capturedPlayers.cend()) {
+        return nullptr;
+    }
+    std::unique_ptr<CapturedPlayer> player(it->second);
+    capturedPlayers.erase(it);
+    return player;
+}
+#endif
+
+#ifdef MDK_LINUX
+// Looks symbols up directly in the dynamic symbol table of the loaded library,
+// using the hashes computed at compile time. Unlike dlsym() this takes no
+// loader lock, doesn't search the dependencies and doesn't hash the names.
+class ElfSymbolTable
+{
+public:
+    explicit ElfSymbolTable(void *library)
+    {
+        struct link_map *linkMap = nullptr;
+        if (!library || (dlinfo(library, RTLD_DI_LINKMAP, &linkMap) != 0) || !linkMap) {
+            return;
+        }
+        m_base = linkMap->l_addr;
+        // Find the program headers of the library to locate its PT_DYNAMIC.
+        dl_iterate_phdr(
+            [](struct dl_phdr_info *info, size_t, void *data) -> int {
+                auto self = static_cast<ElfSymbolTable *>(data);
+                if (info->dlpi_addr != self->m_base) {
+                    return 0;
+                }
+                for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+                    if (info->dlpi_phdr[i].p_type == PT_DYNAMIC) {
+                        self->m_dynamic = reinterpret_cast<const ElfW(Dyn) *>(
+                            info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+                        return 1;
+                    }
+                }
+                return 0;
+            },
+            this);
+        if (!m_dynamic) {
+            return;
+        }
+        const uint32_t *gnuHashSection = nullptr;
+        for (const ElfW(Dyn) *dyn = m_dynamic; dyn->d_tag != DT_NULL; ++dyn) {
+            switch (dyn->d_tag) {
+            case DT_SYMTAB:
+                m_symbols = reinterpret_cast<const ElfW(Sym) *>(address(dyn->d_un.d_ptr));
+                break;
+            case DT_STRTAB:
+                m_strings = reinterpret_cast<const char *>(address(dyn->d_un.d_ptr));
+                break;
+            case DT_VERSYM:
+                m_versions = reinterpret_cast<const ElfW(Half) *>(address(dyn->d_un.d_ptr));
+                break;
+            case DT_GNU_HASH:
+                gnuHashSection = reinterpret_cast<const uint32_t *>(address(dyn->d_un.d_ptr));
+                break;
+            default:
+                break;
+            }
+        }
+        if (!m_symbols || !m_strings || !gnuHashSection) {
+            return;
+        }
+        m_bucketCount = gnuHashSection[0];
+        m_symbolOffset = gnuHashSection[1];
+        m_bloomSize = gnuHashSection[2];
+        m_bloomShift = gnuHashSection[3];
+        m_bloom = reinterpret_cast<const ElfW(Addr) *>(gnuHashSection + 4);
+        m_buckets = reinterpret_cast<const uint32_t *>(m_bloom + m_bloomSize);
+        m_chains = m_buckets + m_bucketCount;
+        m_valid = (m_bucketCount > 0) && (m_bloomSize > 0);
+    }
+
+    bool isValid() const { return m_valid; }
+
+    // Returns null if the symbol isn't a plain function defined by this
+    // library, the caller should fall back to dlsym() then.
+    void *lookup(const uint32_t hash, const char *name) const
+    {
+        if (!m_valid) {
+            return nullptr;
+        }
+        constexpr uint32_t wordBits = sizeof(ElfW(Addr)) * 8;
+        const ElfW(Addr) word = m_bloom[(hash / wordBits) % m_bloomSize];
+        const ElfW(Addr) mask = (ElfW(Addr)(1) << (hash % wordBits))
+                                | (ElfW(Addr)(1) << ((hash >> m_bloomShift) % wordBits));
+        if ((word & mask) != mask) {
+            return nullptr;
+        }
+        uint32_t index = m_buckets[hash % m_bucketCount];
+        if (index < m_symbolOffset) {
+            return nullptr;
+        }
+        for (;; ++index) {
+            const uint32_t chainHash = m_chains[index - m_symbolOffset];
+            if (((chainHash | 1) == (hash | 1))
+                && (std::strcmp(name, m_strings + m_symbols[index].st_name) == 0)) {
+                const ElfW(Sym) &symbol = m_symbols[index];
+                // Hidden (non-default) symbol versions aren't visible to dlsym() either.
+                const bool hidden = m_versions && (m_versions[index] & 0x8000);
+                if (hidden || (symbol.st_shndx == SHN_UNDEF)
+                    || (ELF64_ST_TYPE(symbol.st_info) != STT_FUNC)) {
+                    return nullptr;
+                }
+                return reinterpret_cast<void *>(m_base + symbol.st_value);
+            }
+            if (chainHash & 1) {
+                return nullptr;
+            }
+        }
+    }
+
+private:
+    // glibc relocates the pointers in the dynamic section in place, other
+    // implementations (and read-only dynamic sections) leave them as offsets.
+    ElfW(Addr) address(const ElfW(Addr) value) const
+    {
+        return (value < m_base) ? (m_base + value) : value;
+    }
+
+    bool m_valid = false;
+    ElfW(Addr) m_base = 0;
+    const ElfW(Dyn) *m_dynamic = nullptr;
+    const ElfW(Sym) *m_symbols = nullptr;
+    const char *m_strings = nullptr;
+    const ElfW(Half) *m_versions = nullptr;
+    uint32_t m_bucketCount = 0;
+    uint32_t m_symbolOffset = 0;
+    uint32_t m_bloomSize = 0;
+    uint32_t m_bloomShift = 0;
+    const ElfW(Addr) *m_bloom = nullptr;
+    const uint32_t *m_buckets = nullptr;
+    const uint32_t *m_chains = nullptr;
+};
+#endif
+
+class SymbolResolver
+{
+public:
+    explicit SymbolResolver(MDK_HANDLE library)
+        : m_library(library)
+#ifdef MDK_LINUX
+        , m_elf(library)
+#endif
+    {}
+
+    void *resolve(const MDKAPIIndex index) const
+    {
+#ifdef MDK_LINUX
+        if (void *symbol = m_elf.lookup(mdkapiHashes[index], mdkapiNames[index])) {
+            return symbol;
+        }
+#endif
+        return reinterpret_cast<void *>(MDKLOADER_GETPROCADDRESS(m_library, mdkapiNames[index]));
+    }
+
+private:
+    MDK_HANDLE m_library = nullptr;
+#ifdef MDK_LINUX
+    ElfSymbolTable m_elf;
+#endif
+};
+
+bool isTableComplete(const MDKAPITable *table)
+{
+    return (table && table->library && (table->resolvedMask == allMDKAPIMask));
+}
+
+void resolveTable(MDKAPITable *table, const bool lazy)
+{
+    const SymbolResolver resolver(lazy ? nullptr : table->library);
+    MDKLOADER_FOREACH_MDKAPI(MDKLOADER_RESOLVE_MDKAPI)
+}
+
+// Lazily bound slots are bound right here, the direct table must never point
+// to a trampoline because nothing would patch it.
+void fillDirectTable(MDKAPITable *table)
+{
+    const SymbolResolver resolver(table->binding == MDKLoader_BindingMode_Lazy ? table->library
+                                                                               : nullptr);
+    MDKLOADER_FOREACH_MDKAPI(MDKLOADER_GENERATE_DIRECT_MDKAPI)
+    table->apiReady.store(true, std::memory_order_release);
+}
+
+#ifdef MDK_WINDOWS
+constexpr char pathListSeparator = ';';
+constexpr const char *defaultLibraryNames[] = {"mdk.dll"};
+#elif defined(__APPLE__)
+constexpr char pathListSeparator = ':';
+constexpr const char *defaultLibraryNames[] = {"libmdk.0.dylib", "libmdk.dylib"};
+#else
+constexpr char pathListSeparator = ':';
+constexpr const char *defaultLibraryNames[] = {"libmdk.so.0", "libmdk.so"};
+#endif
+
+void appendPathList(const char *list, std::vector<std::string> *directories)
+{
+    if (!list) {
+        return;
+    }
+    const std::string value = list;
+    size_t begin = 0;
+    while (begin <= value.size()) {
+        size_t end = value.find(pathListSeparator, begin);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        if (end > begin) {
+            directories->push_back(value.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+}
+
+// The directories the loader searches on its own: $MDKLOADER_PATH, then on
+// Unix $LD_LIBRARY_PATH and the default library directories.
+std::vector<std::string> defaultSearchDirectories()
+{
+    std::vector<std::string> directories;
+    appendPathList(std::getenv("MDKLOADER_PATH"), &directories);
+#ifdef MDK_UNIX
+    appendPathList(std::getenv("LD_LIBRARY_PATH"), &directories);
+    appendPathList("/usr/local/lib:/usr/lib:/lib", &directories);
+#ifdef MDK_LINUX
+    appendPathList("/usr/lib64:/lib64:/usr/lib/x86_64-linux-gnu:/usr/lib/aarch64-linux-gnu",
+                   &directories);
+#endif
+#endif
+    return directories;
+}
+
+bool isRegularFile(const std::string &path, struct stat *info)
+{
+    return (stat(path.c_str(), info) == 0) && ((info->st_mode & S_IFMT) == S_IFREG);
+}
+
+// Probes candidates with stat() only, which is much cheaper than a failing
+// dlopen(). Returns the first existing file.
+std::string probeLibrary(const std::vector<std::string> &directories,
+                         const std::vector<std::string> &names,
+                         struct stat *info)
+{
+    for (auto &&directory : directories) {
+        for (auto &&name : names) {
+            std::string path = directory;
+            if (!path.empty() && (path.back() != '/')
+#ifdef MDK_WINDOWS
+                && (path.back() != '\\')
+#endif
+            ) {
+                path += '/';
+            }
+            path += name;
+            if (isRegularFile(path, info)) {
+                return path;
+            }
+        }
+    }
+    return {};
+}
+
+int64_t modificationTime(const struct stat &info)
+{
+#ifdef MDK_LINUX
+    return (int64_t(info.st_mtim.tv_sec) * 1000000000) + info.st_mtim.tv_nsec;
+#else
+    return int64_t(info.st_mtime) * 1000000000;
+#endif
+}
+
+// FNV-1a of the search directories and names, so that a cache entry written
+// for another search, e.g. with another $MDKLOADER_PATH, is never used.
+uint64_t discoveryQueryHash(const std::vector<std::string> &directories,
+                            const std::vector<std::string> &names)
+{
+    uint64_t hash = 14695981039346656037ull;
+    const auto add = [&hash](const std::string &value) {
+        // Includes the terminating null as a separator.
+        for (size_t i = 0; i <= value.size(); ++i) {
+            hash = (hash ^ static_cast<unsigned char>(value.c_str()[i])) * 1099511628211ull;
+        }
+    };
+    for (auto &&directory : directories) {
+        add(directory);
+    }
+    add({});
+    for (auto &&name : names) {
+        add(name);
+    }
+    return hash;
+}
+
+// The cache file holds a single line:
+// "<query hash> <inode> <mtime in ns> <size> <path>". The entry is only
+// trusted for the same query and if the file still has the same identity.
+std::string readDiscoveryCache(const char *cacheFile, uint64_t query)
+{
+    std::FILE *file = std::fopen(cacheFile, "r");
+    if (!file) {
+        return {};
+    }
+    char line[4096] = {};
+    const bool read = std::fgets(line, sizeof(line), file);
+    std::fclose(file);
+    if (!read) {
+        return {};
+    }
+    unsigned long long hash = 0, inode = 0, size = 0;
+    long long mtime = 0;
+    int pathOffset = 0;
+    if ((std::sscanf(line, "%llx %llu %lld %llu %n", &hash, &inode, &mtime, &size, &pathOffset) != 4)
+        || (hash != query)) {
+        return {};
+    }
+    std::string path = line + pathOffset;
+    while (!path.empty() && ((path.back() == '\n') || (path.back() == '\r'))) {
+        path.pop_back();
+    }
+    struct stat info = {};
+    if (path.empty() || !isRegularFile(path, &info) || (uint64_t(info.st_ino) != inode)
+        || (modificationTime(info) != mtime) || (uint64_t(info.st_size) != size)) {
+        return {};
+    }
+    return path;
+}
+
+void writeDiscoveryCache(const char *cacheFile,
+                         uint64_t query,
+                         const std::string &path,
+                         const struct stat &info)
+{
+    // Write to a temporary file and rename it, concurrent launches must never
+    // read a half written entry. The name is unique to this process and call,
+    // so that concurrent writers never share the temporary file.
+    static std::atomic<unsigned> writes = {0};
+#ifdef MDK_WINDOWS
+    const unsigned long pid = GetCurrentProcessId();
+#else
+    const unsigned long pid = static_cast<unsigned long>(getpid());
+#endif
+    const std::string temporary = std::string(cacheFile) + '.' + std::to_string(pid) + '.'
+                                  + std::to_string(writes++) + ".tmp";
+    std::FILE *file = std::fopen(temporary.c_str(), "w");
+    if (!file) {
+        return;
+    }
+    const bool written = std::fprintf(file,
+                                      "%llx %llu %lld %llu %s\n",
+                                      static_cast<unsigned long long>(query),
+                                      static_cast<unsigned long long>(info.st_ino),
+                                      static_cast<long long>(modificationTime(info)),
+                                      static_cast<unsigned long long>(info.st_size),
+                                      path.c_str())
+                         > 0;
+    if ((std::fclose(file) != 0) || !written) {
+        std::remove(temporary.c_str());
+        return;
+    }
+#ifdef MDK_WINDOWS
+    std::remove(cacheFile);
+#endif
+    std::rename(temporary.c_str(), cacheFile);
+}
+
+std::string discoverLibrary(const mdkloaderDiscoveryOptions *options)
+{
+    const TraceScope discoverScope("mdkloader discover");
+    struct stat info = {};
+    // An explicit path wins over the cache, it's one stat() anyway.
+    if (const char *env = std::getenv("MDKLOADER_LIBRARY")) {
+        if (isRegularFile(env, &info)) {
+            return env;
+        }
+    }
+    std::vector<std::string> directories;
+    if (options && options->directories) {
+        for (auto directory = options->directories; *directory; ++directory) {
+            directories.push_back(*directory);
+        }
+    }
+    const std::vector<std::string> defaults = defaultSearchDirectories();
+    directories.insert(directories.end(), defaults.cbegin(), defaults.cend());
+    std::vector<std::string> names;
+    if (options && options->names) {
+        for (auto name = options->names; *name; ++name) {
+            names.push_back(*name);
+        }
+    } else {
+        names.assign(std::cbegin(defaultLibraryNames), std::cend(defaultLibraryNames));
+    }
+    const char *cacheFile = options ? options->cacheFile : nullptr;
+    const uint64_t query = cacheFile ? discoveryQueryHash(directories, names) : 0;
+    if (cacheFile) {
+        std::string cached = readDiscoveryCache(cacheFile, query);
+        if (!cached.empty()) {
+            return cached;
+        }
+    }
+    const std::string path = probeLibrary(directories, names, &info);
+    if (!path.empty() && cacheFile) {
+        writeDiscoveryCache(cacheFile, query, path, info);
+    }
+    return path;
+}
+
+#ifdef MDK_LINUX
+// Best effort guess of the file dlopen() will pick: a name with a slash is
+// used as is, otherwise the search directories are probed. The ld.so cache
+// isn't consulted.
+std::string findLibraryFile(const char *value)
+{
+    struct stat info = {};
+    if (std::strchr(value, '/')) {
+        return isRegularFile(value, &info) ? value : std::string();
+    }
+    return probeLibrary(defaultSearchDirectories(), {value}, &info);
+}
+
+// Starts asynchronous readahead of the whole file, so that mapping and
+// relocating the library doesn't fault its pages in one by one from disk.
+void prefetchLibrary(const char *value)
+{
+    const std::string path = findLibraryFile(value);
+    if (path.empty()) {
+        return;
+    }
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+// Names of the objects in the link maps, as the dynamic linker found them.
+std::vector<std::string> loadedObjects()
+{
+    std::vector<std::string> objects;
+    dl_iterate_phdr(
+        [](struct dl_phdr_info *info, size_t, void *data) {
+            if (info->dlpi_name && info->dlpi_name[0]) {
+                static_cast<std::vector<std::string> *>(data)->emplace_back(info->dlpi_name);
+            }
+            return 0;
+        },
+        &objects);
+    return objects;
+}
+
+// The name /proc/self/smaps shows for the file.
+std::string canonicalPath(const char *path)
+{
+    char *const resolved = realpath(path, nullptr);
+    if (!resolved) {
+        return path;
+    }
+    std::string canonical = resolved;
+    std::free(resolved);
+    return canonical;
+}
+
+// The files of path and of the objects loaded since before was taken.
+std::vector<std::string> addedObjects(const std::vector<std::string> &before, const char *path)
+{
+    std::vector<std::string> added = {canonicalPath(path)};
+    for (const std::string &object : loadedObjects()) {
+        if (std::find(before.cbegin(), before.cend(), object) != before.cend()) {
+            continue;
+        }
+        std::string file = canonicalPath(object.c_str());
+        if (std::find(added.cbegin(), added.cend(), file) == added.cend()) {
+            added.push_back(std::move(file));
+        }
+    }
+    return added;
+}
+
+// Size of a PMD mapped transparent huge page, 0 if madvise() can't get any.
+size_t hugePageSize()
+{
+    char setting[128] = {};
+    std::FILE *file = std::fopen("/sys/kernel/mm/transparent_hugepage/enabled", "re");
+    if (!file) {
+        return 0;
+    }
+    const bool enabled = std::fgets(setting, sizeof(setting), file) && !std::strstr(setting, "[never]");
+    std::fclose(file);
+    if (!enabled) {
+        return 0;
+    }
+    unsigned long long size = 2 << 20;
+    file = std::fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "re");
+    if (file) {
+        if (std::fscanf(file, "%llu", &size) != 1) {
+            size = 2 << 20;
+        }
+        std::fclose(file);
+    }
+    return static_cast<size_t>(size);
+}
+
+// Copies [start, start + size) onto anonymous memory advised for huge pages,
+// then mremap() swaps the copy in. The swap is atomic, code running in the
+// range meanwhile keeps executing the same instructions. Returns false with
+// the original mapping untouched if anything fails.
+bool remapOntoHugePages(const uintptr_t start, const size_t size, const size_t pageSize)
+{
+    // Over-allocate to place the copy on a huge page boundary, which the
+    // kernel needs both to fault in huge pages and to move them as a whole.
+    void *const reserved = mmap(nullptr,
+                                size + pageSize,
+                                PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                -1,
+                                0);
+    if (reserved == MAP_FAILED) {
+        return false;
+    }
+    const auto base = reinterpret_cast<uintptr_t>(reserved);
+    const uintptr_t aligned = (base + pageSize - 1) & ~(pageSize - 1);
+    if (aligned != base) {
+        munmap(reserved, aligned - base);
+    }
+    if (aligned != (base + pageSize)) {
+        munmap(reinterpret_cast<void *>(aligned + size), base + pageSize - aligned);
+    }
+    void *const copy = reinterpret_cast<void *>(aligned);
+    bool moved = (madvise(copy, size, MADV_HUGEPAGE) == 0);
+    if (moved) {
+        std::memcpy(copy, reinterpret_cast<const void *>(start), size);
+        moved = (mprotect(copy, size, PROT_READ | PROT_EXEC) == 0)
+                && (mremap(copy, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, reinterpret_cast<void *>(start))
+                    != MAP_FAILED);
+    }
+    if (!moved) {
+        const int error = errno;
+        munmap(copy, size);
+        errno = error;
+    }
+    return moved;
+}
+
+// Moves the code of the objects loaded since before was taken onto huge
+// pages, see mdkloaderLoadOptions.hugePageText. Only the part of a segment
+// which spans whole huge pages can be moved. Returns the bytes moved.
+int64_t remapTextOntoHugePages(const std::vector<std::string> &before)
+{
+    const size_t pageSize = hugePageSize();
+    if (pageSize == 0) {
+        logMessage(MDKLoader_LogLevel_Info,
+                   "Transparent huge pages are disabled, the code of MDK stays on small pages.");
+        return 0;
+    }
+    struct Segment
+    {
+        uintptr_t start;
+        size_t size;
+    };
+    struct Search
+    {
+        const std::vector<std::string> *before;
+        size_t pageSize;
+        std::vector<Segment> segments;
+    } search = {&before, pageSize, {}};
+    // Collected first, the copies are too slow to make under the lock of the dynamic linker.
+    dl_iterate_phdr(
+        [](struct dl_phdr_info *info, size_t, void *data) {
+            Search &search = *static_cast<Search *>(data);
+            if (!info->dlpi_name || !info->dlpi_name[0]
+                || (std::find(search.before->cbegin(), search.before->cend(), info->dlpi_name)
+                    != search.before->cend())) {
+                return 0;
+            }
+            for (ElfW(Half) i = 0; i != info->dlpi_phnum; ++i) {
+                const ElfW(Phdr) &header = info->dlpi_phdr[i];
+                if ((header.p_type != PT_LOAD) || !(header.p_flags & PF_X)
+                    || !(header.p_flags & PF_R) || (header.p_flags & PF_W)) {
+                    continue;
+                }
+                const uintptr_t begin = info->dlpi_addr + header.p_vaddr;
+                const uintptr_t start = (begin + search.pageSize - 1) & ~(search.pageSize - 1);
+                const uintptr_t end = (begin + header.p_memsz) & ~(search.pageSize - 1);
+                if (end > start) {
+                    search.segments.push_back({start, end - start});
+                }
+            }
+            return 0;
+        },
+        &search);
+    int64_t moved = 0;
+    for (const Segment &segment : search.segments) {
+        if (remapOntoHugePages(segment.start, segment.size, pageSize)) {
+            moved += static_cast<int64_t>(segment.size);
+        } else {
+            logMessage(MDKLoader_LogLevel_Warning,
+                       "Failed to move %zu bytes of code onto huge pages: %s",
+                       segment.size,
+                       std::strerror(errno));
+        }
+    }
+    return moved;
+}
+
+// One entry of /proc/self/smaps, sizes in bytes.
+struct SmapsMapping
+{
+    uintptr_t start = 0;
+    uintptr_t end = 0;
+    std::string path;
+    int64_t rss = 0;
+    int64_t anonymous = 0;
+};
+
+// Calls visit for every mapping in file, which is in the format of
+// /proc/self/smaps. Returns false if the file can't be read.
+template<typename Visit>
+bool readSmaps(const char *file, Visit visit)
+{
+    std::FILE *const smaps = std::fopen(file, "re");
+    if (!smaps) {
+        return false;
+    }
+    SmapsMapping mapping;
+    bool inMapping = false;
+    char *line = nullptr;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, smaps) > 0) {
+        // Fields start with a capital letter, ranges with a lower case hex digit.
+        unsigned long start = 0;
+        unsigned long end = 0;
+        int pathOffset = 0;
+        if (std::sscanf(line, "%lx-%lx %*s %*s %*s %*s %n", &start, &end, &pathOffset) == 2) {
+            if (inMapping) {
+                visit(static_cast<const SmapsMapping &>(mapping));
+            }
+            inMapping = true;
+            mapping.start = start;
+            mapping.end = end;
+            mapping.path.assign(line + pathOffset, std::strcspn(line + pathOffset, "\n"));
+            constexpr char deleted[] = " (deleted)";
+            const size_t deletedLength = sizeof(deleted) - 1;
+            if ((mapping.path.size() > deletedLength)
+                && !mapping.path.compare(mapping.path.size() - deletedLength, deletedLength, deleted)) {
+                mapping.path.resize(mapping.path.size() - deletedLength);
+            }
+            mapping.rss = 0;
+            mapping.anonymous = 0;
+        } else if (!std::strncmp(line, "Rss:", 4)) {
+            mapping.rss = std::strtoll(line + 4, nullptr, 10) * 1024;
+        } else if (!std::strncmp(line, "Anonymous:", 10)) {
+            mapping.anonymous = std::strtoll(line + 10, nullptr, 10) * 1024;
+        }
+    }
+    if (inMapping) {
+        visit(static_cast<const SmapsMapping &>(mapping));
+    }
+    std::free(line);
+    std::fclose(smaps);
+    return true;
+}
+
+// Copy-on-write pages of a file mapping count as anonymous.
+void addMapping(mdkloaderMemoryUsage &usage, const SmapsMapping &mapping)
+{
+    usage.fileRss += mapping.rss - mapping.anonymous;
+    usage.anonRss += mapping.anonymous;
+}
+
+mdkloaderMemoryUsage processMemory()
+{
+    mdkloaderMemoryUsage usage = {};
+    const auto add = [&usage](const SmapsMapping &mapping) { addMapping(usage, mapping); };
+    // The kernel sums the rollup up itself, much cheaper than listing every mapping.
+    if (!readSmaps("/proc/self/smaps_rollup", add)) {
+        readSmaps("/proc/self/smaps", add);
+    }
+    return usage;
+}
+
+// Resident memory of the mappings of every file in paths. The anonymous
+// mapping right behind the last one of a file is its bss.
+std::vector<mdkloaderMemoryUsage> libraryMemory(const std::vector<std::string> &paths)
+{
+    std::vector<mdkloaderMemoryUsage> usage(paths.size());
+    std::unordered_map<std::string, size_t> indices;
+    for (size_t i = 0; i != paths.size(); ++i) {
+        indices.emplace(paths[i], i);
+    }
+    mdkloaderMemoryUsage *previous = nullptr;
+    uintptr_t previousEnd = 0;
+    readSmaps("/proc/self/smaps", [&](const SmapsMapping &mapping) {
+        if (mapping.path.empty() && previous && (mapping.start == previousEnd)) {
+            previous->anonRss += mapping.rss;
+            previous = nullptr;
+            return;
+        }
+        const auto it = indices.find(mapping.path);
+        previous = (it != indices.cend()) ? &usage[it->second] : nullptr;
+        if (previous) {
+            addMapping(*previous, mapping);
+            previousEnd = mapping.end;
+        }
+    });
+    return usage;
+}
+#endif
+
+// An isolated library gets a link map namespace of its own on Linux, so that
+// it and its dependencies don't interpose with any other MDK loaded in the
+// process. Elsewhere it is a plain load, isolated by its distinct path.
+MDK_HANDLE openLibrary(const char *path,
+                       const MDKLoader_BindingMode binding,
+                       const bool isolated = false,
+                       const int openFlags = 0)
+{
+#ifdef MDK_WINDOWS
+    (void) openFlags;
+    return LoadLibraryA(path);
+#else
+    const int flags = ((binding == MDKLoader_BindingMode_Eager) ? RTLD_NOW : RTLD_LAZY) | openFlags;
+#ifdef MDK_LINUX
+    if (isolated) {
+        return dlmopen(LM_ID_NEWLM, path, flags);
+    }
+#endif
+    return dlopen(path, flags);
+#endif
+}
+
+void closeLibrary(MDK_HANDLE library)
+{
+#ifdef MDK_WINDOWS
+    if (!FreeLibrary(library)) {
+        logMessage(MDKLoader_LogLevel_Warning, "Failed to unload the MDK library.");
+    }
+#else
+    dlclose(library);
+#endif
+}
+
+// Must be called with mdkLoadMutex held.
+void applyFFmpegOptions(const MDKAPITable *table)
+{
+    const auto setOption = table ? table->m_lpMDK_setGlobalOptionString.load(std::memory_order_relaxed)
+                                 : nullptr;
+    if (!setOption) {
+        return;
+    }
+    for (int i = 0; i != MDKLoader_FFmpegLibrary_Count; ++i) {
+        if (!ffmpegPaths[i].empty()) {
+            setOption(ffmpegOptionKeys[i], ffmpegPaths[i].c_str());
+        }
+    }
+}
+
+// MDK's global state as set through the forwarding functions, so that it
+// survives an idle unload. Only the last value of every option is kept.
+struct GlobalOption
+{
+    enum Type { String, Int32, Ptr };
+    std::string key;
+    Type type = String;
+    std::string string;
+    int int32 = 0;
+    void *ptr = nullptr;
+};
+
+struct GlobalState
+{
+    std::vector<GlobalOption> options;
+    bool hasLogLevel = false;
+    MDK_LogLevel logLevel = MDK_LogLevel_Info;
+    bool hasLogHandler = false;
+    mdkLogHandler logHandler = {};
+};
+
+std::mutex globalStateMutex;
+GlobalState globalState;
+
+GlobalOption &recordGlobalOption(const char *key, const GlobalOption::Type type)
+{
+    for (GlobalOption &option : globalState.options) {
+        if (option.key == key) {
+            option.type = type;
+            return option;
+        }
+    }
+    globalState.options.emplace_back();
+    GlobalOption &option = globalState.options.back();
+    option.key = key;
+    option.type = type;
+    return option;
+}
+
+void replayGlobalState(const MDKAPITable *table)
+{
+    std::lock_guard<std::mutex> locker(globalStateMutex);
+    if (globalState.hasLogLevel && table->m_lpMDK_setLogLevel) {
+        table->m_lpMDK_setLogLevel.load(std::memory_order_relaxed)(globalState.logLevel);
+    }
+    if (globalState.hasLogHandler && table->m_lpMDK_setLogHandler) {
+        table->m_lpMDK_setLogHandler.load(std::memory_order_relaxed)(globalState.logHandler);
+    }
+    for (const GlobalOption &option : globalState.options) {
+        const char *const key = option.key.c_str();
+        if ((option.type == GlobalOption::String) && table->m_lpMDK_setGlobalOptionString) {
+            table->m_lpMDK_setGlobalOptionString.load(std::memory_order_relaxed)(key,
+                                                                                 option.string.c_str());
+        } else if ((option.type == GlobalOption::Int32) && table->m_lpMDK_setGlobalOptionInt32) {
+            table->m_lpMDK_setGlobalOptionInt32.load(std::memory_order_relaxed)(key, option.int32);
+        } else if ((option.type == GlobalOption::Ptr) && table->m_lpMDK_setGlobalOptionPtr) {
+            table->m_lpMDK_setGlobalOptionPtr.load(std::memory_order_relaxed)(key, option.ptr);
+        }
+    }
+}
+
+int64_t elapsedMicroseconds(const std::chrono::steady_clock::time_point &since)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()
+                                                                 - since)
+        .count();
+}
+
+// The text of the last LoadLibrary()/dlopen() failure of this thread.
+void libraryError(char *buffer, const size_t size)
+{
+#ifdef MDK_WINDOWS
+    const DWORD length = FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                                        nullptr,
+                                        GetLastError(),
+                                        0,
+                                        buffer,
+                                        static_cast<DWORD>(size),
+                                        nullptr);
+    if (length == 0) {
+        copyString(buffer, size, "");
+    }
+#else
+    copyString(buffer, size, dlerror());
+#endif
+}
+
+// The file the library was actually loaded from, e.g. after the search in
+// LD_LIBRARY_PATH. Falls back to the requested name.
+void libraryPath(MDK_HANDLE library, const char *value, char *buffer, const size_t size)
+{
+#ifdef MDK_WINDOWS
+    const DWORD length = GetModuleFileNameA(library, buffer, static_cast<DWORD>(size));
+    if ((length > 0) && (length < size)) {
+        return;
+    }
+#elif defined(MDK_LINUX)
+    struct link_map *linkMap = nullptr;
+    if ((dlinfo(library, RTLD_DI_LINKMAP, &linkMap) == 0) && linkMap && linkMap->l_name
+        && linkMap->l_name[0]) {
+        copyString(buffer, size, linkMap->l_name);
+        return;
+    }
+#else
+    (void) library;
+#endif
+    copyString(buffer, size, value);
+}
+
+// Fills report as it goes, report.loaded is only true if a complete table is
+// returned.
+std::unique_ptr<MDKAPITable> createTable(const char *value,
+                                         const mdkloaderLoadOptions *options,
+                                         mdkloaderLoadReport &report,
+                                         const bool isolated = false)
+{
+    const TraceScope loadScope("mdkloader load");
+    MDKLOADER_PROBE(load__start, value);
+    const MDKLoader_BindingMode binding = options ? options->binding
+                                                  : MDKLoader_BindingMode_Default;
+    report = {};
+    report.binding = binding;
+#ifdef MDK_LINUX
+    // Taken before the clock starts, the timings don't include the measuring.
+    const bool measureMemory = options && options->measureMemory;
+    const mdkloaderMemoryUsage rssBefore = measureMemory ? processMemory() : mdkloaderMemoryUsage{};
+    const std::vector<std::string> objectsBefore = isolated ? std::vector<std::string>()
+                                                            : loadedObjects();
+#endif
+    mdkloaderLoadTimings &timings = report.timings;
+    const auto loadStart = std::chrono::steady_clock::now();
+#ifdef MDK_LINUX
+    if (options && options->prefetch) {
+        const TraceScope prefetchScope("mdkloader prefetch");
+        prefetchLibrary(value);
+        timings.prefetchTime = elapsedMicroseconds(loadStart);
+    }
+#endif
+    const auto openStart = std::chrono::steady_clock::now();
+    const int openFlags = options ? options->openFlags : 0;
+    auto table = std::make_unique<MDKAPITable>();
+    {
+        const TraceScope openScope("mdkloader open");
+        table->library = openLibrary(value, binding, isolated, openFlags);
+    }
+    timings.openTime = elapsedMicroseconds(openStart);
+    if (!table->library) {
+        libraryError(report.error, sizeof(report.error));
+        copyString(report.path, sizeof(report.path), value);
+        logMessage(MDKLoader_LogLevel_Error,
+                   "Failed to load the MDK library %s: %s",
+                   value,
+                   report.error);
+        timings.totalTime = elapsedMicroseconds(loadStart);
+        MDKLOADER_PROBE(load__done, value, 0, timings.totalTime);
+        return nullptr;
+    }
+    libraryPath(table->library, value, report.path, sizeof(report.path));
+    table->path = report.path;
+#ifdef MDK_LINUX
+    if (!isolated) {
+        table->libraries = addedObjects(objectsBefore, report.path);
+    }
+    if (options && options->hugePageText && !isolated) {
+        const TraceScope hugePageScope("mdkloader huge page text");
+        report.hugePageText = remapTextOntoHugePages(objectsBefore);
+        table->hugePageText = true;
+    }
+#endif
+    logMessage(MDKLoader_LogLevel_Info, "The MDK library has been loaded from %s.", report.path);
+    const auto resolveStart = std::chrono::steady_clock::now();
+    const bool lazy = (binding == MDKLoader_BindingMode_Lazy);
+    table->binding = binding;
+    table->openFlags = openFlags;
+    {
+        const TraceScope resolveScope("mdkloader resolve");
+        resolveTable(table.get(), lazy);
+        if (!lazy) {
+            fillDirectTable(table.get());
+        }
+    }
+    // Lazily bound symbols are only looked up on first use, so a missing one
+    // can't be detected here.
+    table->resolved = isTableComplete(table.get());
+    timings.resolveTime = elapsedMicroseconds(resolveStart);
+    report.missingSymbols = allMDKAPIMask & ~table->resolvedMask;
+    for (MDKAPIMask missing = report.missingSymbols; missing; missing &= (missing - 1)) {
+        ++report.missingSymbolCount;
+    }
+    applyFFmpegOptions(table.get());
+    if (table->resolved) {
+        logMessage(MDKLoader_LogLevel_Info, "All MDK symbols have been resolved successfully.");
+    } else {
+        logMessage(MDKLoader_LogLevel_Error,
+                   "Failed to resolve %d MDK symbols.",
+                   report.missingSymbolCount);
+    }
+    report.loaded = table->resolved;
+    timings.totalTime = elapsedMicroseconds(loadStart);
+    MDKLOADER_PROBE(load__done, value, static_cast<int>(report.loaded), timings.totalTime);
+#ifdef MDK_LINUX
+    if (measureMemory) {
+        const mdkloaderMemoryUsage rssAfter = processMemory();
+        report.rssDelta.fileRss = rssAfter.fileRss - rssBefore.fileRss;
+        report.rssDelta.anonRss = rssAfter.anonRss - rssBefore.anonRss;
+    }
+#endif
+    return table;
+}
+
+void destroyTable(const MDKAPITable *table)
+{
+    if (table->library) {
+        closeLibrary(table->library);
+    }
+    delete table;
+}
+
+// Must only be called with generationMutex held.
+bool takeReclaimableTable(const MDKAPITable *table)
+{
+    if (!table->graceElapsed || (table->livePlayers > 0)
+        || (table->liveFrames.load(std::memory_order_relaxed) > 0)) {
+        return false;
+    }
+    const auto it = std::find(retiredTables.cbegin(), retiredTables.cend(), table);
+    if (it == retiredTables.cend()) {
+        return false;
+    }
+    retiredTables.erase(it);
+    return true;
+}
+
+// The table must be in retiredTables and no longer published. Waits for the
+// grace period, then destroys the table unless some of its Players are still
+// alive, in which case the last mdkPlayerAPI_delete() destroys it.
+void retireTable(const MDKAPITable *table)
+{
+    {
+        const TraceScope graceScope("mdkloader grace period");
+        waitForReaders(table);
+    }
+    bool reclaim = false;
+    {
+        std::lock_guard<std::mutex> locker(generationMutex);
+        table->graceElapsed = true;
+        reclaim = takeReclaimableTable(table);
+    }
+    if (reclaim) {
+        destroyTable(table);
+    }
+}
+
+// Whether nothing created by table is alive.
+bool isTableIdle(const MDKAPITable *table)
+{
+    std::lock_guard<std::mutex> locker(generationMutex);
+    return (table->livePlayers == 0) && (table->liveFrames.load(std::memory_order_relaxed) == 0);
+}
+
+void closeFFmpegLibraries()
+{
+    for (MDK_HANDLE &library : ffmpegLibraries) {
+        if (library) {
+            closeLibrary(library);
+            library = nullptr;
+        }
+    }
+}
+
+// Unloads MDK and the preloaded FFmpeg libraries if nothing uses them.
+// Returns false if the library is in use after all.
+bool tryIdleUnload()
+{
+    std::lock_guard<std::mutex> locker(mdkLoadMutex);
+    const MDKAPITable *const table = mdkTable.load(std::memory_order_acquire);
+    if (!table || table->pinned.load(std::memory_order_relaxed) || !isTableIdle(table)) {
+        return false;
+    }
+    idleUnloaded.store(true, std::memory_order_seq_cst);
+    mdkTable.store(nullptr, std::memory_order_seq_cst);
+    {
+        const TraceScope graceScope("mdkloader grace period");
+        waitForReaders(table);
+    }
+    // A call raced with the unload, e.g. one creating a Player. Keep the library.
+    if (mdkUsed.load(std::memory_order_seq_cst) || !isTableIdle(table)) {
+        mdkTable.store(table, std::memory_order_seq_cst);
+        idleUnloaded.store(false, std::memory_order_relaxed);
+        return false;
+    }
+    idleReloadPath = table->path;
+    idleReloadOptions.binding = table->binding;
+    idleReloadOptions.openFlags = table->openFlags;
+    idleReloadOptions.hugePageText = table->hugePageText;
+    destroyTable(table);
+    closeFFmpegLibraries();
+#ifdef MDK_UNIX
+    if (void *const library = dlopen(idleReloadPath.c_str(), RTLD_LAZY | RTLD_NOLOAD)) {
+        dlclose(library);
+        logMessage(MDKLoader_LogLevel_Warning,
+                   "%s stays mapped after unloading, e.g. because it has unique symbols.",
+                   idleReloadPath.c_str());
+    }
+#endif
+    mdkLoadStatus.store(MDKLoader_LoadStatus_IdleUnloaded, std::memory_order_release);
+    logMessage(MDKLoader_LogLevel_Info, "The MDK library has been unloaded after being idle.");
+    return true;
+}
+
+// Called by a ReadGuard which found MDK unloaded for being idle. Returns null
+// if loading failed, which leaves MDK unloaded like a failed mdkloader_load():
+// retrying in every call would open the library with the load lock held again
+// and again.
+const MDKAPITable *reloadAfterIdle()
+{
+    std::lock_guard<std::mutex> locker(mdkLoadMutex);
+    if (const MDKAPITable *table = mdkTable.load(std::memory_order_acquire)) {
+        return table;
+    }
+    if (!idleUnloaded.load(std::memory_order_relaxed)) {
+        // mdkloader_cleanup() meanwhile.
+        return nullptr;
+    }
+    const TraceScope reloadScope("mdkloader reload after idle");
+    for (int i = 0; i != MDKLoader_FFmpegLibrary_Count; ++i) {
+        if (!ffmpegPaths[i].empty() && !ffmpegLibraries[i]) {
+            ffmpegLibraries[i] = openLibrary(ffmpegPaths[i].c_str(), MDKLoader_BindingMode_Default);
+        }
+    }
+    std::unique_ptr<MDKAPITable> table = createTable(idleReloadPath.c_str(),
+                                                     &idleReloadOptions,
+                                                     lastLoadReport);
+    if (!table || !table->resolved) {
+        if (table) {
+            closeLibrary(table->library);
+        }
+        idleUnloaded.store(false, std::memory_order_relaxed);
+        mdkLoadStatus.store(MDKLoader_LoadStatus_Failed, std::memory_order_release);
+        logMessage(MDKLoader_LogLevel_Error,
+                   "Failed to load the MDK library again after being idle: %s",
+                   lastLoadReport.error[0] ? lastLoadReport.error : "missing symbols");
+        return nullptr;
+    }
+    replayGlobalState(table.get());
+    idleUnloaded.store(false, std::memory_order_relaxed);
+    mdkTable.store(table.get(), std::memory_order_seq_cst);
+    mdkLoadStatus.store(MDKLoader_LoadStatus_Loaded, std::memory_order_release);
+    return table.release();
+}
+
+// Guards the watcher thread and its settings, never held with another lock.
+std::mutex idleMutex;
+std::condition_variable idleCondition;
+int64_t idleTimeout = 0; // milliseconds, 0 if disabled
+bool idleWatcherQuit = false;
+
+void watchIdle()
+{
+    std::unique_lock<std::mutex> locker(idleMutex);
+    auto idleSince = std::chrono::steady_clock::now();
+    while (!idleWatcherQuit) {
+        const std::chrono::milliseconds timeout(idleTimeout);
+        // A few ticks per period, MDK is unloaded at most a quarter late.
+        idleCondition.wait_for(locker, std::max(timeout / 4, std::chrono::milliseconds(1)));
+        if (idleWatcherQuit || (idleTimeout <= 0)) {
+            break;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (mdkUsed.exchange(false, std::memory_order_relaxed)) {
+            idleSince = now;
+            continue;
+        }
+        if ((now - idleSince) < timeout) {
+            continue;
+        }
+        locker.unlock();
+        tryIdleUnload();
+        locker.lock();
+        // Loaded but busy, e.g. a Player is playing: check again after another period.
+        idleSince = now;
+    }
+}
+
+// Stops the watcher at exit, a joinable std::thread must not be destroyed.
+struct IdleWatcher
+{
+    ~IdleWatcher() { stop(); }
+
+    // Must not be called with idleMutex held.
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> locker(idleMutex);
+            idleWatcherQuit = true;
+        }
+        idleCondition.notify_all();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    // Must be called with idleMutex held.
+    void start()
+    {
+        idleWatcherQuit = false;
+        thread = std::thread(watchIdle);
+    }
+
+    std::thread thread;
+};
+
+IdleWatcher idleWatcher;
+
+// The threads of mdkloader_loadAsync(). A load must not outlive
+// mdkloader_cleanup(), nor run into the destruction of the loader at exit.
+struct AsyncLoads
+{
+    ~AsyncLoads() { join(); }
+
+    void add(std::thread thread)
+    {
+        std::lock_guard<std::mutex> locker(mutex);
+        threads.push_back(std::move(thread));
+    }
+
+    // Waits for the loads started so far and their callbacks, except the one
+    // running on this thread, e.g. if a callback calls mdkloader_cleanup().
+    void join()
+    {
+        std::vector<std::thread> started;
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            started.swap(threads);
+        }
+        for (std::thread &thread : started) {
+            if (thread.get_id() == std::this_thread::get_id()) {
+                thread.detach();
+            } else {
+                thread.join();
+            }
+        }
+    }
+
+    std::mutex mutex; // never held with another lock
+    std::vector<std::thread> threads;
+};
+
+AsyncLoads asyncLoads;
+
+// mdkloader_loadAsync() reports Loading without the load lock, which can be
+// after another thread published the table. Its own thread always ends up
+// here then and corrects the status.
+bool alreadyLoaded(const MDKAPITable *table)
+{
+    MDKLoader_LoadStatus loading = MDKLoader_LoadStatus_Loading;
+    if (mdkLoadStatus.load(std::memory_order_relaxed) == loading) {
+        mdkLoadStatus.compare_exchange_strong(loading,
+                                              table->resolved ? MDKLoader_LoadStatus_Loaded
+                                                              : MDKLoader_LoadStatus_Failed,
+                                              std::memory_order_acq_rel,
+                                              std::memory_order_relaxed);
+    }
+    return table->resolved;
+}
+
+#ifdef MDK_UNIX
+// fork() only duplicates the calling thread. The locks are taken around it,
+// so that the child never inherits one held by a thread which is gone, and
+// the per-thread bookkeeping of those threads is reset in the child.
+// idleMutex and the lock of asyncLoads are never held with another lock, so
+// they can come first. The rest follow the order used everywhere else: the
+// load lock, then the global state replayed under it, then the generation lock.
+// The frame shards are never held with another lock, the order is arbitrary.
+void preforkPrepare()
+{
+    idleMutex.lock();
+    asyncLoads.mutex.lock();
+    mdkLoadMutex.lock();
+    globalStateMutex.lock();
+    generationMutex.lock();
+    for (FrameShard &shard : frameShards) {
+        shard.mutex.lock();
+    }
+#ifdef MDKLOADER_ENABLE_TRACE
+    traceFlushMutex.lock();
+#endif
+#ifdef MDKLOADER_ENABLE_CAPTURE
+    captureFlushMutex.lock();
+#endif
+    logSinkMutex.lock();
+}
+
+void preforkParent()
+{
+    logSinkMutex.unlock();
+#ifdef MDKLOADER_ENABLE_CAPTURE
+    captureFlushMutex.unlock();
+#endif
+#ifdef MDKLOADER_ENABLE_TRACE
+    traceFlushMutex.unlock();
+#endif
+    for (FrameShard &shard : frameShards) {
+        shard.mutex.unlock();
+    }
+    generationMutex.unlock();
+    globalStateMutex.unlock();
+    mdkLoadMutex.unlock();
+    asyncLoads.mutex.unlock();
+    idleMutex.unlock();
+}
+
+void preforkChild()
+{
+    // Nobody can be inside a wrapper except this thread, the grace period of
+    // a reload in the child must not wait for the readers of the parent.
+    for (ReaderSlot *slot = readerSlots.load(std::memory_order_relaxed); slot; slot = slot->next) {
+        if (slot != threadReader.slot) {
+            slot->table.store(nullptr, std::memory_order_relaxed);
+            slot->inUse.store(false, std::memory_order_relaxed);
+        }
+    }
+#ifdef MDKLOADER_ENABLE_STATS
+    for (ThreadCallStats *stats = threadCallStatsList.load(std::memory_order_relaxed); stats;
+         stats = stats->next) {
+        if (stats != threadCallStats.stats) {
+            stats->inUse.store(false, std::memory_order_relaxed);
+        }
+    }
+#endif
+#ifdef MDKLOADER_ENABLE_TRACE
+    for (TraceRing *ring = traceRings.load(std::memory_order_relaxed); ring; ring = ring->next) {
+        if (ring != threadTrace.ring) {
+            ring->inUse.store(false, std::memory_order_relaxed);
+        }
+    }
+    threadTrace.id = currentThreadId();
+#endif
+#ifdef MDKLOADER_ENABLE_CAPTURE
+    // A thread which is gone may have held the lock of its buffer.
+    for (CaptureBuffer *buffer = captureBuffers.load(std::memory_order_relaxed); buffer;
+         buffer = buffer->next) {
+        if (buffer != threadCapture.buffer) {
+            new (&buffer->mutex) std::mutex;
+            buffer->inUse.store(false, std::memory_order_relaxed);
+        }
+    }
+#endif
+    // mdkloader_loadAsync() reports Loading before its thread gets the lock,
+    // that thread didn't survive.
+    if (mdkLoadStatus.load(std::memory_order_relaxed) == MDKLoader_LoadStatus_Loading) {
+        mdkLoadStatus.store(mdkTable.load(std::memory_order_relaxed) ? MDKLoader_LoadStatus_Loaded
+                                                                     : MDKLoader_LoadStatus_NotLoaded,
+                            std::memory_order_relaxed);
+    }
+    // Nor did any other loading thread, there is nothing to join.
+    for (std::thread &thread : asyncLoads.threads) {
+        new (&thread) std::thread;
+    }
+    asyncLoads.threads.clear();
+    preforkParent();
+    // The thread object refers to the watcher of the parent, start our own.
+    if (idleWatcher.thread.joinable()) {
+        new (&idleWatcher.thread) std::thread;
+        std::lock_guard<std::mutex> locker(idleMutex);
+        idleWatcher.start();
+    }
+}
+#endif
+
+// The players and frames of a replay, by the ids they had in the capture. A
+// Player which was created before capturing started is created on first use.
+struct ReplayContext
+{
+    ~ReplayContext()
+    {
+        for (auto &player : players) {
+            mdkPlayerAPI_delete(&player.second);
+        }
+        for (auto &frame : frames) {
+            mdkVideoFrameAPI_delete(&frame.second);
+        }
+    }
+
+    const mdkPlayerAPI *player(const uint64_t id)
+    {
+        if (!id) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> locker(mutex);
+        const mdkPlayerAPI *&player = players[id];
+        if (!player) {
+            player = mdkPlayerAPI_new();
+        }
+        return player;
+    }
+
+    bool deletePlayer(const uint64_t id)
+    {
+        const mdkPlayerAPI *player = nullptr;
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            const auto it = players.find(id);
+            if (it == players.cend()) {
+                return false;
+            }
+            player = it->second;
+            players.erase(it);
+            tokens.erase(tokens.lower_bound({id, 0}), tokens.upper_bound({id, UINT64_MAX}));
+        }
+        mdkPlayerAPI_delete(&player);
+        return true;
+    }
+
+    bool newFrame(const uint64_t id, const int width, const int height, const MDK_PixelFormat format)
+    {
+        mdkVideoFrameAPI *const frame = mdkVideoFrameAPI_new(width, height, format);
+        std::lock_guard<std::mutex> locker(mutex);
+        mdkVideoFrameAPI *&slot = frames[id];
+        if (slot) {
+            mdkVideoFrameAPI_delete(&slot);
+        }
+        slot = frame;
+        return frame != nullptr;
+    }
+
+    bool deleteFrame(const uint64_t id)
+    {
+        mdkVideoFrameAPI *frame = nullptr;
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            const auto it = frames.find(id);
+            if (it == frames.cend()) {
+                return false;
+            }
+            frame = it->second;
+            frames.erase(it);
+        }
+        mdkVideoFrameAPI_delete(&frame);
+        return true;
+    }
+
+    std::mutex mutex;
+    std::unordered_map<uint64_t, const mdkPlayerAPI *> players;
+    std::unordered_map<uint64_t, mdkVideoFrameAPI *> frames;
+    // Node based, MDK keeps no pointer to a token but a call may outlive an insertion.
+    std::map<std::pair<uint64_t, MDK_CallbackToken>, MDK_CallbackToken> tokens;
+};
+
+MDK_CallbackToken *replayToken(ReplayContext *context, const uint64_t player, const MDK_CallbackToken recorded)
+{
+    std::lock_guard<std::mutex> locker(context->mutex);
+    return &context->tokens[{player, recorded}];
+}
+
+using ReplayMDKAPI = bool (*)(CaptureReader &in);
+
+template<typename Func, Func func>
+struct ReplayFunction;
+
+template<typename Result, typename... Args, Result (*func)(Args...)>
+struct ReplayFunction<Result (*)(Args...), func>
+{
+    static bool call(CaptureReader &in)
+    {
+        if constexpr (!isReplayable<Args...>) {
+            (void) in;
+            return false;
+        } else {
+            // Braced, the arguments are decoded from left to right.
+            const std::tuple<Args...> args{CaptureValue<Args>::read(in)...};
+            if (!in.ok()) {
+                return false;
+            }
+            if constexpr (std::is_same_v<Result, char *>) {
+                std::free(std::apply(func, args));
+            } else {
+                std::apply(func, args);
+            }
+            return true;
+        }
+    }
+};
+
+#define MDKLOADER_GENERATE_REPLAY_MDKAPI(funcName, ...) \
+    &ReplayFunction<decltype(&::funcName), &::funcName>::call,
+
+constexpr ReplayMDKAPI replayMDKAPIs[MDKAPI_Count] = {
+    MDKLOADER_FOREACH_MDKAPI(MDKLOADER_GENERATE_REPLAY_MDKAPI)};
+
+using ReplayPlayerAPI = bool (*)(CaptureReader &in, const mdkPlayerAPI *player);
+
+template<typename Member, Member member>
+struct ReplayMember;
+
+template<typename Result, typename... Args, Result (*mdkPlayerAPI::*member)(mdkPlayer *, Args...)>
+struct ReplayMember<Result (*mdkPlayerAPI::*)(mdkPlayer *, Args...), member>
+{
+    static bool call(CaptureReader &in, const mdkPlayerAPI *player)
+    {
+        if constexpr (!isReplayable<Args...>) {
+            (void) in;
+            (void) player;
+            return false;
+        } else {
+            const auto func = player->*member;
+            if (!func) {
+                return false;
+            }
+            const std::tuple<Args...> args{CaptureValue<Args>::read(in)...};
+            if (!in.ok()) {
+                return false;
+            }
+            std::apply([player, func](Args... values) { func(player->object, values...); }, args);
+            return true;
+        }
+    }
+};
+
+#define MDKLOADER_GENERATE_REPLAY_PLAYERAPI(member) \
+    &ReplayMember<decltype(&mdkPlayerAPI::member), &mdkPlayerAPI::member>::call,
+
+constexpr ReplayPlayerAPI replayPlayerAPIs[PlayerAPI_Count] = {
+    MDKLOADER_FOREACH_PLAYERAPI(MDKLOADER_GENERATE_REPLAY_PLAYERAPI)};
+
+// Returns false if the call was skipped.
+bool replayRecord(ReplayContext &context, const CaptureRecord &record)
+{
+    CaptureReader in(record, &context);
+    switch (record.op) {
+    case MDKAPI_mdkPlayerAPI_new:
+        return context.player(record.object) != nullptr;
+    case MDKAPI_mdkPlayerAPI_delete:
+        return context.deletePlayer(record.object);
+    case MDKAPI_mdkVideoFrameAPI_new: {
+        const auto width = in.get<int>();
+        const auto height = in.get<int>();
+        const auto format = in.get<MDK_PixelFormat>();
+        return in.ok() && context.newFrame(record.object, width, height, format);
+    }
+    case MDKAPI_mdkVideoFrameAPI_delete:
+        return context.deleteFrame(record.object);
+    default:
+        break;
+    }
+    if (record.op < MDKAPI_Count) {
+        return replayMDKAPIs[record.op](in);
+    }
+    if ((record.op >= playerOpBase) && (record.op < (playerOpBase + PlayerAPI_Count))) {
+        const mdkPlayerAPI *const player = context.player(record.object);
+        return player && replayPlayerAPIs[record.op - playerOpBase](in, player);
+    }
+    return false;
+}
+
+} // namespace
+
+// A private generation which is never published, the context functions call
+// through its slots directly.
+struct mdkloaderContext
+{
+    std::unique_ptr<MDKAPITable> table;
+};
+
+bool mdkloader_load(const char *value)
+{
+    return mdkloader_load_ex(value, nullptr, nullptr);
+}
+
+bool mdkloader_load_ex(const char *value,
+                       const mdkloaderLoadOptions *options,
+                       mdkloaderLoadTimings *timings)
+{
+    assert(value);
+    if (timings) {
+        *timings = {};
+    }
+    // Fast path: someone has already loaded the library.
+    if (const MDKAPITable *table = mdkTable.load(std::memory_order_acquire)) {
+        return alreadyLoaded(table);
+    }
+    std::lock_guard<std::mutex> locker(mdkLoadMutex);
+    // The load may have completed while we were waiting for the lock.
+    if (const MDKAPITable *table = mdkTable.load(std::memory_order_acquire)) {
+        return alreadyLoaded(table);
+    }
+    mdkLoadStatus.store(MDKLoader_LoadStatus_Loading, std::memory_order_relaxed);
+    std::unique_ptr<MDKAPITable> table = createTable(value, options, lastLoadReport);
+    if (timings) {
+        *timings = lastLoadReport.timings;
+    }
+    if (!table) {
+        mdkLoadStatus.store(MDKLoader_LoadStatus_Failed, std::memory_order_release);
+        return false;
+    }
+    const bool ret = table->resolved;
+    // Replaces the library unloaded for being idle, if any.
+    idleUnloaded.store(false, std::memory_order_relaxed);
+    // Publish the fully initialized table. Pairs with the acquire loads above
+    // and in the forwarding wrappers.
+    mdkTable.store(table.release(), std::memory_order_seq_cst);
+    mdkLoadStatus.store(ret ? MDKLoader_LoadStatus_Loaded : MDKLoader_LoadStatus_Failed,
+                        std::memory_order_release);
+    return ret;
+}
+
+bool mdkloader_reload(const char *value)
+{
+    assert(value);
+    // Waiting for the readers would dead lock on our own read guard.
+    assert(!ReadGuard::isActive());
+    std::lock_guard<std::mutex> locker(mdkLoadMutex);
+    const MDKAPITable *const old = mdkTable.load(std::memory_order_acquire);
+    mdkloaderLoadOptions options = {};
+    if (old) {
+        options.binding = old->binding;
+        options.openFlags = old->openFlags;
+        options.hugePageText = old->hugePageText;
+    }
+    std::unique_ptr<MDKAPITable> table = createTable(value, &options, lastLoadReport);
+    if (!table || !table->resolved) {
+        // Keep serving the current generation.
+        if (table) {
+            closeLibrary(table->library);
+        }
+        return false;
+    }
+    if (old) {
+        // Retire before unpublishing, mdkPlayerAPI_delete() must always be
+        // able to find the owner of a Player.
+        std::lock_guard<std::mutex> generationLocker(generationMutex);
+        old->retired = true;
+        retiredTables.push_back(old);
+    }
+    idleUnloaded.store(false, std::memory_order_relaxed);
+    mdkTable.store(table.release(), std::memory_order_seq_cst);
+    mdkLoadStatus.store(MDKLoader_LoadStatus_Loaded, std::memory_order_release);
+    if (old) {
+        retireTable(old);
+    }
+    return true;
+}
+
+bool mdkloader_isLoaded()
+{
+    const MDKAPITable *const table = mdkTable.load(std::memory_order_acquire);
+    return (table && table->resolved);
+}
+
+void mdkloader_loadAsync(const char *value,
+                         const mdkloaderLoadOptions *options,
+                         mdkloaderLoadCallback cb)
+{
+    assert(value);
+    mdkloaderLoadOptions asyncOptions = {};
+    if (options) {
+        asyncOptions = *options;
+    }
+    asyncOptions.prefetch = true;
+    // Report Loading right away, pollers must not see NotLoaded after this returns.
+    if (!mdkTable.load(std::memory_order_acquire)) {
+        mdkLoadStatus.store(MDKLoader_LoadStatus_Loading, std::memory_order_relaxed);
+    }
+    asyncLoads.add(std::thread([path = std::string(value), asyncOptions, cb]() {
+        const bool loaded = mdkloader_load_ex(path.c_str(), &asyncOptions, nullptr);
+        if (cb.cb) {
+            cb.cb(loaded, cb.opaque);
+        }
+    }));
+}
+
+int mdkloader_preloadFFmpeg(const char *const *paths, int64_t *loadTimes)
+{
+    assert(paths);
+    MDK_HANDLE libraries[MDKLoader_FFmpegLibrary_Count] = {};
+    int64_t times[MDKLoader_FFmpegLibrary_Count] = {};
+    std::atomic_int next = {0};
+    const auto worker = [paths, &libraries, &times, &next]() {
+        for (int i = next++; i < MDKLoader_FFmpegLibrary_Count; i = next++) {
+            if (!paths[i]) {
+                continue;
+            }
+            const TraceScope preloadScope("mdkloader preload FFmpeg");
+            const auto start = std::chrono::steady_clock::now();
+#ifdef MDK_LINUX
+            prefetchLibrary(paths[i]);
+#endif
+            libraries[i] = openLibrary(paths[i], MDKLoader_BindingMode_Default);
+            times[i] = libraries[i] ? elapsedMicroseconds(start) : -1;
+        }
+    };
+    // The dynamic linker serializes the mapping and relocation work of
+    // concurrent dlopen() calls, what runs in parallel is mostly the disk I/O.
+    const unsigned threadCount = std::min<unsigned>(std::max(std::thread::hardware_concurrency(), 1u),
+                                                    MDKLoader_FFmpegLibrary_Count);
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &&thread : threads) {
+        thread.join();
+    }
+    int loaded = 0;
+    std::lock_guard<std::mutex> locker(mdkLoadMutex);
+    for (int i = 0; i != MDKLoader_FFmpegLibrary_Count; ++i) {
+        if (loadTimes) {
+            loadTimes[i] = times[i];
+        }
+        if (!libraries[i]) {
+            if (paths[i]) {
+                logMessage(MDKLoader_LogLevel_Warning, "Failed to preload %s", paths[i]);
+            }
+            continue;
+        }
+        ++loaded;
+        if (ffmpegLibraries[i]) {
+            closeLibrary(ffmpegLibraries[i]);
+        }
+        ffmpegLibraries[i] = libraries[i];
+        ffmpegPaths[i] = paths[i];
+    }
+    applyFFmpegOptions(mdkTable.load(std::memory_order_acquire));
+    return loaded;
+}
 
-#include "mdkloader.h"
-#include "mdk/c/MediaInfo.h"
-#include "mdk/c/Player.h"
-#include "mdk/c/VideoFrame.h"
-#include "mdk/c/global.h"
-#include <cassert>
-#include <iostream>
-#ifdef MDK_WINDOWS
-#include <windows.h>
-#else
-#include <dlfcn.h>
+bool mdkloader_findLibrary(const mdkloaderDiscoveryOptions *options, char *path, size_t size)
+{
+    assert(path && (size > 0));
+    const std::string found = discoverLibrary(options);
+    if (found.empty() || (found.size() >= size)) {
+        path[0] = '\0';
+        return false;
+    }
+    std::memcpy(path, found.c_str(), found.size() + 1);
+    return true;
+}
+
+bool mdkloader_loadDiscovered(const mdkloaderDiscoveryOptions *discovery,
+                              const mdkloaderLoadOptions *options,
+                              mdkloaderLoadTimings *timings)
+{
+    // Already loaded, don't touch the disk at all.
+    if (const MDKAPITable *table = mdkTable.load(std::memory_order_acquire)) {
+        if (timings) {
+            *timings = {};
+        }
+        return table->resolved;
+    }
+    const std::string path = discoverLibrary(discovery);
+    if (path.empty()) {
+        logMessage(MDKLoader_LogLevel_Error, "Failed to find the MDK library.");
+        mdkLoadStatus.store(MDKLoader_LoadStatus_Failed, std::memory_order_release);
+        return false;
+    }
+    return mdkloader_load_ex(path.c_str(), options, timings);
+}
+
+MDKLoader_LoadStatus mdkloader_loadStatus()
+{
+    return mdkLoadStatus.load(std::memory_order_acquire);
+}
+
+void mdkloader_setIdleUnload(int64_t timeout)
+{
+    {
+        std::lock_guard<std::mutex> locker(idleMutex);
+        idleTimeout = std::max<int64_t>(timeout, 0);
+        if ((idleTimeout > 0) && !idleWatcher.thread.joinable()) {
+            idleWatcher.start();
+            return;
+        }
+        if (idleTimeout > 0) {
+            // The running watcher picks the new period up on its next tick.
+            idleCondition.notify_all();
+            return;
+        }
+    }
+    idleWatcher.stop();
+}
+
+bool mdkloader_prefork(const char *value, const mdkloaderPreforkOptions *options)
+{
+    assert(value);
+    // Children must find every slot bound, lazy binding would dlsym() in each of them.
+    mdkloaderLoadOptions loadOptions = {};
+    loadOptions.binding = MDKLoader_BindingMode_Eager;
+    if (!mdkloader_load_ex(value, &loadOptions, nullptr)) {
+        return false;
+    }
+    mdkloader_api();
+    // MDK sets up its global state on first use, do it once for all children.
+    if (options && options->logHandler.cb) {
+        MDK_setLogHandler(options->logHandler);
+    }
+    if (options && options->globalOptions) {
+        for (const char *const *option = options->globalOptions; option[0] && option[1]; option += 2) {
+            MDK_setGlobalOptionString(option[0], option[1]);
+        }
+    }
+    MDK_version();
+#ifdef MDK_UNIX
+    static std::once_flag atforkRegistered;
+    std::call_once(atforkRegistered, [] {
+        pthread_atfork(preforkPrepare, preforkParent, preforkChild);
+    });
 #endif
+    return true;
+}
 
-namespace {
+const mdkloaderAPI *mdkloader_api()
+{
+    if (!mdkTable.load(std::memory_order_acquire) && idleUnloaded.load(std::memory_order_acquire)) {
+        reloadAfterIdle();
+    }
+    // tryIdleUnload() checks pinned with the load lock held, so the table
+    // can't be unloaded between reading and pinning it.
+    std::lock_guard<std::mutex> locker(mdkLoadMutex);
+    const MDKAPITable *const table = mdkTable.load(std::memory_order_acquire);
+    if (!table) {
+        return nullptr;
+    }
+    // Calls through the returned table can't be tracked, never unload it.
+    table->pinned.store(true, std::memory_order_relaxed);
+    if (!table->apiReady.load(std::memory_order_relaxed)) {
+        // Tables are only handed out as const, but none is created const.
+        fillDirectTable(const_cast<MDKAPITable *>(table));
+    }
+    return &table->api;
+}
 
-#ifndef MDK_HANDLE
-#ifdef MDK_WINDOWS
-#define MDK_HANDLE HMODULE
+mdkloaderContext *mdkloader_context_create(const char *value)
+{
+    assert(value);
+    // Lazy binding is not available, the trampolines patch the global table.
+    mdkloaderLoadOptions options = {};
+    options.binding = MDKLoader_BindingMode_Default;
+    std::unique_ptr<MDKAPITable> table;
+    {
+        // Also protects the FFmpeg paths applied to the new library.
+        std::lock_guard<std::mutex> locker(mdkLoadMutex);
+        table = createTable(value, &options, lastLoadReport, true);
+    }
+    if (!table) {
+        return nullptr;
+    }
+    if (!table->resolved) {
+        closeLibrary(table->library);
+        return nullptr;
+    }
+    auto context = new mdkloaderContext;
+    context->table = std::move(table);
+    return context;
+}
+
+void mdkloader_context_destroy(mdkloaderContext *context)
+{
+    if (!context) {
+        return;
+    }
+    closeLibrary(context->table->library);
+    delete context;
+}
+
+const mdkloaderAPI *mdkloader_context_api(const mdkloaderContext *context)
+{
+    assert(context);
+    return &context->table->api;
+}
+
+int mdkloader_context_version(const mdkloaderContext *context)
+{
+    assert(context);
+    return context->table->api.MDK_version();
+}
+
+const mdkPlayerAPI *mdkloader_context_newPlayer(const mdkloaderContext *context)
+{
+    assert(context);
+    return context->table->api.mdkPlayerAPI_new();
+}
+
+void mdkloader_context_deletePlayer(const mdkloaderContext *context, const mdkPlayerAPI **value)
+{
+    assert(context);
+    context->table->api.mdkPlayerAPI_delete(value);
+}
+
+mdkVideoFrameAPI *mdkloader_context_newVideoFrame(const mdkloaderContext *context,
+                                                  int w,
+                                                  int h,
+                                                  enum MDK_PixelFormat f)
+{
+    assert(context);
+    return context->table->api.mdkVideoFrameAPI_new(w, h, f);
+}
+
+void mdkloader_context_deleteVideoFrame(const mdkloaderContext *context, mdkVideoFrameAPI **value)
+{
+    assert(context);
+    context->table->api.mdkVideoFrameAPI_delete(value);
+}
+
+void mdkloader_context_audioStreamCodecParameters(const mdkloaderContext *context,
+                                                  const mdkAudioStreamInfo *asi,
+                                                  mdkAudioCodecParameters *acp)
+{
+    assert(context);
+    context->table->api.MDK_AudioStreamCodecParameters(asi, acp);
+}
+
+bool mdkloader_context_audioStreamMetadata(const mdkloaderContext *context,
+                                           const mdkAudioStreamInfo *asi,
+                                           mdkStringMapEntry *sme)
+{
+    assert(context);
+    return context->table->api.MDK_AudioStreamMetadata(asi, sme);
+}
+
+void mdkloader_context_videoStreamCodecParameters(const mdkloaderContext *context,
+                                                  const mdkVideoStreamInfo *vsi,
+                                                  mdkVideoCodecParameters *vcp)
+{
+    assert(context);
+    context->table->api.MDK_VideoStreamCodecParameters(vsi, vcp);
+}
+
+bool mdkloader_context_videoStreamMetadata(const mdkloaderContext *context,
+                                           const mdkVideoStreamInfo *vsi,
+                                           mdkStringMapEntry *sme)
+{
+    assert(context);
+    return context->table->api.MDK_VideoStreamMetadata(vsi, sme);
+}
+
+bool mdkloader_context_mediaMetadata(const mdkloaderContext *context,
+                                     const mdkMediaInfo *mi,
+                                     mdkStringMapEntry *sme)
+{
+    assert(context);
+    return context->table->api.MDK_MediaMetadata(mi, sme);
+}
+
+int mdkloader_callStats(mdkloaderCallStats *stats, int count)
+{
+#ifdef MDKLOADER_ENABLE_STATS
+    if (!stats) {
+        return MDKAPI_Count;
+    }
+    count = std::min<int>(count, MDKAPI_Count);
+    for (int i = 0; i < count; ++i) {
+        stats[i] = {};
+        stats[i].name = mdkapiNames[i];
+    }
+    for (const ThreadCallStats *thread = threadCallStatsList.load(std::memory_order_acquire); thread;
+         thread = thread->next) {
+        for (int i = 0; i < count; ++i) {
+            const ThreadCallStats::Counters &counters = thread->counters[i];
+            stats[i].calls += counters.calls.load(std::memory_order_relaxed);
+            stats[i].totalTime += counters.totalTime.load(std::memory_order_relaxed);
+            for (int bucket = 0; bucket != MDKLOADER_STATS_BUCKETS; ++bucket) {
+                stats[i].histogram[bucket] += counters.histogram[bucket].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    return MDKAPI_Count;
 #else
-#define MDK_HANDLE void *
-#endif
+    (void) stats;
+    (void) count;
+    return 0;
 #endif
+}
 
-#ifndef MDKLOADER_GETPROCADDRESS
-#ifdef MDK_WINDOWS
-#define MDKLOADER_GETPROCADDRESS GetProcAddress
+bool mdkloader_dumpCallStats(const char *fileName)
+{
+    mdkloaderCallStats stats[MDKAPI_Count];
+    if (mdkloader_callStats(stats, MDKAPI_Count) == 0) {
+        return false;
+    }
+    FILE *file = fileName ? std::fopen(fileName, "w") : stderr;
+    if (!file) {
+        return false;
+    }
+    // Quantiles are reported as the upper bound of the bucket they fall in.
+    const auto quantile = [](const mdkloaderCallStats &api, const double q) -> uint64_t {
+        const auto rank = static_cast<uint64_t>(q * static_cast<double>(api.calls - 1));
+        uint64_t seen = 0;
+        for (int bucket = 0; bucket != MDKLOADER_STATS_BUCKETS; ++bucket) {
+            seen += api.histogram[bucket];
+            if (seen > rank) {
+                return uint64_t(2) << bucket;
+            }
+        }
+        return UINT64_MAX;
+    };
+    std::fprintf(file, "%-34s %12s %14s %10s %10s %10s\n", "api", "calls", "total(ns)", "mean(ns)",
+                 "p50(ns)", "p99(ns)");
+    for (const mdkloaderCallStats &api : stats) {
+        if (api.calls == 0) {
+            continue;
+        }
+        std::fprintf(file, "%-34s %12llu %14llu %10llu %10llu %10llu\n", api.name,
+                     static_cast<unsigned long long>(api.calls),
+                     static_cast<unsigned long long>(api.totalTime),
+                     static_cast<unsigned long long>(api.totalTime / api.calls),
+                     static_cast<unsigned long long>(quantile(api, 0.5)),
+                     static_cast<unsigned long long>(quantile(api, 0.99)));
+    }
+    if (file == stderr) {
+        std::fflush(file);
+        return true;
+    }
+    return (std::fclose(file) == 0);
+}
+
+bool mdkloader_loadReport(mdkloaderLoadReport *report)
+{
+    assert(report);
+    std::lock_guard<std::mutex> locker(mdkLoadMutex);
+    *report = lastLoadReport;
+    // createTable() always fills in a path.
+    return (report->path[0] != '\0');
+}
+
+int mdkloader_memoryUsage(mdkloaderLibraryMemory *libraries, int count)
+{
+#ifdef MDK_LINUX
+    std::vector<std::string> paths;
+    {
+        std::lock_guard<std::mutex> locker(mdkLoadMutex);
+        const MDKAPITable *const table = mdkTable.load(std::memory_order_acquire);
+        if (!table) {
+            return 0;
+        }
+        paths = table->libraries;
+        for (int i = 0; i != MDKLoader_FFmpegLibrary_Count; ++i) {
+            if (!ffmpegLibraries[i]) {
+                continue;
+            }
+            char path[sizeof(mdkloaderLibraryMemory::path)];
+            libraryPath(ffmpegLibraries[i], ffmpegPaths[i].c_str(), path, sizeof(path));
+            std::string file = canonicalPath(path);
+            if (std::find(paths.cbegin(), paths.cend(), file) == paths.cend()) {
+                paths.push_back(std::move(file));
+            }
+        }
+    }
+    if (libraries) {
+        const std::vector<mdkloaderMemoryUsage> usage = libraryMemory(paths);
+        for (int i = 0; i < std::min(count, static_cast<int>(paths.size())); ++i) {
+            copyString(libraries[i].path, sizeof(libraries[i].path), paths[i].c_str());
+            libraries[i].rss = usage[i];
+        }
+    }
+    return static_cast<int>(paths.size());
 #else
-#define MDKLOADER_GETPROCADDRESS dlsym
-#endif
+    (void) libraries;
+    (void) count;
+    return 0;
 #endif
+}
 
-#ifndef MDKLOADER_GENERATE_MDKAPI
-#define MDKLOADER_GENERATE_MDKAPI(funcName, resultType, ...) \
-    using _MDKLOADER_MDKAPI_##funcName = resultType (*)(__VA_ARGS__); \
-    _MDKLOADER_MDKAPI_##funcName m_lp##funcName = nullptr;
-#endif
+const char *mdkloader_symbolName(int index)
+{
+    return ((index >= 0) && (index < MDKAPI_Count)) ? mdkapiNames[index] : nullptr;
+}
 
-#ifndef MDKLOADER_RESOLVE_ERROR
-#ifdef _DEBUG
-#define MDKLOADER_RESOLVE_ERROR(funcName) assert(m_lp##funcName);
-#else
-#define MDKLOADER_RESOLVE_ERROR(funcName) \
-    if (!m_lp##funcName) { \
-        std::cerr << "MDKLoader: Failed to resolve symbol" << #funcName << std::endl; \
+void mdkloader_setLogSink(mdkloaderLogSink sink)
+{
+    std::lock_guard<std::mutex> locker(logSinkMutex);
+    logSink = sink;
+}
+
+bool mdkloader_traceStart(size_t eventsPerThread)
+{
+#ifdef MDKLOADER_ENABLE_TRACE
+    size_t capacity = 1;
+    while (capacity < (eventsPerThread ? eventsPerThread : 65536)) {
+        capacity <<= 1;
     }
+    traceRingCapacity.store(capacity, std::memory_order_relaxed);
+    traceEnabled.store(true, std::memory_order_release);
+    return true;
+#else
+    (void) eventsPerThread;
+    return false;
 #endif
+}
+
+void mdkloader_traceStop()
+{
+#ifdef MDKLOADER_ENABLE_TRACE
+    traceEnabled.store(false, std::memory_order_relaxed);
 #endif
+}
 
-#ifndef MDKLOADER_RESOLVE_MDKAPI
-#define MDKLOADER_RESOLVE_MDKAPI(funcName) \
-    if (!m_lp##funcName) { \
-        m_lp##funcName = reinterpret_cast<_MDKLOADER_MDKAPI_##funcName>( \
-            MDKLOADER_GETPROCADDRESS(mdkLib, #funcName)); \
-        MDKLOADER_RESOLVE_ERROR(funcName) \
+void mdkloader_traceBegin(const char *name)
+{
+#ifdef MDKLOADER_ENABLE_TRACE
+    if (traceEnabled.load(std::memory_order_relaxed)) {
+        recordTraceEvent(name, 'B');
     }
+#else
+    (void) name;
 #endif
+}
 
-#ifndef MDKLOADER_EXECUTE_MDKAPI
-#define MDKLOADER_EXECUTE_MDKAPI(funcName, ...) \
-    if (m_lp##funcName) { \
-        m_lp##funcName(__VA_ARGS__); \
+void mdkloader_traceEnd(const char *name)
+{
+#ifdef MDKLOADER_ENABLE_TRACE
+    if (traceEnabled.load(std::memory_order_relaxed)) {
+        recordTraceEvent(name, 'E');
     }
+#else
+    (void) name;
 #endif
+}
 
-#ifndef MDKLOADER_EXECUTE_MDKAPI_RETURN
-#define MDKLOADER_EXECUTE_MDKAPI_RETURN(funcName, defVal, ...) \
-    return m_lp##funcName ? m_lp##funcName(__VA_ARGS__) : defVal;
+bool mdkloader_traceFlush(const char *fileName)
+{
+#ifdef MDKLOADER_ENABLE_TRACE
+    assert(fileName);
+    std::lock_guard<std::mutex> locker(traceFlushMutex);
+    FILE *file = std::fopen(fileName, "w");
+    if (!file) {
+        return false;
+    }
+#ifdef MDK_WINDOWS
+    const unsigned long pid = GetCurrentProcessId();
+#else
+    const unsigned long pid = static_cast<unsigned long>(getpid());
 #endif
+    std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
+    bool first = true;
+    uint64_t dropped = 0;
+    for (TraceRing *ring = traceRings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        const uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        for (uint64_t i = tail; i != head; ++i) {
+            const TraceEvent &event = ring->events[i & ring->mask];
+            std::fprintf(file, "%s\n{\"name\":\"", first ? "" : ",");
+            for (const char *c = event.name; *c; ++c) {
+                if ((*c == '"') || (*c == '\\')) {
+                    std::fputc('\\', file);
+                }
+                std::fputc(*c, file);
+            }
+            std::fprintf(file, "\",\"cat\":\"mdk\",\"ph\":\"%c\",\"ts\":%lld.%03lld,\"pid\":%lu,\"tid\":%lu}",
+                         event.phase, static_cast<long long>(event.time / 1000),
+                         static_cast<long long>(event.time % 1000), pid,
+                         static_cast<unsigned long>(event.thread));
+            first = false;
+        }
+        ring->tail.store(head, std::memory_order_release);
+        dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+    }
+    std::fprintf(file, "\n],\"otherData\":{\"droppedEvents\":\"%llu\"}}\n",
+                 static_cast<unsigned long long>(dropped));
+    return (std::fclose(file) == 0);
+#else
+    (void) fileName;
+    return false;
+#endif
+}
 
-MDK_HANDLE mdkLib = nullptr;
-
-// global.h
-MDKLOADER_GENERATE_MDKAPI(MDK_javaVM, void *, void *)
-MDKLOADER_GENERATE_MDKAPI(MDK_setLogLevel, void, MDK_LogLevel)
-MDKLOADER_GENERATE_MDKAPI(MDK_logLevel, MDK_LogLevel)
-MDKLOADER_GENERATE_MDKAPI(MDK_setLogHandler, void, mdkLogHandler)
-MDKLOADER_GENERATE_MDKAPI(MDK_setGlobalOptionString, void, const char *, const char *)
-MDKLOADER_GENERATE_MDKAPI(MDK_setGlobalOptionInt32, void, const char *, int)
-MDKLOADER_GENERATE_MDKAPI(MDK_setGlobalOptionPtr, void, const char *, void *)
-MDKLOADER_GENERATE_MDKAPI(MDK_strdup, char *, const char *)
-MDKLOADER_GENERATE_MDKAPI(MDK_version, int)
-// MediaInfo.h
-MDKLOADER_GENERATE_MDKAPI(MDK_AudioStreamCodecParameters,
-                          void,
-                          const mdkAudioStreamInfo *,
-                          mdkAudioCodecParameters *)
-MDKLOADER_GENERATE_MDKAPI(MDK_AudioStreamMetadata,
-                          bool,
-                          const mdkAudioStreamInfo *,
-                          mdkStringMapEntry *)
-MDKLOADER_GENERATE_MDKAPI(MDK_VideoStreamCodecParameters,
-                          void,
-                          const mdkVideoStreamInfo *,
-                          mdkVideoCodecParameters *)
-MDKLOADER_GENERATE_MDKAPI(MDK_VideoStreamMetadata,
-                          bool,
-                          const mdkVideoStreamInfo *,
-                          mdkStringMapEntry *)
-MDKLOADER_GENERATE_MDKAPI(MDK_MediaMetadata, bool, const mdkMediaInfo *, mdkStringMapEntry *)
-// Player.h
-MDKLOADER_GENERATE_MDKAPI(mdkPlayerAPI_new, const mdkPlayerAPI *)
-MDKLOADER_GENERATE_MDKAPI(mdkPlayerAPI_delete, void, const struct mdkPlayerAPI **)
-MDKLOADER_GENERATE_MDKAPI(MDK_foreignGLContextDestroyed, void)
-// VideoFrame.h
-MDKLOADER_GENERATE_MDKAPI(mdkVideoFrameAPI_new, mdkVideoFrameAPI *, int, int, enum MDK_PixelFormat)
-MDKLOADER_GENERATE_MDKAPI(mdkVideoFrameAPI_delete, void, struct mdkVideoFrameAPI **)
-
-} // namespace
-
-bool mdkloader_load(const char *value)
+bool mdkloader_captureStart(size_t bytesPerThread)
 {
-    assert(value);
-#ifdef MDK_WINDOWS
-    mdkLib = LoadLibraryA(value);
+#ifdef MDKLOADER_ENABLE_CAPTURE
+    captureBufferCapacity.store(bytesPerThread ? bytesPerThread : (16 << 20),
+                                std::memory_order_relaxed);
+    captureEnabled.store(true, std::memory_order_release);
+    return true;
 #else
-    mdkLib = dlopen(value, RTLD_LAZY);
+    (void) bytesPerThread;
+    return false;
 #endif
-    if (!mdkLib) {
-        std::cerr << "MDKLoader: Failed to load the MDK library:" << value << std::endl;
+}
+
+void mdkloader_captureStop()
+{
+#ifdef MDKLOADER_ENABLE_CAPTURE
+    captureEnabled.store(false, std::memory_order_relaxed);
+#endif
+}
+
+bool mdkloader_captureFlush(const char *fileName)
+{
+#ifdef MDKLOADER_ENABLE_CAPTURE
+    assert(fileName);
+    std::lock_guard<std::mutex> locker(captureFlushMutex);
+    FILE *file = std::fopen(fileName, "wb");
+    if (!file) {
         return false;
     }
-    std::cout << "MDKLoader: The MDK library has been loaded successfully." << std::endl;
-    // global.h
-    MDKLOADER_RESOLVE_MDKAPI(MDK_javaVM)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_setLogLevel)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_logLevel)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_setLogHandler)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_setGlobalOptionString)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_setGlobalOptionInt32)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_setGlobalOptionPtr)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_strdup)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_version)
-    // MediaInfo.h
-    MDKLOADER_RESOLVE_MDKAPI(MDK_AudioStreamCodecParameters)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_AudioStreamMetadata)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_VideoStreamCodecParameters)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_VideoStreamMetadata)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_MediaMetadata)
-    // Player.h
-    MDKLOADER_RESOLVE_MDKAPI(mdkPlayerAPI_new)
-    MDKLOADER_RESOLVE_MDKAPI(mdkPlayerAPI_delete)
-    MDKLOADER_RESOLVE_MDKAPI(MDK_foreignGLContextDestroyed)
-    // VideoFrame.h
-    MDKLOADER_RESOLVE_MDKAPI(mdkVideoFrameAPI_new)
-    MDKLOADER_RESOLVE_MDKAPI(mdkVideoFrameAPI_delete)
-    const bool ret = mdkloader_isLoaded();
-    if (ret) {
-        std::cout << "MDKLoader: All MDK symbols have been resolved successfully." << std::endl;
-    } else {
-        std::cerr << "MDKLoader: Failed to resolve some MDK symbols." << std::endl;
+    std::vector<std::vector<unsigned char>> chunks;
+    uint64_t dropped = 0;
+    for (CaptureBuffer *buffer = captureBuffers.load(std::memory_order_acquire); buffer;
+         buffer = buffer->next) {
+        std::lock_guard<std::mutex> bufferLocker(buffer->mutex);
+        chunks.push_back(std::move(buffer->data));
+        buffer->data.clear();
+        dropped += buffer->dropped;
+        buffer->dropped = 0;
     }
-    return ret;
+    // Each buffer is in order already, the threads are interleaved by time.
+    std::vector<CaptureRecord> records;
+    for (const std::vector<unsigned char> &chunk : chunks) {
+        size_t offset = 0;
+        CaptureRecord record;
+        while (readCaptureRecord(chunk.data(), chunk.size(), offset, record)) {
+            records.push_back(record);
+        }
+    }
+    std::stable_sort(records.begin(),
+                     records.end(),
+                     [](const CaptureRecord &a, const CaptureRecord &b) { return a.time < b.time; });
+    std::fwrite(captureMagic, sizeof(captureMagic), 1, file);
+    std::fwrite(&dropped, sizeof(dropped), 1, file);
+    for (const CaptureRecord &record : records) {
+        std::fwrite(record.payload - captureRecordHeaderSize,
+                    captureRecordHeaderSize + record.size,
+                    1,
+                    file);
+    }
+    return (std::fclose(file) == 0);
+#else
+    (void) fileName;
+    return false;
+#endif
 }
 
-bool mdkloader_isLoaded()
+bool mdkloader_replay(const char *fileName,
+                      const mdkloaderReplayOptions *options,
+                      mdkloaderReplayResult *result)
 {
-    if (!mdkLib) {
+    assert(fileName);
+    std::vector<unsigned char> data;
+    if (FILE *file = std::fopen(fileName, "rb")) {
+        unsigned char chunk[65536];
+        size_t size = 0;
+        while ((size = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            data.insert(data.end(), chunk, chunk + size);
+        }
+        std::fclose(file);
+    } else {
+        logMessage(MDKLoader_LogLevel_Warning, "Failed to open capture %s", fileName);
+        return false;
+    }
+    uint64_t dropped = 0;
+    if ((data.size() < (sizeof(captureMagic) + sizeof(dropped)))
+        || std::memcmp(data.data(), captureMagic, sizeof(captureMagic))) {
+        logMessage(MDKLoader_LogLevel_Warning, "%s is not a capture", fileName);
+        return false;
+    }
+    std::memcpy(&dropped, data.data() + sizeof(captureMagic), sizeof(dropped));
+    std::vector<CaptureRecord> records;
+    size_t offset = sizeof(captureMagic) + sizeof(dropped);
+    CaptureRecord record;
+    while (readCaptureRecord(data.data(), data.size(), offset, record)) {
+        records.push_back(record);
+    }
+    if (offset != data.size()) {
+        logMessage(MDKLoader_LogLevel_Warning, "Capture %s is truncated", fileName);
         return false;
     }
-    const bool globalLoaded = (m_lpMDK_javaVM && m_lpMDK_setLogLevel && m_lpMDK_logLevel
-                               && m_lpMDK_setLogHandler && m_lpMDK_setGlobalOptionString
-                               && m_lpMDK_setGlobalOptionInt32 && m_lpMDK_setGlobalOptionPtr
-                               && m_lpMDK_strdup && m_lpMDK_version);
-    const bool mediaInfoLoaded = (m_lpMDK_AudioStreamCodecParameters && m_lpMDK_AudioStreamMetadata
-                                  && m_lpMDK_VideoStreamCodecParameters
-                                  && m_lpMDK_VideoStreamMetadata && m_lpMDK_MediaMetadata);
-    const bool playerLoaded = (m_lpmdkPlayerAPI_new && m_lpmdkPlayerAPI_delete
-                               && m_lpMDK_foreignGLContextDestroyed);
-    const bool videoFrameLoaded = (m_lpmdkVideoFrameAPI_new && m_lpmdkVideoFrameAPI_delete);
-    return (globalLoaded && mediaInfoLoaded && playerLoaded && videoFrameLoaded);
+    // By thread, for replaying with the original timing.
+    std::map<uint16_t, std::vector<const CaptureRecord *>> threads;
+    for (const CaptureRecord &record : records) {
+        threads[record.thread].push_back(&record);
+    }
+
+    std::atomic<uint64_t> calls = {0};
+    std::atomic<uint64_t> skipped = {0};
+    std::atomic<int64_t> maxLateness = {0};
+    const auto start = std::chrono::steady_clock::now();
+    {
+        ReplayContext context;
+        if (!options || !options->originalTiming) {
+            for (const CaptureRecord &record : records) {
+                ++(replayRecord(context, record) ? calls : skipped);
+            }
+        } else {
+            const int64_t firstTime = records.empty() ? 0 : records.front().time;
+            std::vector<std::thread> replayers;
+            for (const auto &thread : threads) {
+                replayers.emplace_back([&, &recorded = thread.second] {
+                    int64_t lateness = 0;
+                    for (const CaptureRecord *record : recorded) {
+                        const std::chrono::steady_clock::time_point due
+                            = start
+                              + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  std::chrono::nanoseconds(record->time - firstTime));
+                        std::this_thread::sleep_until(due);
+                        lateness = std::max<int64_t>(lateness, elapsedMicroseconds(due));
+                        ++(replayRecord(context, *record) ? calls : skipped);
+                    }
+                    int64_t current = maxLateness.load(std::memory_order_relaxed);
+                    while ((current < lateness)
+                           && !maxLateness.compare_exchange_weak(current, lateness)) {
+                    }
+                });
+            }
+            for (std::thread &replayer : replayers) {
+                replayer.join();
+            }
+        }
+    }
+    if (result) {
+        result->calls = calls.load();
+        result->skipped = skipped.load();
+        result->dropped = dropped;
+        result->threads = static_cast<int>(threads.size());
+        result->duration = elapsedMicroseconds(start);
+        result->maxLateness = maxLateness.load();
+    }
+    return true;
 }
 
 int mdkloader_version()
 {
-    MDKLOADER_EXECUTE_MDKAPI_RETURN(MDK_version, MDK_VERSION)
+    MDKLOADER_EXECUTE_MDKAPI_RETURN(MDK_version, (mdkapiDefault<MDKAPI_MDK_version, int>))
 }
 
 void mdkloader_cleanup()
 {
-    if (mdkLib) {
-#ifdef MDK_WINDOWS
-        if (!FreeLibrary(mdkLib)) {
-            std::cerr << "MDKLoader: Failed to unload the MDK library." << std::endl;
-        }
-#else
-        dlclose(mdkLib);
-#endif
+    assert(!ReadGuard::isActive());
+    // Unload what they load, not the other way around.
+    asyncLoads.join();
+    std::lock_guard<std::mutex> locker(mdkLoadMutex);
+    const MDKAPITable *const table = mdkTable.load(std::memory_order_acquire);
+    if (table) {
+        std::lock_guard<std::mutex> generationLocker(generationMutex);
+        table->retired = true;
+        retiredTables.push_back(table);
+    }
+    mdkTable.store(nullptr, std::memory_order_seq_cst);
+    idleUnloaded.store(false, std::memory_order_relaxed);
+    idleReloadPath.clear();
+    mdkLoadStatus.store(MDKLoader_LoadStatus_NotLoaded, std::memory_order_release);
+    // Calls in flight finish on the old library. It is closed once they did,
+    // and once the Players it created are gone.
+    if (table) {
+        retireTable(table);
+    }
+    closeFFmpegLibraries();
+    for (std::string &path : ffmpegPaths) {
+        path.clear();
     }
 }
 
@@ -229,30 +3680,55 @@ void *MDK_javaVM(void *value)
     MDKLOADER_EXECUTE_MDKAPI_RETURN(MDK_javaVM, nullptr, value)
 }
 
-void MDK_setLogLevel(MDK_LogLevel value){MDKLOADER_EXECUTE_MDKAPI(MDK_setLogLevel, value)}
+void MDK_setLogLevel(MDK_LogLevel value)
+{
+    {
+        std::lock_guard<std::mutex> locker(globalStateMutex);
+        globalState.hasLogLevel = true;
+        globalState.logLevel = value;
+    }
+    MDKLOADER_EXECUTE_MDKAPI(MDK_setLogLevel, value)
+}
 
 MDK_LogLevel MDK_logLevel()
 {
-    MDKLOADER_EXECUTE_MDKAPI_RETURN(MDK_logLevel, MDK_LogLevel_Debug)
+    MDKLOADER_EXECUTE_MDKAPI_RETURN(MDK_logLevel, (mdkapiDefault<MDKAPI_MDK_logLevel, MDK_LogLevel>))
 }
 
 void MDK_setLogHandler(mdkLogHandler value)
 {
+    {
+        std::lock_guard<std::mutex> locker(globalStateMutex);
+        globalState.hasLogHandler = true;
+        globalState.logHandler = value;
+    }
     MDKLOADER_EXECUTE_MDKAPI(MDK_setLogHandler, value)
 }
 
 void MDK_setGlobalOptionString(const char *key, const char *value)
 {
+    if (key) {
+        std::lock_guard<std::mutex> locker(globalStateMutex);
+        recordGlobalOption(key, GlobalOption::String).string = value ? value : "";
+    }
     MDKLOADER_EXECUTE_MDKAPI(MDK_setGlobalOptionString, key, value)
 }
 
 void MDK_setGlobalOptionInt32(const char *key, int value)
 {
+    if (key) {
+        std::lock_guard<std::mutex> locker(globalStateMutex);
+        recordGlobalOption(key, GlobalOption::Int32).int32 = value;
+    }
     MDKLOADER_EXECUTE_MDKAPI(MDK_setGlobalOptionInt32, key, value)
 }
 
 void MDK_setGlobalOptionPtr(const char *key, void *value)
 {
+    if (key) {
+        std::lock_guard<std::mutex> locker(globalStateMutex);
+        recordGlobalOption(key, GlobalOption::Ptr).ptr = value;
+    }
     MDKLOADER_EXECUTE_MDKAPI(MDK_setGlobalOptionPtr, key, value)
 }
 
@@ -261,6 +3737,11 @@ char *MDK_strdup(const char *value)
     MDKLOADER_EXECUTE_MDKAPI_RETURN(MDK_strdup, nullptr, value)
 }
 
+int MDK_version()
+{
+    MDKLOADER_EXECUTE_MDKAPI_RETURN(MDK_version, (mdkapiDefault<MDKAPI_MDK_version, int>))
+}
+
 // MediaInfo.h
 
 void MDK_AudioStreamCodecParameters(const mdkAudioStreamInfo *asi, mdkAudioCodecParameters *acp)
@@ -292,12 +3773,87 @@ bool MDK_MediaMetadata(const mdkMediaInfo *mi, mdkStringMapEntry *sme)
 
 const mdkPlayerAPI *mdkPlayerAPI_new()
 {
-    MDKLOADER_EXECUTE_MDKAPI_RETURN(mdkPlayerAPI_new, nullptr)
+    MDKLOADER_COUNT_MDKAPI_CALL(mdkPlayerAPI_new)
+    MDKLOADER_TRACE_MDKAPI_CALL(mdkPlayerAPI_new)
+    MDKLOADER_PROBE_MDKAPI_CALL(mdkPlayerAPI_new)
+    const ReadGuard guard;
+    const MDKAPITable *const table = guard.table();
+    const auto func = table ? table->m_lpmdkPlayerAPI_new.load(std::memory_order_relaxed) : nullptr;
+#ifdef MDKLOADER_ENABLE_CAPTURE
+    const int64_t time = captureTime();
+#endif
+    const mdkPlayerAPI *const player = func ? func() : nullptr;
+    if (player) {
+        std::lock_guard<std::mutex> locker(generationMutex);
+        playerOwners[player] = table;
+        ++table->livePlayers;
+    }
+#ifdef MDKLOADER_ENABLE_CAPTURE
+    // Every Player is interposed, its calls are captured once capturing starts.
+    if (player) {
+        const CapturedPlayer *const captured = capturePlayer(player);
+        if (captureEnabled.load(std::memory_order_relaxed)) {
+            recordCall(MDKAPI_mdkPlayerAPI_new, captured->id, time);
+        }
+        return &captured->api;
+    }
+#endif
+    return player;
 }
 
 void mdkPlayerAPI_delete(const struct mdkPlayerAPI **value)
 {
-    MDKLOADER_EXECUTE_MDKAPI(mdkPlayerAPI_delete, value)
+    if (!value || !*value) {
+        MDKLOADER_EXECUTE_MDKAPI(mdkPlayerAPI_delete, value)
+        return;
+    }
+    MDKLOADER_COUNT_MDKAPI_CALL(mdkPlayerAPI_delete)
+    MDKLOADER_TRACE_MDKAPI_CALL(mdkPlayerAPI_delete)
+    MDKLOADER_PROBE_MDKAPI_CALL(mdkPlayerAPI_delete)
+    const ReadGuard guard;
+#ifdef MDKLOADER_ENABLE_CAPTURE
+    // MDK deletes its own table, the copy handed out goes with it.
+    const std::unique_ptr<CapturedPlayer> captured = releaseCapturedPlayer(*value);
+    if (captured && captureEnabled.load(std::memory_order_relaxed)) {
+        recordCall(MDKAPI_mdkPlayerAPI_delete, captured->id, captureTime());
+    }
+    const mdkPlayerAPI *original = captured ? captured->original : *value;
+    const struct mdkPlayerAPI **const target = captured ? &original : value;
+#else
+    const struct mdkPlayerAPI **const target = value;
+#endif
+    const mdkPlayerAPI *const player = *target;
+    const MDKAPITable *owner = guard.table();
+    {
+        std::lock_guard<std::mutex> locker(generationMutex);
+        const auto it = playerOwners.find(player);
+        if (it != playerOwners.cend()) {
+            owner = it->second;
+        }
+    }
+    // The owner can't be destroyed before its Player count drops below.
+    if (const auto func = owner ? owner->m_lpmdkPlayerAPI_delete.load(std::memory_order_relaxed)
+                                : nullptr) {
+        func(target);
+    }
+#ifdef MDKLOADER_ENABLE_CAPTURE
+    if (captured) {
+        *value = *target;
+    }
+#endif
+    bool reclaim = false;
+    {
+        std::lock_guard<std::mutex> locker(generationMutex);
+        const auto it = playerOwners.find(player);
+        if (it != playerOwners.cend()) {
+            playerOwners.erase(it);
+            --owner->livePlayers;
+            reclaim = owner->retired && takeReclaimableTable(owner);
+        }
+    }
+    if (reclaim) {
+        destroyTable(owner);
+    }
 }
 
 void MDK_foreignGLContextDestroyed(){MDKLOADER_EXECUTE_MDKAPI(MDK_foreignGLContextDestroyed)}
@@ -306,10 +3862,79 @@ void MDK_foreignGLContextDestroyed(){MDKLOADER_EXECUTE_MDKAPI(MDK_foreignGLConte
 
 mdkVideoFrameAPI *mdkVideoFrameAPI_new(int w, int h, enum MDK_PixelFormat f)
 {
-    MDKLOADER_EXECUTE_MDKAPI_RETURN(mdkVideoFrameAPI_new, nullptr, w, h, f)
+    MDKLOADER_COUNT_MDKAPI_CALL(mdkVideoFrameAPI_new)
+    MDKLOADER_TRACE_MDKAPI_CALL(mdkVideoFrameAPI_new)
+    MDKLOADER_PROBE_MDKAPI_CALL(mdkVideoFrameAPI_new)
+    const ReadGuard guard;
+    const MDKAPITable *const table = guard.table();
+    const auto func = table ? table->m_lpmdkVideoFrameAPI_new.load(std::memory_order_relaxed)
+                            : nullptr;
+    mdkVideoFrameAPI *const frame = func ? func(w, h, f) : nullptr;
+    if (frame) {
+        FrameShard &shard = frameShard(frame);
+        std::lock_guard<std::mutex> locker(shard.mutex);
+        shard.owners[frame] = table;
+        table->liveFrames.fetch_add(1, std::memory_order_relaxed);
+    }
+#ifdef MDKLOADER_ENABLE_CAPTURE
+    if (frame && captureEnabled.load(std::memory_order_relaxed)) {
+        recordCall<int, int, MDK_PixelFormat>(MDKAPI_mdkVideoFrameAPI_new,
+                                              reinterpret_cast<uintptr_t>(frame),
+                                              captureTime(),
+                                              w,
+                                              h,
+                                              f);
+    }
+#endif
+    return frame;
 }
 
 void mdkVideoFrameAPI_delete(struct mdkVideoFrameAPI **value)
 {
-    MDKLOADER_EXECUTE_MDKAPI(mdkVideoFrameAPI_delete, value)
+    MDKLOADER_COUNT_MDKAPI_CALL(mdkVideoFrameAPI_delete)
+    MDKLOADER_TRACE_MDKAPI_CALL(mdkVideoFrameAPI_delete)
+    MDKLOADER_PROBE_MDKAPI_CALL(mdkVideoFrameAPI_delete)
+    const ReadGuard guard;
+    const mdkVideoFrameAPI *const frame = value ? *value : nullptr;
+#ifdef MDKLOADER_ENABLE_CAPTURE
+    if (frame && captureEnabled.load(std::memory_order_relaxed)) {
+        recordCall(MDKAPI_mdkVideoFrameAPI_delete, reinterpret_cast<uintptr_t>(*value), captureTime());
+    }
+#endif
+    // Frames MDK created on its own are deleted by the current library.
+    const MDKAPITable *owner = guard.table();
+    bool counted = false;
+    if (frame) {
+        FrameShard &shard = frameShard(frame);
+        std::lock_guard<std::mutex> locker(shard.mutex);
+        const auto it = shard.owners.find(frame);
+        if (it != shard.owners.cend()) {
+            owner = it->second;
+            counted = true;
+            shard.owners.erase(it);
+        }
+    }
+    // The owner can't be destroyed before its frame count drops below.
+    if (const auto func = owner ? owner->m_lpmdkVideoFrameAPI_delete.load(std::memory_order_relaxed)
+                                : nullptr) {
+        func(value);
+    }
+    if (!counted) {
+        return;
+    }
+    if (owner == guard.table()) {
+        // Pinned by the guard, retiring it waits for the guard before
+        // looking at the count.
+        owner->liveFrames.fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
+    bool reclaim = false;
+    {
+        std::lock_guard<std::mutex> locker(generationMutex);
+        reclaim = (owner->liveFrames.fetch_sub(1, std::memory_order_relaxed) == 1) && owner->retired
+                  && takeReclaimableTable(owner);
+    }
+    if (reclaim) {
+        destroyTable(owner);
+    }
 }
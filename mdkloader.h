@@ -25,13 +25,397 @@
 #pragma once
 
 #include "mdkloader_global.h"
+#include "mdk/c/MediaInfo.h"
+#include "mdk/c/Player.h"
+#include "mdk/c/VideoFrame.h"
+#include "mdk/c/global.h"
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef enum MDKLoader_BindingMode {
+    MDKLoader_BindingMode_Default, /* dlopen with RTLD_LAZY, then resolve all symbols */
+    MDKLoader_BindingMode_Eager, /* dlopen with RTLD_NOW, then resolve all symbols. Pays every cost before the first call */
+    MDKLoader_BindingMode_Lazy, /* dlopen with RTLD_LAZY, each symbol is resolved on its first call */
+} MDKLoader_BindingMode;
+
+typedef struct mdkloaderLoadOptions {
+    MDKLoader_BindingMode binding;
+    bool prefetch; /* ask the kernel to read the library file into the page cache before opening it. Linux only */
+    bool measureMemory; /* record the RSS growth of the process in mdkloaderLoadReport.rssDelta. Linux only */
+    int openFlags; /* or'ed into the dlopen() mode, e.g. RTLD_GLOBAL or RTLD_NODELETE. Unix only */
+    bool hugePageText; /* move the code of MDK and of the libraries it pulls in onto transparent huge pages, see below. Linux only */
+} mdkloaderLoadOptions;
+
+/* All values are in microseconds. Zero if the library was already loaded. */
+typedef struct mdkloaderLoadTimings {
+    int64_t openTime; /* LoadLibrary/dlopen */
+    int64_t resolveTime; /* symbol resolution, or installing the lazy binding trampolines */
+    int64_t totalTime;
+    int64_t prefetchTime; /* locating the library file and issuing the readahead */
+} mdkloaderLoadTimings;
+
+typedef enum MDKLoader_LoadStatus {
+    MDKLoader_LoadStatus_NotLoaded,
+    MDKLoader_LoadStatus_Loading,
+    MDKLoader_LoadStatus_Loaded,
+    MDKLoader_LoadStatus_Failed, /* the library or some of its symbols could not be loaded */
+    MDKLoader_LoadStatus_IdleUnloaded, /* unloaded after being idle, the next call loads it again */
+} MDKLoader_LoadStatus;
+
+/*!
+  \brief mdkloaderLoadCallback
+  \param loaded the same as the return value of mdkloader_load_ex()
+  Invoked on the loading thread.
+ */
+typedef struct mdkloaderLoadCallback {
+    void (*cb)(bool loaded, void* opaque);
+    void* opaque;
+} mdkloaderLoadCallback;
+
+/*
+  \brief mdkloaderDiscoveryOptions
+  Candidates are probed with stat() in this order:
+  - $MDKLOADER_LIBRARY, a full path to the library
+  - every directory in directories, $MDKLOADER_PATH, and on Unix $LD_LIBRARY_PATH and the default library directories,
+    with every file name in names
+  The path found in the directories is stored in cacheFile together with its inode, mtime and size, and the searched
+  directories and names. As long as the file is unchanged and the search is the same, the next discovery costs one
+  stat().
+ */
+typedef struct mdkloaderDiscoveryOptions {
+    const char* const* directories; /* null terminated, can be null */
+    const char* const* names; /* null terminated, null for the platform default (libmdk.so.0 and libmdk.so on Linux) */
+    const char* cacheFile; /* can be null to disable the cache */
+} mdkloaderDiscoveryOptions;
+
+/* MDK state mdkloader_prefork() sets up in the parent, so that forked children inherit it */
+typedef struct mdkloaderPreforkOptions {
+    const char* const* globalOptions; /* null terminated key, value pairs for MDK_setGlobalOptionString(), can be null */
+    mdkLogHandler logHandler; /* passed to MDK_setLogHandler() if cb is not null */
+} mdkloaderPreforkOptions;
+
+/* FFmpeg runtime libraries MDK can be pointed at, see MDK_setGlobalOptionString() */
+typedef enum MDKLoader_FFmpegLibrary {
+    MDKLoader_FFmpegLibrary_avutil, /* avutil_lib */
+    MDKLoader_FFmpegLibrary_avcodec, /* avcodec_lib */
+    MDKLoader_FFmpegLibrary_avformat, /* avformat_lib */
+    MDKLoader_FFmpegLibrary_swresample, /* swresample_lib */
+    MDKLoader_FFmpegLibrary_avfilter, /* avfilter_lib */
+    MDKLoader_FFmpegLibrary_Count,
+} MDKLoader_FFmpegLibrary;
+
+/*
+  \brief mdkloaderAPI
+  The resolved MDK entry points. Calling through this table goes straight into MDK,
+  without the extra hop through the forwarding functions exported by this library.
+  A member is null if the symbol is missing. The table is valid until mdkloader_cleanup().
+  Players and VideoFrames created by the forwarding functions must be deleted by them too, not through this table,
+  otherwise the library which created them is never closed.
+ */
+typedef struct mdkloaderAPI {
+    /* global.h */
+    void* (*MDK_javaVM)(void* vm);
+    void (*MDK_setLogLevel)(MDK_LogLevel value);
+    MDK_LogLevel (*MDK_logLevel)();
+    void (*MDK_setLogHandler)(mdkLogHandler);
+    void (*MDK_setGlobalOptionString)(const char* key, const char* value);
+    void (*MDK_setGlobalOptionInt32)(const char* key, int value);
+    void (*MDK_setGlobalOptionPtr)(const char* key, void* value);
+    char* (*MDK_strdup)(const char* strSource);
+    int (*MDK_version)();
+    /* MediaInfo.h */
+    void (*MDK_AudioStreamCodecParameters)(const mdkAudioStreamInfo*, mdkAudioCodecParameters* p);
+    bool (*MDK_AudioStreamMetadata)(const mdkAudioStreamInfo*, mdkStringMapEntry* entry);
+    void (*MDK_VideoStreamCodecParameters)(const mdkVideoStreamInfo*, mdkVideoCodecParameters* p);
+    bool (*MDK_VideoStreamMetadata)(const mdkVideoStreamInfo*, mdkStringMapEntry* entry);
+    bool (*MDK_MediaMetadata)(const mdkMediaInfo*, mdkStringMapEntry* entry);
+    /* Player.h */
+    const mdkPlayerAPI* (*mdkPlayerAPI_new)();
+    void (*mdkPlayerAPI_delete)(const struct mdkPlayerAPI**);
+    void (*MDK_foreignGLContextDestroyed)();
+    /* VideoFrame.h */
+    mdkVideoFrameAPI* (*mdkVideoFrameAPI_new)(int width, int height, enum MDK_PixelFormat format);
+    void (*mdkVideoFrameAPI_delete)(struct mdkVideoFrameAPI**);
+} mdkloaderAPI;
+
+typedef enum MDKLoader_LogLevel {
+    MDKLoader_LogLevel_Error,
+    MDKLoader_LogLevel_Warning,
+    MDKLoader_LogLevel_Info,
+} MDKLoader_LogLevel;
+
+/*!
+  \brief mdkloaderLogSink
+  Receives the messages of the loader, e.g. why loading failed. The default sink writes
+  warnings and errors to stderr.
+  \param cb null to silence the loader. message is only valid during the call
+  \param level messages above this level are not even formatted
+ */
+typedef struct mdkloaderLogSink {
+    void (*cb)(MDKLoader_LogLevel level, const char* message, void* opaque);
+    void* opaque;
+    MDKLoader_LogLevel level;
+} mdkloaderLogSink;
+
+/* Resident memory in bytes, see mdkloader_memoryUsage() */
+typedef struct mdkloaderMemoryUsage {
+    int64_t fileRss; /* pages backed by the file: code, read only data and data never written to */
+    int64_t anonRss; /* anonymous pages: data written to, e.g. by relocations, and bss */
+} mdkloaderMemoryUsage;
+
+typedef struct mdkloaderLibraryMemory {
+    char path[1024];
+    mdkloaderMemoryUsage rss;
+} mdkloaderLibraryMemory;
+
+/* What happened during the last attempt to load a library, see mdkloader_loadReport(). */
+typedef struct mdkloaderLoadReport {
+    bool loaded; /* the library was loaded and all symbols were resolved */
+    MDKLoader_BindingMode binding;
+    char path[1024]; /* the file actually loaded if known, otherwise the requested one */
+    char error[512]; /* LoadLibrary/dlopen error if the library could not be loaded */
+    uint64_t missingSymbols; /* bit i is set if the symbol mdkloader_symbolName(i) is missing. Always 0 with lazy binding */
+    int missingSymbolCount;
+    mdkloaderLoadTimings timings;
+    mdkloaderMemoryUsage rssDelta; /* growth of the process RSS over the load, see mdkloaderLoadOptions.measureMemory */
+    int64_t hugePageText; /* bytes of code moved onto huge pages, see mdkloaderLoadOptions.hugePageText */
+} mdkloaderLoadReport;
+
+#define MDKLOADER_STATS_BUCKETS 32
+
+/* Calls of one API made through the forwarding functions, summed over all threads. */
+typedef struct mdkloaderCallStats {
+    const char* name;
+    uint64_t calls;
+    uint64_t totalTime; /* nanoseconds */
+    uint64_t histogram[MDKLOADER_STATS_BUCKETS]; /* histogram[i]: calls which took [2^i, 2^(i+1)) ns, the last bucket is open ended */
+} mdkloaderCallStats;
+
+typedef struct mdkloaderReplayOptions {
+    bool originalTiming; /* issue each call at its recorded time, on a thread per recorded thread. Otherwise every call is issued in order on the calling thread, as fast as possible */
+} mdkloaderReplayOptions;
+
+typedef struct mdkloaderReplayResult {
+    uint64_t calls; /* calls issued */
+    uint64_t skipped; /* calls which can't be replayed, see mdkloader_replay() */
+    uint64_t dropped; /* calls lost while capturing because a buffer was full */
+    int threads; /* recorded threads */
+    int64_t duration; /* microseconds */
+    int64_t maxLateness; /* microseconds the most delayed call was issued after its recorded time, with originalTiming */
+} mdkloaderReplayResult;
+
+/*
+  \brief mdkloaderContext
+  An MDK library loaded independently of the global one and of other contexts, e.g. to
+  compare two MDK releases inside one process. On Linux every context lives in a link map
+  namespace of its own (dlmopen), glibc supports at most 15 of them. Elsewhere contexts
+  must be created from distinct library files.
+  Objects created by a context must be used through their own function tables (mdkPlayerAPI,
+  mdkVideoFrameAPI) or the context functions, never passed to another context or to the
+  global forwarding functions.
+ */
+typedef struct mdkloaderContext mdkloaderContext;
+
+// Thread safe. The library is loaded only once, concurrent callers wait for
+// the in-flight load and share its result. Call mdkloader_cleanup() first to
+// load another library.
 MDKLOADER_EXPORT bool mdkloader_load(const char *value);
+/*
+  options and timings can be null.
+  With options->hugePageText, the parts of the executable segments which span whole huge pages
+  are copied onto anonymous memory advised with MADV_HUGEPAGE, which replaces the file mapping
+  atomically (mremap). Large code then takes a fraction of the iTLB entries. The copies count as
+  anonymous memory which isn't shared with other processes, and profilers can't symbolize the
+  moved code from the file anymore. Skipped if transparent huge pages are disabled.
+ */
+MDKLOADER_EXPORT bool mdkloader_load_ex(const char *value,
+                                        const mdkloaderLoadOptions *options,
+                                        mdkloaderLoadTimings *timings);
 MDKLOADER_EXPORT bool mdkloader_isLoaded();
+/*!
+  \brief mdkloader_reload
+  Load another MDK library, e.g. a patched build, and switch to it without restarting.
+  Calls in flight finish on the old library, new calls go to the new one. The old library
+  is unloaded once no thread is inside a forwarding function anymore and every Player
+  created by it has been deleted. VideoFrames created by the old library must not be used
+  after reloading, neither must the table returned by mdkloader_api().
+  MUST NOT be called from an MDK callback.
+  \return false if the new library can't be loaded or misses symbols, the current one is kept then.
+ */
+MDKLOADER_EXPORT bool mdkloader_reload(const char *value);
+// Finds the library without loading it. options can be null.
+// Returns false if nothing was found or path is too small.
+MDKLOADER_EXPORT bool mdkloader_findLibrary(const mdkloaderDiscoveryOptions *options,
+                                            char *path,
+                                            size_t size);
+// mdkloader_findLibrary() + mdkloader_load_ex(). All arguments can be null.
+MDKLOADER_EXPORT bool mdkloader_loadDiscovered(const mdkloaderDiscoveryOptions *discovery,
+                                               const mdkloaderLoadOptions *options,
+                                               mdkloaderLoadTimings *timings);
+// Loads MDK on a background thread and returns immediately. The library file is
+// prefetched before it is opened. Completion is reported through cb (can be null)
+// and can also be polled with mdkloader_loadStatus(). mdkloader_cleanup() waits for
+// the pending loads and their callbacks.
+MDKLOADER_EXPORT void mdkloader_loadAsync(const char *value,
+                                          const mdkloaderLoadOptions *options,
+                                          mdkloaderLoadCallback cb);
+MDKLOADER_EXPORT MDKLoader_LoadStatus mdkloader_loadStatus();
+/*!
+  \brief mdkloader_setIdleUnload
+  For long running processes which use MDK only now and then. Unloads MDK, and the FFmpeg libraries
+  of mdkloader_preloadFFmpeg(), once no forwarding function has been called for timeout milliseconds
+  while no Player and no VideoFrame created through them is alive. The next call through a forwarding
+  function loads the same library again, with the same binding, and restores the log level, log
+  handler and global options set through the forwarding functions meanwhile. If that fails,
+  mdkloader_loadStatus() returns MDKLoader_LoadStatus_Failed and MDK stays unloaded until
+  mdkloader_load() succeeds, the call and the following ones return their defaults. Unloading never waits for a call in flight, a library which turns out to be in use is kept.
+  Not done if mdkloader_api() has been called, or while VideoFrames received in MDK callbacks are
+  kept after their Player is deleted. mdkloader_isLoaded() returns false while MDK is unloaded.
+  \param timeout milliseconds, 0 to disable (the default)
+ */
+MDKLOADER_EXPORT void mdkloader_setIdleUnload(int64_t timeout);
+/*!
+  \brief mdkloader_prefork
+  For processes which fork a worker per job. Loads MDK with eager binding, binds every symbol,
+  sets up MDK's global state from options and installs pthread_atfork() handlers. Children forked
+  afterwards inherit the resolved table and call into MDK without any dlopen() or dlsym(), the pages
+  of MDK stay shared copy-on-write. The handlers also make fork() safe while other threads use the
+  loader: its locks are taken around fork(), and the child forgets the threads which didn't survive.
+  Don't create Players before forking, the threads of MDK don't survive fork() either.
+  On Windows it only loads MDK and applies options.
+  \param options can be null
+  \return the same as mdkloader_load_ex()
+ */
+MDKLOADER_EXPORT bool mdkloader_prefork(const char *value, const mdkloaderPreforkOptions *options);
+/*!
+  \brief mdkloader_preloadFFmpeg
+  Open the FFmpeg libraries concurrently on a few threads, then pass the paths to MDK
+  as global options (now if MDK is loaded, otherwise as soon as it is). The libraries
+  stay loaded until mdkloader_cleanup(). Can be called before mdkloader_load().
+  \param paths indexed by MDKLoader_FFmpegLibrary, null entries are skipped
+  \param loadTimes can be null. Indexed by MDKLoader_FFmpegLibrary, microseconds spent on
+  each library, -1 if it failed to load and 0 if it was skipped
+  \return number of libraries loaded
+ */
+MDKLOADER_EXPORT int mdkloader_preloadFFmpeg(const char *const *paths, int64_t *loadTimes);
+// Null if MDK is not loaded. With lazy binding, the first call binds all symbols.
+// Invalid after mdkloader_reload() and mdkloader_cleanup(). The library is never
+// unloaded for being idle once this has been called.
+MDKLOADER_EXPORT const mdkloaderAPI *mdkloader_api();
+// Null if the library can't be loaded or misses symbols. Symbols are always bound eagerly.
+MDKLOADER_EXPORT mdkloaderContext *mdkloader_context_create(const char *value);
+// Every object created by the context must have been deleted.
+MDKLOADER_EXPORT void mdkloader_context_destroy(mdkloaderContext *context);
+// Valid until mdkloader_context_destroy().
+MDKLOADER_EXPORT const mdkloaderAPI *mdkloader_context_api(const mdkloaderContext *context);
+MDKLOADER_EXPORT int mdkloader_context_version(const mdkloaderContext *context);
+/* Context scoped mdkPlayerAPI_new()/mdkPlayerAPI_delete() */
+MDKLOADER_EXPORT const mdkPlayerAPI *mdkloader_context_newPlayer(const mdkloaderContext *context);
+MDKLOADER_EXPORT void mdkloader_context_deletePlayer(const mdkloaderContext *context,
+                                                     const mdkPlayerAPI **value);
+/* Context scoped mdkVideoFrameAPI_new()/mdkVideoFrameAPI_delete() */
+MDKLOADER_EXPORT mdkVideoFrameAPI *mdkloader_context_newVideoFrame(const mdkloaderContext *context,
+                                                                   int width,
+                                                                   int height,
+                                                                   enum MDK_PixelFormat format);
+MDKLOADER_EXPORT void mdkloader_context_deleteVideoFrame(const mdkloaderContext *context,
+                                                         mdkVideoFrameAPI **value);
+/* Context scoped MediaInfo.h */
+MDKLOADER_EXPORT void mdkloader_context_audioStreamCodecParameters(const mdkloaderContext *context,
+                                                                   const mdkAudioStreamInfo *asi,
+                                                                   mdkAudioCodecParameters *acp);
+MDKLOADER_EXPORT bool mdkloader_context_audioStreamMetadata(const mdkloaderContext *context,
+                                                            const mdkAudioStreamInfo *asi,
+                                                            mdkStringMapEntry *sme);
+MDKLOADER_EXPORT void mdkloader_context_videoStreamCodecParameters(const mdkloaderContext *context,
+                                                                   const mdkVideoStreamInfo *vsi,
+                                                                   mdkVideoCodecParameters *vcp);
+MDKLOADER_EXPORT bool mdkloader_context_videoStreamMetadata(const mdkloaderContext *context,
+                                                            const mdkVideoStreamInfo *vsi,
+                                                            mdkStringMapEntry *sme);
+MDKLOADER_EXPORT bool mdkloader_context_mediaMetadata(const mdkloaderContext *context,
+                                                      const mdkMediaInfo *mi,
+                                                      mdkStringMapEntry *sme);
+/*!
+  \brief mdkloader_callStats
+  Call counts and latencies are only collected if the library was built with
+  MDKLOADER_ENABLE_STATS, otherwise the forwarding functions carry no instrumentation at all.
+  \param stats can be null to query the number of APIs. Filled in the order of mdkloaderAPI.
+  \return number of forwarded APIs, 0 if the stats are not compiled in
+ */
+MDKLOADER_EXPORT int mdkloader_callStats(mdkloaderCallStats *stats, int count);
+// Writes a table of the APIs which were called to fileName (stderr if null).
+// Returns false if the stats are not compiled in or the file can't be written.
+MDKLOADER_EXPORT bool mdkloader_dumpCallStats(const char *fileName);
+/*!
+  \brief mdkloader_traceStart
+  Record begin/end events of the loading phases and of every forwarded MDK call (and, if
+  MDKLOADER_ENABLE_TRACE is defined where mdk/Player.h is included, of the mdk::Player
+  calls and callbacks) into a lock free ring per thread. Events are dropped while a ring is full.
+  Only available if the library was built with MDKLOADER_ENABLE_TRACE.
+  \param eventsPerThread ring size, rounded up to a power of 2. 0 for the default (65536)
+  \return false if tracing is not compiled in
+ */
+MDKLOADER_EXPORT bool mdkloader_traceStart(size_t eventsPerThread);
+MDKLOADER_EXPORT void mdkloader_traceStop();
+// Custom events, e.g. to put the calls into MDK in the context of the application.
+// name must stay valid until the next mdkloader_traceFlush(), a string literal is best.
+MDKLOADER_EXPORT void mdkloader_traceBegin(const char *name);
+MDKLOADER_EXPORT void mdkloader_traceEnd(const char *name);
+// Moves the events recorded so far into a Chrome trace event JSON file, which can be
+// opened in chrome://tracing or Perfetto. Can be called while tracing.
+MDKLOADER_EXPORT bool mdkloader_traceFlush(const char *fileName);
+/*!
+  \brief mdkloader_captureStart
+  Record every call through the forwarding functions and through the mdkPlayerAPI tables they
+  return, i.e. every mdk::Player call, with its arguments, the time and the calling thread, into
+  a buffer per thread. Calls are dropped while the buffer of their thread is full.
+  Only available if the library was built with MDKLOADER_ENABLE_CAPTURE, mdkPlayerAPI_new() then
+  returns a copy of the table of MDK whose functions record the calls.
+  \param bytesPerThread buffer size, 0 for the default (16 MiB)
+  \return false if capturing is not compiled in
+ */
+MDKLOADER_EXPORT bool mdkloader_captureStart(size_t bytesPerThread);
+MDKLOADER_EXPORT void mdkloader_captureStop();
+// Moves the calls recorded so far into a binary capture file for mdkloader_replay().
+// Can be called while capturing.
+MDKLOADER_EXPORT bool mdkloader_captureFlush(const char *fileName);
+/*!
+  \brief mdkloader_replay
+  Issue the calls of a capture file again, against the MDK loaded now, e.g. libmdk_stub. Players
+  and VideoFrames are created and deleted as recorded, a Player created before capturing started
+  is created on its first call. Callbacks which were set are replaced by ones doing nothing.
+  Calls taking memory of the application, e.g. surfaces, renderers and MediaInfo, and onSync()
+  are skipped. Players and VideoFrames still alive at the end are deleted.
+  Available in every build.
+  \param options can be null to replay as fast as possible
+  \param result can be null
+  \return false if the file can't be read or is not a capture
+ */
+MDKLOADER_EXPORT bool mdkloader_replay(const char *fileName,
+                                       const mdkloaderReplayOptions *options,
+                                       mdkloaderReplayResult *result);
+// Copies the report of the last mdkloader_load*(), mdkloader_reload() or
+// mdkloader_context_create() which actually tried to load a library.
+// Returns false if there was none yet.
+MDKLOADER_EXPORT bool mdkloader_loadReport(mdkloaderLoadReport *report);
+/*!
+  \brief mdkloader_memoryUsage
+  The resident memory of the libraries loaded with MDK, measured now from /proc/self/smaps: the
+  MDK library first, then every library its dlopen() pulled in, e.g. FFmpeg, and the libraries
+  of mdkloader_preloadFFmpeg(). Libraries which were already loaded before MDK aren't included.
+  Pages shared with other processes are counted in full. Only available on Linux.
+  \param libraries can be null to query the number of libraries
+  \return number of libraries, 0 if MDK is not loaded
+ */
+MDKLOADER_EXPORT int mdkloader_memoryUsage(mdkloaderLibraryMemory *libraries, int count);
+// Name of the symbol at index, in the order of mdkloaderAPI. Null if out of range.
+MDKLOADER_EXPORT const char *mdkloader_symbolName(int index);
+MDKLOADER_EXPORT void mdkloader_setLogSink(mdkloaderLogSink sink);
 MDKLOADER_EXPORT int mdkloader_version();
 MDKLOADER_EXPORT void mdkloader_cleanup();
 
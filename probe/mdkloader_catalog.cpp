@@ -0,0 +1,1134 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2020 by wangwenx190 (Yuhang Zhao)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// A columnar catalogue of the files probed by mdkloader_probe, answering filter queries.
+//
+//   mdkloader_catalog --catalog file [--cache file] [--rebuild] [--where predicate]...
+//                     [--count] [--scalar] [--output file]
+//
+// With --cache, the files of the probe cache which are new or changed since the last update
+// are appended to the catalogue first, --rebuild starts from scratch. With --where, the paths
+// of the files matching all predicates are printed, one per line. A predicate is a field, an
+// operator (= != < <= > >=) and a value, e.g.
+//
+//   --where video.codec=hevc --where video.width>3840 --where video.bit_rate>20M --where duration<60000
+//
+// Fields without a prefix are the ones of MediaInfo, video. and audio. the ones of a stream
+// and its codec parameters, see the column lists below. A query may use one kind of stream,
+// a file matches if one of its streams matches. Times are in ms, integers take a k, M or G
+// suffix and must fit the column. Strings are dictionary encoded and compared with = and != only.
+//
+// The catalogue has a table of files, one of video streams and one of audio streams, stored
+// column by column. Every update appends a block of rows, whose columns are contiguous arrays
+// read in place from the mapping:
+//
+//   CatalogFileHeader
+//   block: BlockHeader, RowGroupHeader, columns, path offsets, paths, new dictionary strings, blockEnd
+//   block: BlockHeader, count, file rows replaced or failed since, blockEnd
+//
+// Rows are numbered across blocks, every block starts at a multiple of 64, so that the
+// predicates are evaluated into bitmaps one word of 64 rows at a time, with AVX2 where the CPU
+// has it. Only the dictionary and the replaced rows are collected on open.
+
+#include "mdkloader_probecache.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MDKLOADER_CATALOG_AVX2 1
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+using namespace probe;
+using Clock = std::chrono::steady_clock;
+
+/// Schema
+
+enum class ColumnType { Int32, Int64, Float, Code };
+
+template<ColumnType type>
+struct ColumnTraits;
+template<>
+struct ColumnTraits<ColumnType::Int32>
+{
+    using Value = int32_t;
+};
+template<>
+struct ColumnTraits<ColumnType::Int64>
+{
+    using Value = int64_t;
+};
+template<>
+struct ColumnTraits<ColumnType::Float>
+{
+    using Value = float;
+};
+// Index in the dictionary.
+template<>
+struct ColumnTraits<ColumnType::Code>
+{
+    using Value = uint32_t;
+};
+
+// name, type, value: entry is the CacheEntry, stream the CachedVideoStream or the
+// CachedAudioStream, file the row of the file and code() encodes a string.
+#define MDKLOADER_FOREACH_FILE_COLUMN(F) \
+    F(start_time, Int64, entry->startTime) \
+    F(duration, Int64, entry->duration) \
+    F(bit_rate, Int64, entry->bitRate) \
+    F(size, Int64, entry->mediaSize) \
+    F(streams, Int32, entry->streams) \
+    F(format, Code, code(text(entry, entry->format))) \
+    F(file_size, Int64, entry->fileSize) \
+    F(modified, Int64, entry->modified) \
+    F(path_hash, Int64, static_cast<int64_t>(entry->hash))
+
+#define MDKLOADER_FOREACH_VIDEO_COLUMN(F) \
+    F(file, Int32, file) \
+    F(index, Int32, stream.index) \
+    F(codec, Code, code(text(entry, stream.codec))) \
+    F(format_name, Code, code(text(entry, stream.formatName))) \
+    F(width, Int32, stream.width) \
+    F(height, Int32, stream.height) \
+    F(bit_rate, Int64, stream.bitRate) \
+    F(frame_rate, Float, stream.frameRate) \
+    F(profile, Int32, stream.profile) \
+    F(level, Int32, stream.level) \
+    F(b_frames, Int32, stream.bFrames) \
+    F(rotation, Int32, stream.rotation) \
+    F(start_time, Int64, stream.startTime) \
+    F(duration, Int64, stream.duration) \
+    F(frames, Int64, stream.frames)
+
+#define MDKLOADER_FOREACH_AUDIO_COLUMN(F) \
+    F(file, Int32, file) \
+    F(index, Int32, stream.index) \
+    F(codec, Code, code(text(entry, stream.codec))) \
+    F(bit_rate, Int64, stream.bitRate) \
+    F(profile, Int32, stream.profile) \
+    F(sample_rate, Int32, stream.sampleRate) \
+    F(channels, Int32, stream.channels) \
+    F(frame_size, Int32, stream.frameSize) \
+    F(start_time, Int64, stream.startTime) \
+    F(duration, Int64, stream.duration) \
+    F(frames, Int64, stream.frames)
+
+enum Table { Table_Files, Table_Video, Table_Audio, Table_Count };
+
+#define MDKLOADER_GENERATE_COLUMN_INDEX(table) \
+    MDKLOADER_FOREACH_##table##_COLUMN(MDKLOADER_GENERATE_##table##_COLUMN_INDEX)
+#define MDKLOADER_GENERATE_FILE_COLUMN_INDEX(name, type, value) FileColumn_##name,
+#define MDKLOADER_GENERATE_VIDEO_COLUMN_INDEX(name, type, value) VideoColumn_##name,
+#define MDKLOADER_GENERATE_AUDIO_COLUMN_INDEX(name, type, value) AudioColumn_##name,
+
+// Indexes of the columns of all tables, one after another.
+enum Column {
+    MDKLOADER_GENERATE_COLUMN_INDEX(FILE)
+    MDKLOADER_GENERATE_COLUMN_INDEX(VIDEO)
+    MDKLOADER_GENERATE_COLUMN_INDEX(AUDIO)
+    Column_Count
+};
+
+struct ColumnInfo
+{
+    Table table;
+    const char *name;
+    ColumnType type;
+};
+
+#define MDKLOADER_GENERATE_FILE_COLUMN_INFO(name, type, value) {Table_Files, #name, ColumnType::type},
+#define MDKLOADER_GENERATE_VIDEO_COLUMN_INFO(name, type, value) {Table_Video, #name, ColumnType::type},
+#define MDKLOADER_GENERATE_AUDIO_COLUMN_INFO(name, type, value) {Table_Audio, #name, ColumnType::type},
+
+constexpr ColumnInfo columns[Column_Count] = {
+    MDKLOADER_FOREACH_FILE_COLUMN(MDKLOADER_GENERATE_FILE_COLUMN_INFO)
+    MDKLOADER_FOREACH_VIDEO_COLUMN(MDKLOADER_GENERATE_VIDEO_COLUMN_INFO)
+    MDKLOADER_FOREACH_AUDIO_COLUMN(MDKLOADER_GENERATE_AUDIO_COLUMN_INFO)};
+
+constexpr const char *tablePrefixes[Table_Count] = {"", "video.", "audio."};
+
+/// File layout
+
+constexpr char catalogMagic[8] = {'M', 'D', 'K', 'C', 'A', 'T', 'L', 'G'};
+// Changes with the layout and the column lists.
+constexpr uint32_t catalogVersion = 2 + (Column_Count << 8);
+constexpr uint64_t blockEnd = 0x444e454b434f4c42ull; // "BLOCKEND" on little endian
+constexpr size_t columnAlignment = 64;
+constexpr uint64_t maxBlockFiles = 1 << 20; // bounds the memory of an update
+
+// Padded, so that the first block and the columns in it are aligned in the mapping.
+struct CatalogFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    char reserved[columnAlignment - 16];
+};
+
+enum BlockKind : uint32_t {
+    BlockKind_Rows = 1,
+    BlockKind_Deletions = 2,
+};
+
+struct BlockHeader
+{
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t size; // including the header and blockEnd
+};
+
+// Offsets are relative to the block.
+struct RowGroupHeader
+{
+    uint64_t firstRow[Table_Count];
+    uint64_t rows[Table_Count];
+    uint64_t dictionaryBegin; // code of the first new string
+    uint64_t dictionaryCount;
+    uint64_t dictionary; // uint32_t size, the string and a null, aligned to 4
+    uint64_t pathOffsets; // uint64_t[rows + 1] into paths
+    uint64_t paths;
+    uint64_t columns[Column_Count];
+};
+
+static_assert((sizeof(CatalogFileHeader) == columnAlignment) && ((sizeof(BlockHeader) % 8) == 0)
+              && ((sizeof(RowGroupHeader) % 8) == 0));
+
+size_t alignTo(const size_t value, const size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/// Catalogue
+
+class Catalog
+{
+public:
+    struct RowGroup
+    {
+        const unsigned char *block;
+        RowGroupHeader header;
+
+        template<typename T>
+        const T *column(const int index) const
+        {
+            return reinterpret_cast<const T *>(block + header.columns[index]);
+        }
+    };
+
+    bool open(const fs::path &path)
+    {
+        path_ = path;
+        groups_.clear();
+        dictionary_.clear();
+        deletions_.clear();
+        std::error_code ec;
+        const auto fileSize = fs::file_size(path_, ec);
+        if (ec) {
+            return !fs::exists(path_, ec);
+        }
+        if (!file_.open(path_)) {
+            return false;
+        }
+        const size_t validSize = scan();
+        if ((validSize == 0) && (fileSize > 0)) {
+            std::fprintf(stderr, "%s is not a catalogue of this build and machine\n", path_.u8string().c_str());
+            return false;
+        }
+        if (validSize < fileSize) {
+            // A torn block of an interrupted update.
+            file_.close();
+            fs::resize_file(path_, validSize, ec);
+            if (ec || !file_.open(path_)) {
+                return false;
+            }
+            scan();
+        }
+        return true;
+    }
+
+    // The parts of a block, written one after another.
+    bool append(const std::vector<std::string_view> &parts)
+    {
+        std::error_code ec;
+        const bool created = !fs::exists(path_, ec) || (fs::file_size(path_, ec) == 0);
+        std::ofstream out(path_, std::ios::binary | std::ios::app);
+        if (created) {
+            CatalogFileHeader header = {};
+            std::memcpy(header.magic, catalogMagic, sizeof(catalogMagic));
+            header.version = catalogVersion;
+            header.byteOrder = cacheByteOrder;
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        }
+        for (const std::string_view part : parts) {
+            out.write(part.data(), static_cast<std::streamsize>(part.size()));
+        }
+        out.flush();
+        return static_cast<bool>(out);
+    }
+
+    const std::vector<RowGroup> &groups() const { return groups_; }
+    const std::vector<std::string_view> &dictionary() const { return dictionary_; }
+
+    // The row the next block starts with.
+    uint64_t nextRow(const Table table) const
+    {
+        if (groups_.empty()) {
+            return 0;
+        }
+        const RowGroupHeader &last = groups_.back().header;
+        return alignTo(last.firstRow[table] + last.rows[table], 64);
+    }
+
+    uint64_t rows(const Table table) const
+    {
+        uint64_t count = 0;
+        for (const RowGroup &group : groups_) {
+            count += group.header.rows[table];
+        }
+        return count;
+    }
+
+    uint64_t deletedFiles() const { return deletions_.size(); }
+
+    // One bit per file row, cleared for the rows in between blocks and the deleted ones.
+    std::vector<uint64_t> liveFiles() const
+    {
+        std::vector<uint64_t> live(nextRow(Table_Files) / 64);
+        for (const RowGroup &group : groups_) {
+            const uint64_t first = group.header.firstRow[Table_Files];
+            const uint64_t rows = group.header.rows[Table_Files];
+            std::fill_n(live.begin() + first / 64, rows / 64, ~uint64_t(0));
+            if (rows % 64) {
+                live[(first + rows) / 64] = (uint64_t(1) << (rows % 64)) - 1;
+            }
+        }
+        for (const uint64_t row : deletions_) {
+            if ((row / 64) < live.size()) {
+                live[row / 64] &= ~(uint64_t(1) << (row % 64));
+            }
+        }
+        return live;
+    }
+
+    std::string_view path(const uint64_t row) const
+    {
+        const auto it = std::upper_bound(groups_.cbegin(), groups_.cend(), row, [](const uint64_t value, const RowGroup &group) {
+            return value < group.header.firstRow[Table_Files];
+        });
+        const RowGroup &group = *(it - 1);
+        const uint64_t local = row - group.header.firstRow[Table_Files];
+        const auto offsets = reinterpret_cast<const uint64_t *>(group.block + group.header.pathOffsets);
+        return {reinterpret_cast<const char *>(group.block + group.header.paths) + offsets[local],
+                static_cast<size_t>(offsets[local + 1] - offsets[local])};
+    }
+
+private:
+    // Collects the complete blocks, returns the size of the valid part of the file.
+    size_t scan()
+    {
+        groups_.clear();
+        dictionary_.clear();
+        deletions_.clear();
+        const unsigned char *data = file_.data();
+        const size_t size = file_.size();
+        CatalogFileHeader header;
+        if (size < sizeof(header)) {
+            return 0;
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, catalogMagic, sizeof(catalogMagic)) || (header.version != catalogVersion)
+            || (header.byteOrder != cacheByteOrder)) {
+            return 0;
+        }
+        size_t offset = sizeof(header);
+        while ((size - offset) >= (sizeof(BlockHeader) + sizeof(blockEnd))) {
+            const unsigned char *block = data + offset;
+            BlockHeader blockHeader;
+            std::memcpy(&blockHeader, block, sizeof(blockHeader));
+            uint64_t end = 0;
+            if ((blockHeader.size > (size - offset)) || (blockHeader.size < (sizeof(BlockHeader) + sizeof(end)))
+                || (blockHeader.size % columnAlignment)) {
+                break;
+            }
+            std::memcpy(&end, block + blockHeader.size - sizeof(end), sizeof(end));
+            if (end != blockEnd) {
+                break;
+            }
+            if (blockHeader.kind == BlockKind_Rows) {
+                RowGroup group = {block, {}};
+                std::memcpy(&group.header, block + sizeof(BlockHeader), sizeof(group.header));
+                if (group.header.dictionaryBegin != dictionary_.size()) {
+                    break;
+                }
+                const unsigned char *strings = block + group.header.dictionary;
+                for (uint64_t i = 0; i < group.header.dictionaryCount; ++i) {
+                    uint32_t length;
+                    std::memcpy(&length, strings, sizeof(length));
+                    dictionary_.emplace_back(reinterpret_cast<const char *>(strings + sizeof(length)), length);
+                    strings += alignTo(sizeof(length) + length + 1, sizeof(length));
+                }
+                groups_.push_back(group);
+            } else if (blockHeader.kind == BlockKind_Deletions) {
+                uint64_t count;
+                std::memcpy(&count, block + sizeof(BlockHeader), sizeof(count));
+                const auto rows = reinterpret_cast<const uint64_t *>(block + sizeof(BlockHeader) + sizeof(count));
+                deletions_.insert(deletions_.end(), rows, rows + count);
+            }
+            offset += blockHeader.size;
+        }
+        return offset;
+    }
+
+    fs::path path_;
+    MappedFile file_;
+    std::vector<RowGroup> groups_;
+    std::vector<std::string_view> dictionary_;
+    std::vector<uint64_t> deletions_;
+};
+
+constexpr char zeros[columnAlignment] = {};
+
+template<typename T>
+std::string_view bytesOf(const T &value)
+{
+    return {reinterpret_cast<const char *>(&value), sizeof(value)};
+}
+
+// Collects rows into the columns of a new block. parts() is the block, next() starts another
+// one after it.
+class RowGroupBuilder
+{
+public:
+    explicit RowGroupBuilder(const Catalog &catalog)
+    {
+        for (int table = 0; table < Table_Count; ++table) {
+            header_.firstRow[table] = catalog.nextRow(static_cast<Table>(table));
+        }
+        header_.dictionaryBegin = catalog.dictionary().size();
+        // The dictionary stays mapped while the catalogue is open.
+        for (size_t i = 0; i < catalog.dictionary().size(); ++i) {
+            codes_.emplace(catalog.dictionary()[i], static_cast<uint32_t>(i));
+        }
+        pathOffsets_.push_back(0);
+    }
+
+    uint64_t rows() const { return header_.rows[Table_Files]; }
+
+    void add(const CacheEntry *entry)
+    {
+#define MDKLOADER_ADD_COLUMN(table, name, type, value) \
+    put<ColumnType::type>(columns_[table##Column_##name], value);
+#define MDKLOADER_ADD_FILE_COLUMN(name, type, value) MDKLOADER_ADD_COLUMN(File, name, type, value)
+#define MDKLOADER_ADD_VIDEO_COLUMN(name, type, value) MDKLOADER_ADD_COLUMN(Video, name, type, value)
+#define MDKLOADER_ADD_AUDIO_COLUMN(name, type, value) MDKLOADER_ADD_COLUMN(Audio, name, type, value)
+        const auto file = static_cast<int32_t>(header_.firstRow[Table_Files] + header_.rows[Table_Files]);
+        MDKLOADER_FOREACH_FILE_COLUMN(MDKLOADER_ADD_FILE_COLUMN)
+        const std::string_view path = text(entry, entry->path);
+        paths_.append(path);
+        pathOffsets_.push_back(paths_.size());
+        ++header_.rows[Table_Files];
+        for (uint32_t i = 0; i < entry->videoCount; ++i) {
+            const CachedVideoStream &stream = array<CachedVideoStream>(entry, entry->videoOffset)[i];
+            MDKLOADER_FOREACH_VIDEO_COLUMN(MDKLOADER_ADD_VIDEO_COLUMN)
+            ++header_.rows[Table_Video];
+        }
+        for (uint32_t i = 0; i < entry->audioCount; ++i) {
+            const CachedAudioStream &stream = array<CachedAudioStream>(entry, entry->audioOffset)[i];
+            MDKLOADER_FOREACH_AUDIO_COLUMN(MDKLOADER_ADD_AUDIO_COLUMN)
+            ++header_.rows[Table_Audio];
+        }
+    }
+
+    // Valid until the next add() or next().
+    std::vector<std::string_view> parts()
+    {
+        std::vector<std::string_view> parts;
+        size_t offset = 0;
+        const auto write = [&parts, &offset](const std::string_view part) {
+            parts.push_back(part);
+            offset += part.size();
+        };
+        const auto pad = [&write, &offset](const size_t alignment) {
+            write({zeros, alignTo(offset, alignment) - offset});
+        };
+        header_.dictionaryCount = strings_.size() - flushedStrings_;
+        offset = sizeof(BlockHeader) + sizeof(RowGroupHeader);
+        for (int i = 0; i < Column_Count; ++i) {
+            offset = alignTo(offset, columnAlignment);
+            header_.columns[i] = offset;
+            offset += columns_[i].size();
+        }
+        offset = alignTo(offset, sizeof(uint64_t));
+        header_.pathOffsets = offset;
+        offset += pathOffsets_.size() * sizeof(uint64_t);
+        header_.paths = offset;
+        offset += paths_.size();
+        header_.dictionary = alignTo(offset, sizeof(uint32_t));
+
+        offset = 0;
+        write(bytesOf(blockHeader_));
+        write(bytesOf(header_));
+        for (int i = 0; i < Column_Count; ++i) {
+            pad(columnAlignment);
+            write({reinterpret_cast<const char *>(columns_[i].data()), columns_[i].size()});
+        }
+        pad(sizeof(uint64_t));
+        write({reinterpret_cast<const char *>(pathOffsets_.data()), pathOffsets_.size() * sizeof(uint64_t)});
+        write(paths_);
+        lengths_.clear();
+        for (size_t i = flushedStrings_; i < strings_.size(); ++i) {
+            lengths_.push_back(static_cast<uint32_t>(strings_[i].size()));
+        }
+        for (size_t i = flushedStrings_; i < strings_.size(); ++i) {
+            pad(sizeof(uint32_t));
+            write(bytesOf(lengths_[i - flushedStrings_]));
+            write({strings_[i].c_str(), strings_[i].size() + 1});
+        }
+        offset += sizeof(blockEnd);
+        pad(columnAlignment);
+        offset -= sizeof(blockEnd);
+        write(bytesOf(blockEnd));
+        blockHeader_ = {BlockKind_Rows, 0, offset};
+        return parts;
+    }
+
+    void next()
+    {
+        for (int table = 0; table < Table_Count; ++table) {
+            header_.firstRow[table] = alignTo(header_.firstRow[table] + header_.rows[table], 64);
+            header_.rows[table] = 0;
+        }
+        header_.dictionaryBegin += strings_.size() - flushedStrings_;
+        flushedStrings_ = strings_.size();
+        for (auto &column : columns_) {
+            column.clear();
+        }
+        pathOffsets_.assign(1, 0);
+        paths_.clear();
+    }
+
+private:
+    template<ColumnType type>
+    static void put(std::vector<unsigned char> &column, const typename ColumnTraits<type>::Value value)
+    {
+        const size_t size = column.size();
+        column.resize(size + sizeof(value));
+        std::memcpy(column.data() + size, &value, sizeof(value));
+    }
+
+    uint32_t code(const std::string_view value)
+    {
+        const auto it = codes_.find(value);
+        if (it != codes_.cend()) {
+            return it->second;
+        }
+        const auto code = static_cast<uint32_t>(header_.dictionaryBegin + strings_.size() - flushedStrings_);
+        strings_.emplace_back(value);
+        codes_.emplace(strings_.back(), code);
+        return code;
+    }
+
+    BlockHeader blockHeader_ = {};
+    RowGroupHeader header_ = {};
+    std::vector<unsigned char> columns_[Column_Count];
+    std::vector<uint64_t> pathOffsets_;
+    std::string paths_;
+    std::deque<std::string> strings_; // stable, codes_ refers to them
+    size_t flushedStrings_ = 0;
+    std::vector<uint32_t> lengths_;
+    std::unordered_map<std::string_view, uint32_t> codes_;
+};
+
+std::vector<std::string_view> deletionParts(const std::vector<uint64_t> &rows, BlockHeader &header, uint64_t &count)
+{
+    const size_t size = sizeof(BlockHeader) + sizeof(count) + rows.size() * sizeof(uint64_t);
+    header = {BlockKind_Deletions, 0, alignTo(size + sizeof(blockEnd), columnAlignment)};
+    count = rows.size();
+    return {bytesOf(header),
+            bytesOf(count),
+            {reinterpret_cast<const char *>(rows.data()), rows.size() * sizeof(uint64_t)},
+            {zeros, header.size - size - sizeof(blockEnd)},
+            bytesOf(blockEnd)};
+}
+
+struct UpdateResult
+{
+    uint64_t added = 0;
+    uint64_t replaced = 0;
+    uint64_t removed = 0; // failed to open since
+    uint64_t unchanged = 0;
+};
+
+// Appends the files which are new or changed in the cache, and deletes the rows they replace.
+bool update(Catalog &catalog, const ProbeCache &cache, UpdateResult &result)
+{
+    const std::vector<uint64_t> live = catalog.liveFiles();
+    std::unordered_map<uint64_t, uint64_t> rows; // path hash, live file row
+    for (const Catalog::RowGroup &group : catalog.groups()) {
+        const int64_t *hashes = group.column<int64_t>(FileColumn_path_hash);
+        for (uint64_t i = 0; i < group.header.rows[Table_Files]; ++i) {
+            const uint64_t row = group.header.firstRow[Table_Files] + i;
+            if (live[row / 64] & (uint64_t(1) << (row % 64))) {
+                rows[static_cast<uint64_t>(hashes[i])] = row;
+            }
+        }
+    }
+    const auto column = [&catalog](const uint64_t row, const int index) {
+        const auto it = std::upper_bound(catalog.groups().cbegin(), catalog.groups().cend(), row, [](const uint64_t value, const Catalog::RowGroup &group) {
+            return value < group.header.firstRow[Table_Files];
+        });
+        return (it - 1)->column<int64_t>(index)[row - (it - 1)->header.firstRow[Table_Files]];
+    };
+    RowGroupBuilder builder(catalog);
+    std::vector<uint64_t> deletions;
+    bool ok = true;
+    // Deletions first, an interrupted update then misses files instead of listing them twice.
+    const auto flush = [&catalog, &builder, &deletions, &ok] {
+        if (!deletions.empty()) {
+            BlockHeader header;
+            uint64_t count;
+            ok = ok && catalog.append(deletionParts(deletions, header, count));
+            deletions.clear();
+        }
+        if (builder.rows() > 0) {
+            ok = ok && catalog.append(builder.parts());
+            builder.next();
+        }
+    };
+    cache.forEachLatest([&](const CacheEntry *entry) {
+        const auto it = rows.find(entry->hash);
+        const bool known = (it != rows.cend()) && (catalog.path(it->second) == text(entry, entry->path));
+        if (known && (column(it->second, FileColumn_file_size) == entry->fileSize)
+            && (column(it->second, FileColumn_modified) == entry->modified)) {
+            ++result.unchanged;
+            return;
+        }
+        if (known) {
+            deletions.push_back(it->second);
+        }
+        if (entry->flags & EntryFlag_Failed) {
+            result.removed += known;
+            return;
+        }
+        ++(known ? result.replaced : result.added);
+        builder.add(entry);
+        if (builder.rows() >= maxBlockFiles) {
+            flush();
+        }
+    });
+    flush();
+    return ok;
+}
+
+/// Filters
+
+enum class Op { Eq, Ne, Lt, Le, Gt, Ge };
+
+template<Op op, typename T>
+bool compare(const T value, const T operand)
+{
+    if constexpr (op == Op::Eq) {
+        return value == operand;
+    } else if constexpr (op == Op::Ne) {
+        return value != operand;
+    } else if constexpr (op == Op::Lt) {
+        return value < operand;
+    } else if constexpr (op == Op::Le) {
+        return value <= operand;
+    } else if constexpr (op == Op::Gt) {
+        return value > operand;
+    } else {
+        return value >= operand;
+    }
+}
+
+// mask &= predicate, for rows [begin, end). begin is a multiple of 64, a vectorizing
+// compiler turns the inner loop into compares and a movemask too.
+template<Op op, typename T>
+void filterScalar(const T *values, const size_t begin, const size_t end, const T operand, uint64_t *mask)
+{
+    for (size_t base = begin; base < end; base += 64) {
+        const size_t count = std::min<size_t>(64, end - base);
+        uint64_t bits = 0;
+        for (size_t i = 0; i < count; ++i) {
+            bits |= uint64_t(compare<op>(values[base + i], operand)) << i;
+        }
+        mask[base / 64] &= bits;
+    }
+}
+
+#ifdef MDKLOADER_CATALOG_AVX2
+// Whole words of 64 rows, returns the rows done.
+template<Op op>
+__attribute__((target("avx2"))) size_t filterAvx2(const int64_t *values, const size_t rows, const int64_t operand, uint64_t *mask)
+{
+    const __m256i b = _mm256_set1_epi64x(operand);
+    for (size_t word = 0; word < rows / 64; ++word) {
+        uint64_t bits = 0;
+        for (int j = 0; j < 16; ++j) {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + word * 64 + j * 4));
+            __m256i r;
+            if constexpr ((op == Op::Eq) || (op == Op::Ne)) {
+                r = _mm256_cmpeq_epi64(a, b);
+            } else if constexpr ((op == Op::Gt) || (op == Op::Le)) {
+                r = _mm256_cmpgt_epi64(a, b);
+            } else {
+                r = _mm256_cmpgt_epi64(b, a);
+            }
+            bits |= uint64_t(uint32_t(_mm256_movemask_pd(_mm256_castsi256_pd(r)))) << (j * 4);
+        }
+        // Ne, Le and Ge are the complement of Eq, Gt and Lt.
+        mask[word] &= ((op == Op::Ne) || (op == Op::Le) || (op == Op::Ge)) ? ~bits : bits;
+    }
+    return rows / 64 * 64;
+}
+
+// int32_t, and uint32_t codes which are only compared for equality.
+template<Op op, typename T>
+__attribute__((target("avx2"))) size_t filterAvx2(const T *values, const size_t rows, const T operand, uint64_t *mask)
+{
+    static_assert(sizeof(T) == 4);
+    const __m256i b = _mm256_set1_epi32(static_cast<int32_t>(operand));
+    for (size_t word = 0; word < rows / 64; ++word) {
+        uint64_t bits = 0;
+        for (int j = 0; j < 8; ++j) {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + word * 64 + j * 8));
+            __m256i r;
+            if constexpr ((op == Op::Eq) || (op == Op::Ne)) {
+                r = _mm256_cmpeq_epi32(a, b);
+            } else if constexpr ((op == Op::Gt) || (op == Op::Le)) {
+                r = _mm256_cmpgt_epi32(a, b);
+            } else {
+                r = _mm256_cmpgt_epi32(b, a);
+            }
+            bits |= uint64_t(uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(r)))) << (j * 8);
+        }
+        mask[word] &= ((op == Op::Ne) || (op == Op::Le) || (op == Op::Ge)) ? ~bits : bits;
+    }
+    return rows / 64 * 64;
+}
+
+// Ordered compares, false for NaN like the scalar ones, except Ne.
+template<Op op>
+__attribute__((target("avx2"))) size_t filterAvx2(const float *values, const size_t rows, const float operand, uint64_t *mask)
+{
+    const __m256 b = _mm256_set1_ps(operand);
+    for (size_t word = 0; word < rows / 64; ++word) {
+        uint64_t bits = 0;
+        for (int j = 0; j < 8; ++j) {
+            const __m256 a = _mm256_loadu_ps(values + word * 64 + j * 8);
+            __m256 r;
+            if constexpr (op == Op::Eq) {
+                r = _mm256_cmp_ps(a, b, _CMP_EQ_OQ);
+            } else if constexpr (op == Op::Ne) {
+                r = _mm256_cmp_ps(a, b, _CMP_NEQ_UQ);
+            } else if constexpr (op == Op::Lt) {
+                r = _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+            } else if constexpr (op == Op::Le) {
+                r = _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+            } else if constexpr (op == Op::Gt) {
+                r = _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+            } else {
+                r = _mm256_cmp_ps(a, b, _CMP_GE_OQ);
+            }
+            bits |= uint64_t(uint32_t(_mm256_movemask_ps(r))) << (j * 8);
+        }
+        mask[word] &= bits;
+    }
+    return rows / 64 * 64;
+}
+
+bool hasAvx2()
+{
+    static const bool value = __builtin_cpu_supports("avx2");
+    return value;
+}
+#endif
+
+template<Op op, typename T>
+void filter(const T *values, const size_t rows, const T operand, uint64_t *mask, const bool simd)
+{
+    size_t done = 0;
+#ifdef MDKLOADER_CATALOG_AVX2
+    if (simd && hasAvx2()) {
+        done = filterAvx2<op>(values, rows, operand, mask);
+    }
+#else
+    (void) simd;
+#endif
+    filterScalar<op>(values, done, rows, operand, mask);
+}
+
+template<typename T>
+void filter(const Op op, const T *values, const size_t rows, const T operand, uint64_t *mask, const bool simd)
+{
+    switch (op) {
+    case Op::Eq:
+        return filter<Op::Eq>(values, rows, operand, mask, simd);
+    case Op::Ne:
+        return filter<Op::Ne>(values, rows, operand, mask, simd);
+    case Op::Lt:
+        return filter<Op::Lt>(values, rows, operand, mask, simd);
+    case Op::Le:
+        return filter<Op::Le>(values, rows, operand, mask, simd);
+    case Op::Gt:
+        return filter<Op::Gt>(values, rows, operand, mask, simd);
+    case Op::Ge:
+        return filter<Op::Ge>(values, rows, operand, mask, simd);
+    }
+}
+
+struct Predicate
+{
+    int column;
+    Op op;
+    int64_t integer; // Int32, Int64 and Code
+    float real;
+};
+
+void apply(const Predicate &predicate, const Catalog::RowGroup &group, uint64_t *mask, const bool simd)
+{
+    const size_t rows = group.header.rows[columns[predicate.column].table];
+    switch (columns[predicate.column].type) {
+    case ColumnType::Int32:
+        return filter(predicate.op, group.column<int32_t>(predicate.column), rows, static_cast<int32_t>(predicate.integer), mask, simd);
+    case ColumnType::Int64:
+        return filter(predicate.op, group.column<int64_t>(predicate.column), rows, predicate.integer, mask, simd);
+    case ColumnType::Float:
+        return filter(predicate.op, group.column<float>(predicate.column), rows, predicate.real, mask, simd);
+    case ColumnType::Code:
+        return filter(predicate.op, group.column<uint32_t>(predicate.column), rows, static_cast<uint32_t>(predicate.integer), mask, simd);
+    }
+}
+
+// field, operator and value, e.g. video.width>=3840.
+bool parsePredicate(const char *text, const Catalog &catalog, Predicate &predicate)
+{
+    const std::string_view value(text);
+    const size_t opBegin = value.find_first_of("!<>=");
+    if ((opBegin == std::string_view::npos) || (opBegin == 0)) {
+        return false;
+    }
+    size_t opEnd = opBegin + 1;
+    if ((opEnd < value.size()) && (value[opEnd] == '=')) {
+        ++opEnd;
+    }
+    const std::string_view field = value.substr(0, opBegin);
+    const std::string_view op = value.substr(opBegin, opEnd - opBegin);
+    const std::string operand(value.substr(opEnd));
+    if ((op == "=") || (op == "==")) {
+        predicate.op = Op::Eq;
+    } else if (op == "!=") {
+        predicate.op = Op::Ne;
+    } else if (op == "<") {
+        predicate.op = Op::Lt;
+    } else if (op == "<=") {
+        predicate.op = Op::Le;
+    } else if (op == ">") {
+        predicate.op = Op::Gt;
+    } else if (op == ">=") {
+        predicate.op = Op::Ge;
+    } else {
+        return false;
+    }
+    predicate.column = -1;
+    for (int i = 0; i < Column_Count; ++i) {
+        const std::string_view prefix = tablePrefixes[columns[i].table];
+        if ((field.size() > prefix.size()) && (field.substr(0, prefix.size()) == prefix)
+            && (field.substr(prefix.size()) == columns[i].name)) {
+            predicate.column = i;
+            break;
+        }
+    }
+    if (predicate.column < 0) {
+        return false;
+    }
+    switch (columns[predicate.column].type) {
+    case ColumnType::Code: {
+        if ((predicate.op != Op::Eq) && (predicate.op != Op::Ne)) {
+            return false;
+        }
+        // Not in the dictionary: a code no row has.
+        const auto &dictionary = catalog.dictionary();
+        const auto it = std::find(dictionary.cbegin(), dictionary.cend(), operand);
+        predicate.integer = (it != dictionary.cend()) ? (it - dictionary.cbegin()) : UINT32_MAX;
+        return true;
+    }
+    case ColumnType::Float: {
+        char *end = nullptr;
+        predicate.real = std::strtof(operand.c_str(), &end);
+        return !operand.empty() && !*end;
+    }
+    default: {
+        // Values the column can't hold are rejected, truncated they would compare wrongly.
+        char *end = nullptr;
+        errno = 0;
+        predicate.integer = std::strtoll(operand.c_str(), &end, 10);
+        if (operand.empty() || (end == operand.c_str()) || (errno == ERANGE)) {
+            return false;
+        }
+        for (const char suffix : {'k', 'M', 'G'}) {
+            if (*end == suffix) {
+                const int64_t scale = (suffix == 'k') ? 1000 : ((suffix == 'M') ? 1000000 : 1000000000);
+                if ((predicate.integer > std::numeric_limits<int64_t>::max() / scale)
+                    || (predicate.integer < std::numeric_limits<int64_t>::min() / scale)) {
+                    return false;
+                }
+                predicate.integer *= scale;
+                ++end;
+                break;
+            }
+        }
+        if ((columns[predicate.column].type == ColumnType::Int32)
+            && ((predicate.integer < std::numeric_limits<int32_t>::min())
+                || (predicate.integer > std::numeric_limits<int32_t>::max()))) {
+            return false;
+        }
+        return !*end;
+    }
+    }
+}
+
+int lowestBit(const uint64_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// Paths of the files matching all predicates, one per line. Returns the number of files.
+uint64_t query(const Catalog &catalog, const std::vector<Predicate> &predicates, const bool simd, FILE *out)
+{
+    Table streamTable = Table_Files;
+    for (const Predicate &predicate : predicates) {
+        if (columns[predicate.column].table != Table_Files) {
+            streamTable = columns[predicate.column].table;
+        }
+    }
+    std::vector<uint64_t> files = catalog.liveFiles();
+    for (const Catalog::RowGroup &group : catalog.groups()) {
+        uint64_t *mask = files.data() + group.header.firstRow[Table_Files] / 64;
+        for (const Predicate &predicate : predicates) {
+            if (columns[predicate.column].table == Table_Files) {
+                apply(predicate, group, mask, simd);
+            }
+        }
+    }
+    uint64_t matches = 0;
+    const auto print = [&catalog, out, &matches](const uint64_t row) {
+        if (out) {
+            const std::string_view path = catalog.path(row);
+            std::fwrite(path.data(), 1, path.size(), out);
+            std::fputc('\n', out);
+        }
+        ++matches;
+    };
+    if (streamTable == Table_Files) {
+        for (size_t word = 0; word < files.size(); ++word) {
+            for (uint64_t bits = files[word]; bits; bits &= bits - 1) {
+                print(word * 64 + static_cast<uint64_t>(lowestBit(bits)));
+            }
+        }
+        return matches;
+    }
+    const int fileColumn = (streamTable == Table_Video) ? VideoColumn_file : AudioColumn_file;
+    std::vector<uint64_t> streams;
+    int64_t last = -1;
+    for (const Catalog::RowGroup &group : catalog.groups()) {
+        const uint64_t rows = group.header.rows[streamTable];
+        streams.assign((rows + 63) / 64, ~uint64_t(0));
+        if (rows % 64) {
+            streams.back() = (uint64_t(1) << (rows % 64)) - 1;
+        }
+        for (const Predicate &predicate : predicates) {
+            if (columns[predicate.column].table == streamTable) {
+                apply(predicate, group, streams.data(), simd);
+            }
+        }
+        // The streams of a file are next to each other, a file is listed once.
+        const int32_t *fileRows = group.column<int32_t>(fileColumn);
+        for (size_t word = 0; word < streams.size(); ++word) {
+            for (uint64_t bits = streams[word]; bits; bits &= bits - 1) {
+                const int64_t file = fileRows[word * 64 + static_cast<size_t>(lowestBit(bits))];
+                if ((file != last) && (files[file / 64] & (uint64_t(1) << (file % 64)))) {
+                    print(static_cast<uint64_t>(file));
+                    last = file;
+                }
+            }
+        }
+    }
+    return matches;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const char *catalogFile = nullptr;
+    const char *cacheFile = nullptr;
+    const char *output = nullptr;
+    bool rebuild = false;
+    bool count = false;
+    bool simd = true;
+    bool usage = false;
+    std::vector<const char *> wheres;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = (i + 1) < argc;
+        if (!std::strcmp(argv[i], "--catalog") && hasValue) {
+            catalogFile = argv[++i];
+        } else if (!std::strcmp(argv[i], "--cache") && hasValue) {
+            cacheFile = argv[++i];
+        } else if (!std::strcmp(argv[i], "--output") && hasValue) {
+            output = argv[++i];
+        } else if (!std::strcmp(argv[i], "--where") && hasValue) {
+            wheres.push_back(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--rebuild")) {
+            rebuild = true;
+        } else if (!std::strcmp(argv[i], "--count")) {
+            count = true;
+        } else if (!std::strcmp(argv[i], "--scalar")) {
+            simd = false;
+        } else {
+            usage = true;
+            break;
+        }
+    }
+    if (usage || !catalogFile || (rebuild && !cacheFile)) {
+        std::fprintf(stderr,
+                     "Usage: %s --catalog file [--cache file] [--rebuild] [--where predicate]... "
+                     "[--count] [--scalar] [--output file]\n",
+                     argv[0]);
+        return 1;
+    }
+    const fs::path catalogPath = fs::u8path(catalogFile);
+    std::error_code ec;
+    if (rebuild) {
+        fs::remove(catalogPath, ec);
+    }
+    Catalog catalog;
+    if (!catalog.open(catalogPath)) {
+        std::fprintf(stderr, "Failed to open the catalogue %s\n", catalogFile);
+        return 1;
+    }
+
+    std::string updateJson;
+    if (cacheFile) {
+        const auto start = Clock::now();
+        ProbeCache cache;
+        UpdateResult result;
+        if (!cache.open(fs::u8path(cacheFile))) {
+            std::fprintf(stderr, "Failed to open the cache %s\n", cacheFile);
+            return 1;
+        }
+        if (!update(catalog, cache, result) || !catalog.open(catalogPath)) {
+            std::fprintf(stderr, "Failed to update the catalogue %s\n", catalogFile);
+            return 1;
+        }
+        char buffer[256];
+        std::snprintf(buffer,
+                      sizeof(buffer),
+                      "  \"update\": {\"added\": %llu, \"replaced\": %llu, \"removed\": %llu, \"unchanged\": %llu, \"ms\": %lld},\n",
+                      static_cast<unsigned long long>(result.added),
+                      static_cast<unsigned long long>(result.replaced),
+                      static_cast<unsigned long long>(result.removed),
+                      static_cast<unsigned long long>(result.unchanged),
+                      static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count()));
+        updateJson = buffer;
+    }
+
+    std::vector<Predicate> predicates;
+    Table streamTable = Table_Files;
+    for (const char *where : wheres) {
+        Predicate predicate = {};
+        if (!parsePredicate(where, catalog, predicate)) {
+            std::fprintf(stderr, "Invalid predicate %s\n", where);
+            return 1;
+        }
+        const Table table = columns[predicate.column].table;
+        if ((table != Table_Files) && (streamTable != Table_Files) && (table != streamTable)) {
+            std::fprintf(stderr, "A query can't combine video and audio streams: %s\n", where);
+            return 1;
+        }
+        if (table != Table_Files) {
+            streamTable = table;
+        }
+        predicates.push_back(predicate);
+    }
+    long long queryUs = -1;
+    uint64_t matches = 0;
+    if (!wheres.empty()) {
+        FILE *out = count ? nullptr : (output ? std::fopen(output, "w") : stdout);
+        if (!count && !out) {
+            std::fprintf(stderr, "Failed to open %s\n", output);
+            return 1;
+        }
+        const auto start = Clock::now();
+        matches = query(catalog, predicates, simd, out);
+        queryUs = static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+        if (output && out) {
+            std::fclose(out);
+        } else if (out) {
+            std::fflush(out);
+        }
+    }
+#ifdef MDKLOADER_CATALOG_AVX2
+    const char *kernels = (simd && hasAvx2()) ? "avx2" : "scalar";
+#else
+    const char *kernels = "scalar";
+#endif
+    std::fprintf(stderr,
+                 "{\n%s  \"files\": %llu,\n  \"deleted_files\": %llu,\n  \"video_streams\": %llu,\n"
+                 "  \"audio_streams\": %llu,\n  \"blocks\": %zu,\n  \"dictionary\": %zu,\n",
+                 updateJson.c_str(),
+                 static_cast<unsigned long long>(catalog.rows(Table_Files)),
+                 static_cast<unsigned long long>(catalog.deletedFiles()),
+                 static_cast<unsigned long long>(catalog.rows(Table_Video)),
+                 static_cast<unsigned long long>(catalog.rows(Table_Audio)),
+                 catalog.groups().size(),
+                 catalog.dictionary().size());
+    std::fprintf(stderr,
+                 "  \"kernels\": \"%s\",\n  \"matches\": %llu,\n  \"query_us\": %lld\n}\n",
+                 kernels,
+                 static_cast<unsigned long long>(matches),
+                 queryUs);
+    return 0;
+}
@@ -0,0 +1,837 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2020 by wangwenx190 (Yuhang Zhao)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Probes media files in parallel and prints their MediaInfo as JSON lines, in completion order.
+// A summary goes to stderr as JSON.
+//
+//   mdkloader_probe [--library path] [--cache file] [--threads N] [--timeout ms] [--ext mp4,mkv]
+//                   [--option key=value]... [--checkpoint N] [--retry-failed] [--compact]
+//                   [--quiet] [--output file] path...
+//
+// Directories are walked recursively. Every worker thread reuses one mdk::Player, whose
+// prepare() callback returns false to only read the MediaInfo. The paths are split into one
+// range per worker, an idle worker steals the upper half of the largest range left.
+//
+// Paths are made absolute and normalized, so the same file has the same cache entry whatever
+// the working directory. Results are kept in a cache file keyed by path, size and modification
+// time, see mdkloader_probecache.h. A rescan reads the entries of unchanged files in place, MDK
+// isn't called for them. Failed probes are cached too, --retry-failed probes them again.
+// Timeouts are not cached.
+
+#include "mdkloader_probecache.h"
+#include "mdkloader.h"
+#include "mdk/Player.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace probe;
+using Clock = std::chrono::steady_clock;
+
+// Flattens a MediaInfo, or a failure if info is null, into a CacheEntry.
+class EntryBuilder
+{
+public:
+    std::vector<unsigned char> build(const std::string_view path,
+                                     const int64_t fileSize,
+                                     const int64_t modified,
+                                     const mdk::MediaInfo *info)
+    {
+        CacheEntry entry = {};
+        std::vector<CachedVideoStream> video;
+        std::vector<CachedAudioStream> audio;
+        std::vector<CachedChapter> chapters;
+        metadata_.clear();
+        strings_.clear();
+        size_t fixedSize = sizeof(CacheEntry);
+        if (info) {
+            size_t metadataCount = info->metadata.size();
+            for (const auto &stream : info->video) {
+                metadataCount += stream.metadata.size();
+            }
+            for (const auto &stream : info->audio) {
+                metadataCount += stream.metadata.size();
+            }
+            fixedSize += info->video.size() * sizeof(CachedVideoStream)
+                         + info->audio.size() * sizeof(CachedAudioStream)
+                         + info->chapters.size() * sizeof(CachedChapter)
+                         + metadataCount * sizeof(CachedMetadata);
+        }
+        stringsBase_ = alignUp(fixedSize);
+        entry.hash = hashPath(path);
+        entry.fileSize = fileSize;
+        entry.modified = modified;
+        entry.path = add(path);
+        if (!info) {
+            entry.flags = EntryFlag_Failed;
+        } else {
+            entry.startTime = info->start_time;
+            entry.duration = info->duration;
+            entry.bitRate = info->bit_rate;
+            entry.mediaSize = info->size;
+            entry.format = add(info->format);
+            entry.streams = info->streams;
+            addMetadata(info->metadata);
+            entry.mediaMetadataCount = static_cast<uint32_t>(metadata_.size());
+            for (const auto &stream : info->video) {
+                CachedVideoStream cached = {};
+                cached.startTime = stream.start_time;
+                cached.duration = stream.duration;
+                cached.frames = stream.frames;
+                cached.bitRate = stream.codec.bit_rate;
+                cached.index = stream.index;
+                cached.rotation = stream.rotation;
+                cached.codec = add(stream.codec.codec);
+                cached.formatName = add(stream.codec.format_name);
+                cached.codecTag = stream.codec.codec_tag;
+                cached.profile = stream.codec.profile;
+                cached.level = stream.codec.level;
+                cached.frameRate = stream.codec.frame_rate;
+                cached.format = stream.codec.format;
+                cached.width = stream.codec.width;
+                cached.height = stream.codec.height;
+                cached.bFrames = stream.codec.b_frames;
+                cached.metadataBegin = static_cast<uint32_t>(metadata_.size());
+                cached.metadataCount = addMetadata(stream.metadata);
+                video.push_back(cached);
+            }
+            for (const auto &stream : info->audio) {
+                CachedAudioStream cached = {};
+                cached.startTime = stream.start_time;
+                cached.duration = stream.duration;
+                cached.frames = stream.frames;
+                cached.bitRate = stream.codec.bit_rate;
+                cached.index = stream.index;
+                cached.codec = add(stream.codec.codec);
+                cached.codecTag = stream.codec.codec_tag;
+                cached.profile = stream.codec.profile;
+                cached.level = stream.codec.level;
+                cached.frameRate = stream.codec.frame_rate;
+                cached.isFloat = stream.codec.is_float;
+                cached.isUnsigned = stream.codec.is_unsigned;
+                cached.isPlanar = stream.codec.is_planar;
+                cached.rawSampleSize = stream.codec.raw_sample_size;
+                cached.channels = stream.codec.channels;
+                cached.sampleRate = stream.codec.sample_rate;
+                cached.blockAlign = stream.codec.block_align;
+                cached.frameSize = stream.codec.frame_size;
+                cached.metadataBegin = static_cast<uint32_t>(metadata_.size());
+                cached.metadataCount = addMetadata(stream.metadata);
+                audio.push_back(cached);
+            }
+            for (const auto &chapter : info->chapters) {
+                chapters.push_back({chapter.start_time, chapter.end_time, add(chapter.title)});
+            }
+        }
+        size_t offset = sizeof(CacheEntry);
+        const auto place = [&offset](const size_t count, const size_t size) {
+            const size_t begin = offset;
+            offset += count * size;
+            return static_cast<uint32_t>(begin);
+        };
+        entry.videoOffset = place(video.size(), sizeof(CachedVideoStream));
+        entry.videoCount = static_cast<uint32_t>(video.size());
+        entry.audioOffset = place(audio.size(), sizeof(CachedAudioStream));
+        entry.audioCount = static_cast<uint32_t>(audio.size());
+        entry.chapterOffset = place(chapters.size(), sizeof(CachedChapter));
+        entry.chapterCount = static_cast<uint32_t>(chapters.size());
+        entry.metadataOffset = place(metadata_.size(), sizeof(CachedMetadata));
+        entry.metadataCount = static_cast<uint32_t>(metadata_.size());
+        entry.size = static_cast<uint32_t>(alignUp(stringsBase_ + strings_.size()));
+
+        std::vector<unsigned char> data(entry.size);
+        std::memcpy(data.data(), &entry, sizeof(entry));
+        const auto copy = [&data](const uint32_t at, const auto &values) {
+            if (!values.empty()) {
+                std::memcpy(data.data() + at, values.data(), values.size() * sizeof(values[0]));
+            }
+        };
+        copy(entry.videoOffset, video);
+        copy(entry.audioOffset, audio);
+        copy(entry.chapterOffset, chapters);
+        copy(entry.metadataOffset, metadata_);
+        std::memcpy(data.data() + stringsBase_, strings_.data(), strings_.size());
+        return data;
+    }
+
+private:
+    StringRef add(const std::string_view value)
+    {
+        const StringRef ref = {static_cast<uint32_t>(stringsBase_ + strings_.size()),
+                               static_cast<uint32_t>(value.size())};
+        strings_.append(value).push_back('\0');
+        return ref;
+    }
+
+    StringRef add(const char *value) { return add(std::string_view(value ? value : "")); }
+
+    uint32_t addMetadata(const std::unordered_map<std::string, std::string> &values)
+    {
+        for (const auto &value : values) {
+            metadata_.push_back({add(value.first), add(value.second)});
+        }
+        return static_cast<uint32_t>(values.size());
+    }
+
+    size_t stringsBase_ = 0;
+    std::string strings_;
+    std::vector<CachedMetadata> metadata_;
+};
+
+/// Output
+
+void appendJsonString(std::string &out, const std::string_view value)
+{
+    out.push_back('"');
+    for (const char c : value) {
+        switch (c) {
+        case '"':
+            out.append("\\\"");
+            break;
+        case '\\':
+            out.append("\\\\");
+            break;
+        case '\n':
+            out.append("\\n");
+            break;
+        case '\r':
+            out.append("\\r");
+            break;
+        case '\t':
+            out.append("\\t");
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+                out.append(escaped);
+            } else {
+                out.push_back(c);
+            }
+            break;
+        }
+    }
+    out.push_back('"');
+}
+
+template<typename... Args>
+void appendFormat(std::string &out, const char *format, Args... args)
+{
+    char buffer[256];
+    const int size = std::snprintf(buffer, sizeof(buffer), format, args...);
+    if (size > 0) {
+        out.append(buffer, std::min<size_t>(static_cast<size_t>(size), sizeof(buffer) - 1));
+    }
+}
+
+void appendMetadata(std::string &out, const CacheEntry *entry, const uint32_t begin, const uint32_t count)
+{
+    const CachedMetadata *metadata = array<CachedMetadata>(entry, entry->metadataOffset) + begin;
+    out.append(",\"metadata\":{");
+    for (uint32_t i = 0; i < count; ++i) {
+        if (i) {
+            out.push_back(',');
+        }
+        appendJsonString(out, text(entry, metadata[i].key));
+        out.push_back(':');
+        appendJsonString(out, text(entry, metadata[i].value));
+    }
+    out.push_back('}');
+}
+
+void appendEntry(std::string &out, const CacheEntry *entry, const bool cached)
+{
+    out.append("{\"path\":");
+    appendJsonString(out, text(entry, entry->path));
+    appendFormat(out, ",\"cached\":%s", cached ? "true" : "false");
+    if (entry->flags & EntryFlag_Failed) {
+        out.append(",\"ok\":false,\"error\":\"open\"}\n");
+        return;
+    }
+    out.append(",\"ok\":true,\"format\":");
+    appendJsonString(out, text(entry, entry->format));
+    appendFormat(out,
+                 ",\"start_time\":%lld,\"duration\":%lld,\"bit_rate\":%lld,\"size\":%lld,\"streams\":%d",
+                 static_cast<long long>(entry->startTime),
+                 static_cast<long long>(entry->duration),
+                 static_cast<long long>(entry->bitRate),
+                 static_cast<long long>(entry->mediaSize),
+                 entry->streams);
+    appendMetadata(out, entry, 0, entry->mediaMetadataCount);
+    out.append(",\"chapters\":[");
+    const CachedChapter *chapters = array<CachedChapter>(entry, entry->chapterOffset);
+    for (uint32_t i = 0; i < entry->chapterCount; ++i) {
+        appendFormat(out,
+                     "%s{\"start_time\":%lld,\"end_time\":%lld,\"title\":",
+                     i ? "," : "",
+                     static_cast<long long>(chapters[i].startTime),
+                     static_cast<long long>(chapters[i].endTime));
+        appendJsonString(out, text(entry, chapters[i].title));
+        out.push_back('}');
+    }
+    out.append("],\"video\":[");
+    const CachedVideoStream *video = array<CachedVideoStream>(entry, entry->videoOffset);
+    for (uint32_t i = 0; i < entry->videoCount; ++i) {
+        const CachedVideoStream &stream = video[i];
+        appendFormat(out, "%s{\"index\":%d,\"codec\":", i ? "," : "", stream.index);
+        appendJsonString(out, text(entry, stream.codec));
+        out.append(",\"format_name\":");
+        appendJsonString(out, text(entry, stream.formatName));
+        appendFormat(out,
+                     ",\"width\":%d,\"height\":%d,\"frame_rate\":%g,\"bit_rate\":%lld,\"profile\":%d,"
+                     "\"level\":%d,\"b_frames\":%d,\"rotation\":%d",
+                     stream.width,
+                     stream.height,
+                     static_cast<double>(stream.frameRate),
+                     static_cast<long long>(stream.bitRate),
+                     stream.profile,
+                     stream.level,
+                     stream.bFrames,
+                     stream.rotation);
+        appendFormat(out,
+                     ",\"start_time\":%lld,\"duration\":%lld,\"frames\":%lld",
+                     static_cast<long long>(stream.startTime),
+                     static_cast<long long>(stream.duration),
+                     static_cast<long long>(stream.frames));
+        appendMetadata(out, entry, stream.metadataBegin, stream.metadataCount);
+        out.push_back('}');
+    }
+    out.append("],\"audio\":[");
+    const CachedAudioStream *audio = array<CachedAudioStream>(entry, entry->audioOffset);
+    for (uint32_t i = 0; i < entry->audioCount; ++i) {
+        const CachedAudioStream &stream = audio[i];
+        appendFormat(out, "%s{\"index\":%d,\"codec\":", i ? "," : "", stream.index);
+        appendJsonString(out, text(entry, stream.codec));
+        appendFormat(out,
+                     ",\"sample_rate\":%d,\"channels\":%d,\"bit_rate\":%lld,\"profile\":%d,"
+                     "\"frame_size\":%d,\"is_float\":%s,\"is_planar\":%s",
+                     stream.sampleRate,
+                     stream.channels,
+                     static_cast<long long>(stream.bitRate),
+                     stream.profile,
+                     stream.frameSize,
+                     stream.isFloat ? "true" : "false",
+                     stream.isPlanar ? "true" : "false");
+        appendFormat(out,
+                     ",\"start_time\":%lld,\"duration\":%lld,\"frames\":%lld",
+                     static_cast<long long>(stream.startTime),
+                     static_cast<long long>(stream.duration),
+                     static_cast<long long>(stream.frames));
+        appendMetadata(out, entry, stream.metadataBegin, stream.metadataCount);
+        out.push_back('}');
+    }
+    out.append("]}\n");
+}
+
+/// Probing
+
+struct ProbeOptions
+{
+    unsigned threads = 0;
+    std::chrono::milliseconds timeout = std::chrono::seconds(30);
+    size_t checkpoint = 4096;
+    bool retryFailed = false;
+    bool quiet = false;
+};
+
+struct ProbeCounts
+{
+    std::atomic<uint64_t> cached = {0};
+    std::atomic<uint64_t> probed = {0};
+    std::atomic<uint64_t> failed = {0};
+    std::atomic<uint64_t> timeouts = {0};
+    std::atomic<uint64_t> missing = {0};
+    std::atomic<uint64_t> stolen = {0};
+};
+
+class Prober
+{
+public:
+    // cache can be null. load is called once, by the first worker which has to probe a file.
+    Prober(const std::vector<std::string> &paths,
+           ProbeCache *cache,
+           std::function<bool()> load,
+           const ProbeOptions &options,
+           FILE *out)
+        : paths_(paths)
+        , cache_(cache)
+        , load_(std::move(load))
+        , options_(options)
+        , out_(out)
+        , ranges_(options.threads)
+    {
+        // Contiguous ranges, neighbouring files are likely on the same disk and directory.
+        const size_t count = paths_.size();
+        for (size_t i = 0; i < ranges_.size(); ++i) {
+            ranges_[i].begin = count * i / ranges_.size();
+            ranges_[i].end = count * (i + 1) / ranges_.size();
+        }
+    }
+
+    void run()
+    {
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < options_.threads; ++i) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+        checkpoint(true);
+    }
+
+    const ProbeCounts &counts() const { return counts_; }
+    bool loaded() const { return loaded_; }
+    bool loadFailed() const { return loadFailed_; }
+    uint64_t written() const { return written_; }
+    bool writeFailed() const { return writeFailed_; }
+
+private:
+    struct alignas(64) WorkRange
+    {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    // The callback of a probe only reports to the worker while its generation is current,
+    // the worker moves on after a timeout.
+    struct ProbeState
+    {
+        std::mutex mutex;
+        std::condition_variable cond;
+        uint64_t generation = 0;
+        bool done = false;
+        std::shared_ptr<const mdk::MediaInfo> info;
+    };
+
+    bool next(const unsigned id, size_t &index)
+    {
+        WorkRange &own = ranges_[id];
+        {
+            std::lock_guard<std::mutex> locker(own.mutex);
+            if (own.begin < own.end) {
+                index = own.begin++;
+                return true;
+            }
+        }
+        for (;;) {
+            size_t victim = ranges_.size();
+            size_t largest = 0;
+            for (size_t i = 0; i < ranges_.size(); ++i) {
+                std::lock_guard<std::mutex> locker(ranges_[i].mutex);
+                if ((ranges_[i].end - ranges_[i].begin) > largest) {
+                    largest = ranges_[i].end - ranges_[i].begin;
+                    victim = i;
+                }
+            }
+            if (victim == ranges_.size()) {
+                return false;
+            }
+            size_t begin;
+            size_t end;
+            {
+                std::lock_guard<std::mutex> locker(ranges_[victim].mutex);
+                const size_t left = ranges_[victim].end - ranges_[victim].begin;
+                if (left == 0) {
+                    continue; // taken meanwhile
+                }
+                end = ranges_[victim].end;
+                begin = end - (left + 1) / 2;
+                ranges_[victim].end = begin;
+            }
+            counts_.stolen.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> locker(own.mutex);
+            own.begin = begin + 1;
+            own.end = end;
+            index = begin;
+            return true;
+        }
+    }
+
+    void work(const unsigned id)
+    {
+        std::unique_ptr<mdk::Player> player;
+        ProbeState state;
+        EntryBuilder builder;
+        std::string output;
+        for (size_t index = 0; next(id, index);) {
+            const std::string &path = paths_[index];
+            const fs::path file = fs::u8path(path);
+            std::error_code ec;
+            const auto fileSize = static_cast<int64_t>(fs::file_size(file, ec));
+            const auto modified = ec ? 0 : static_cast<int64_t>(fs::last_write_time(file, ec).time_since_epoch().count());
+            if (ec) {
+                counts_.missing.fetch_add(1, std::memory_order_relaxed);
+                appendError(output, path, "stat");
+                flushOutput(output, false);
+                continue;
+            }
+            const CacheEntry *cached = cache_ ? cache_->find(path, hashPath(path)) : nullptr;
+            if (cached && (cached->fileSize == fileSize) && (cached->modified == modified)
+                && (!(cached->flags & EntryFlag_Failed) || !options_.retryFailed)) {
+                counts_.cached.fetch_add(1, std::memory_order_relaxed);
+                if (!options_.quiet) {
+                    appendEntry(output, cached, true);
+                }
+                flushOutput(output, false);
+                continue;
+            }
+            if (!player) {
+                std::call_once(loadOnce_, [this] {
+                    loaded_ = load_();
+                    loadFailed_ = !loaded_;
+                });
+                if (!loaded_) {
+                    appendError(output, path, "load");
+                    flushOutput(output, false);
+                    continue;
+                }
+                player = std::make_unique<mdk::Player>();
+            }
+            std::shared_ptr<const mdk::MediaInfo> info;
+            if (!probe(*player, state, path, info)) {
+                // The player may still be busy with the file, a new one is faster than waiting.
+                player.reset();
+                counts_.timeouts.fetch_add(1, std::memory_order_relaxed);
+                appendError(output, path, "timeout");
+                flushOutput(output, false);
+                continue;
+            }
+            (info ? counts_.probed : counts_.failed).fetch_add(1, std::memory_order_relaxed);
+            std::vector<unsigned char> entry = builder.build(path, fileSize, modified, info.get());
+            if (!options_.quiet) {
+                appendEntry(output, reinterpret_cast<const CacheEntry *>(entry.data()), false);
+            }
+            flushOutput(output, false);
+            if (cache_) {
+                {
+                    std::lock_guard<std::mutex> locker(pendingMutex_);
+                    pending_.push_back(std::move(entry));
+                }
+                checkpoint(false);
+            }
+        }
+        flushOutput(output, true);
+        // Before state, a late callback must not outlive it.
+        player.reset();
+    }
+
+    // Returns false on timeout. info is null if MDK failed to open the file.
+    bool probe(mdk::Player &player,
+               ProbeState &state,
+               const std::string &path,
+               std::shared_ptr<const mdk::MediaInfo> &info)
+    {
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> locker(state.mutex);
+            generation = ++state.generation;
+            state.done = false;
+            state.info.reset();
+        }
+        player.setMedia(path.c_str());
+        // Reported with the lock held: once the worker sees done it may call prepare() again,
+        // which replaces this callback.
+        player.prepare(0, [&player, &state, generation](int64_t position, bool *) {
+            std::lock_guard<std::mutex> locker(state.mutex);
+            if (state.generation == generation) {
+                if (position >= 0) {
+                    state.info = player.mediaInfoSnapshot();
+                }
+                state.done = true;
+                state.cond.notify_one();
+            }
+            return false;
+        });
+        std::unique_lock<std::mutex> locker(state.mutex);
+        if (!state.cond.wait_for(locker, options_.timeout, [&state] { return state.done; })) {
+            ++state.generation;
+            return false;
+        }
+        info = std::move(state.info);
+        return true;
+    }
+
+    void appendError(std::string &output, const std::string &path, const char *error)
+    {
+        if (options_.quiet) {
+            return;
+        }
+        output.append("{\"path\":");
+        appendJsonString(output, path);
+        appendFormat(output, ",\"cached\":false,\"ok\":false,\"error\":\"%s\"}\n", error);
+    }
+
+    void flushOutput(std::string &output, const bool force)
+    {
+        if (output.empty() || (!force && (output.size() < 65536))) {
+            return;
+        }
+        std::lock_guard<std::mutex> locker(outMutex_);
+        std::fwrite(output.data(), 1, output.size(), out_);
+        output.clear();
+    }
+
+    // Appends the pending entries as a segment once there are enough, or if final.
+    void checkpoint(const bool final)
+    {
+        std::vector<std::vector<unsigned char>> entries;
+        {
+            std::lock_guard<std::mutex> locker(pendingMutex_);
+            if (pending_.empty() || (!final && (pending_.size() < options_.checkpoint))) {
+                return;
+            }
+            entries.swap(pending_);
+        }
+        std::vector<const CacheEntry *> segment;
+        for (const auto &entry : entries) {
+            segment.push_back(reinterpret_cast<const CacheEntry *>(entry.data()));
+        }
+        if (cache_->append(segment)) {
+            written_ += segment.size();
+        } else {
+            writeFailed_ = true;
+        }
+    }
+
+    const std::vector<std::string> &paths_;
+    ProbeCache *const cache_;
+    const std::function<bool()> load_;
+    std::once_flag loadOnce_;
+    std::atomic_bool loaded_ = {false};
+    std::atomic_bool loadFailed_ = {false};
+    const ProbeOptions options_;
+    FILE *const out_;
+    std::vector<WorkRange> ranges_;
+    ProbeCounts counts_;
+    std::mutex outMutex_;
+    std::mutex pendingMutex_;
+    std::vector<std::vector<unsigned char>> pending_;
+    std::atomic<uint64_t> written_ = {0};
+    std::atomic_bool writeFailed_ = {false};
+};
+
+// Files as given, directories walked recursively, all absolute and normalized. Sorted, so that
+// the ranges of the workers follow the directory tree.
+std::vector<std::string> collectPaths(const std::vector<const char *> &inputs,
+                                      const std::vector<std::string> &extensions)
+{
+    const auto wanted = [&extensions](const fs::path &path) {
+        if (extensions.empty()) {
+            return true;
+        }
+        std::string extension = path.extension().u8string();
+        if (!extension.empty()) {
+            extension.erase(0, 1);
+        }
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+        return std::find(extensions.cbegin(), extensions.cend(), extension) != extensions.cend();
+    };
+    std::vector<std::string> paths;
+    for (const char *input : inputs) {
+        std::error_code ec;
+        fs::path path = fs::absolute(fs::u8path(input), ec);
+        if (ec) {
+            std::fprintf(stderr, "Failed to resolve %s: %s\n", input, ec.message().c_str());
+            continue;
+        }
+        path = path.lexically_normal();
+        if (!fs::is_directory(path, ec)) {
+            paths.push_back(path.u8string());
+            continue;
+        }
+        for (auto it = fs::recursive_directory_iterator(path, fs::directory_options::skip_permission_denied, ec);
+             !ec && (it != fs::recursive_directory_iterator());
+             it.increment(ec)) {
+            std::error_code typeError;
+            if (it->is_regular_file(typeError) && wanted(it->path())) {
+                paths.push_back(it->path().u8string());
+            }
+        }
+        if (ec) {
+            std::fprintf(stderr, "Failed to walk %s: %s\n", input, ec.message().c_str());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+    return paths;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const char *library = nullptr;
+    const char *cacheFile = nullptr;
+    const char *output = nullptr;
+    bool compact = false;
+    bool usage = false;
+    ProbeOptions options;
+    std::vector<const char *> inputs;
+    std::vector<std::string> extensions;
+    std::vector<std::pair<std::string, std::string>> globalOptions;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = (i + 1) < argc;
+        if (!std::strcmp(argv[i], "--library") && hasValue) {
+            library = argv[++i];
+        } else if (!std::strcmp(argv[i], "--cache") && hasValue) {
+            cacheFile = argv[++i];
+        } else if (!std::strcmp(argv[i], "--output") && hasValue) {
+            output = argv[++i];
+        } else if (!std::strcmp(argv[i], "--threads") && hasValue) {
+            options.threads = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        } else if (!std::strcmp(argv[i], "--timeout") && hasValue) {
+            options.timeout = std::chrono::milliseconds(std::max(1, std::atoi(argv[++i])));
+        } else if (!std::strcmp(argv[i], "--checkpoint") && hasValue) {
+            options.checkpoint = static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        } else if (!std::strcmp(argv[i], "--ext") && hasValue) {
+            std::string list = argv[++i];
+            std::transform(list.begin(), list.end(), list.begin(), [](unsigned char c) {
+                return static_cast<char>(std::tolower(c));
+            });
+            for (size_t begin = 0; begin <= list.size();) {
+                const size_t end = std::min(list.find(',', begin), list.size());
+                if (end > begin) {
+                    extensions.push_back(list.substr(begin, end - begin));
+                }
+                begin = end + 1;
+            }
+        } else if (!std::strcmp(argv[i], "--option") && hasValue && std::strchr(argv[i + 1], '=')) {
+            const std::string option = argv[++i];
+            const size_t equal = option.find('=');
+            globalOptions.emplace_back(option.substr(0, equal), option.substr(equal + 1));
+        } else if (!std::strcmp(argv[i], "--retry-failed")) {
+            options.retryFailed = true;
+        } else if (!std::strcmp(argv[i], "--compact")) {
+            compact = true;
+        } else if (!std::strcmp(argv[i], "--quiet")) {
+            options.quiet = true;
+        } else if (argv[i][0] != '-') {
+            inputs.push_back(argv[i]);
+        } else {
+            usage = true;
+            break;
+        }
+    }
+    if (usage || (inputs.empty() && !(compact && cacheFile))) {
+        std::fprintf(stderr,
+                     "Usage: %s [--library path] [--cache file] [--threads N] [--timeout ms] "
+                     "[--ext mp4,mkv] [--option key=value]... [--checkpoint N] [--retry-failed] "
+                     "[--compact] [--quiet] [--output file] path...\n",
+                     argv[0]);
+        return 1;
+    }
+    if (options.threads == 0) {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    ProbeCache cache;
+    if (cacheFile && !cache.open(fs::u8path(cacheFile))) {
+        std::fprintf(stderr, "Failed to open the cache %s\n", cacheFile);
+        return 1;
+    }
+    const auto start = Clock::now();
+    const std::vector<std::string> paths = collectPaths(inputs, extensions);
+    FILE *out = output ? std::fopen(output, "w") : stdout;
+    if (!out) {
+        std::fprintf(stderr, "Failed to open %s\n", output);
+        return 1;
+    }
+    options.threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(options.threads, paths.size())));
+    // Not loaded at all if everything is cached.
+    const auto loadMDK = [library, &globalOptions] {
+        // Without --library, $MDKLOADER_LIBRARY, $MDKLOADER_PATH and the library directories.
+        if (!(library ? mdkloader_load(library) : mdkloader_loadDiscovered(nullptr, nullptr, nullptr))) {
+            return false;
+        }
+        MDK_setLogLevel(MDK_LogLevel_Warning);
+        for (const auto &option : globalOptions) {
+            MDK_setGlobalOptionString(option.first.c_str(), option.second.c_str());
+        }
+        return true;
+    };
+    Prober prober(paths, cacheFile ? &cache : nullptr, loadMDK, options, out);
+    prober.run();
+    const ProbeCounts &counts = prober.counts();
+    bool writeFailed = prober.writeFailed();
+    if (output) {
+        std::fclose(out);
+    } else {
+        std::fflush(out);
+    }
+    bool compacted = false;
+    if (cacheFile && (compact || (cache.segments() > maxSegments))) {
+        compacted = cache.compact();
+        writeFailed = writeFailed || !compacted;
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+    std::fprintf(stderr,
+                 "{\n  \"files\": %zu,\n  \"cached\": %llu,\n  \"probed\": %llu,\n  \"failed\": %llu,\n"
+                 "  \"timeouts\": %llu,\n  \"missing\": %llu,\n  \"threads\": %u,\n  \"steals\": %llu,\n",
+                 paths.size(),
+                 static_cast<unsigned long long>(counts.cached),
+                 static_cast<unsigned long long>(counts.probed),
+                 static_cast<unsigned long long>(counts.failed),
+                 static_cast<unsigned long long>(counts.timeouts),
+                 static_cast<unsigned long long>(counts.missing),
+                 options.threads,
+                 static_cast<unsigned long long>(counts.stolen));
+    std::fprintf(stderr,
+                 "  \"cache_entries_written\": %llu,\n  \"cache_segments\": %zu,\n  \"compacted\": %s,\n"
+                 "  \"elapsed_ms\": %lld,\n  \"files_per_second\": %.1f\n}\n",
+                 static_cast<unsigned long long>(prober.written()),
+                 cache.segments(),
+                 compacted ? "true" : "false",
+                 static_cast<long long>(elapsed),
+                 elapsed > 0 ? paths.size() * 1000.0 / elapsed : 0.0);
+    if (prober.loaded()) {
+        mdkloader_cleanup();
+    }
+    if (prober.loadFailed()) {
+        std::fprintf(stderr, "Failed to load %s\n", library ? library : "MDK");
+        return 1;
+    }
+    if (writeFailed) {
+        std::fprintf(stderr, "Failed to write the cache %s\n", cacheFile);
+        return 1;
+    }
+    return 0;
+}
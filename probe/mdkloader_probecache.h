@@ -0,0 +1,638 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2020 by wangwenx190 (Yuhang Zhao)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// The result cache of mdkloader_probe, also read by mdkloader_catalog.
+//
+// A header followed by segments. Every run appends its new results as a segment, every
+// --checkpoint results, so an interrupted scan keeps most of its work:
+//
+//   CacheFileHeader
+//   segment: SegmentHeader, CacheEntry..., Bucket[buckets], segmentEnd
+//
+// Entries are self-contained, all their offsets are relative to the entry, and are read in
+// place from the mapping. The buckets are an open addressing table of path hashes, lookups go
+// from the newest segment to the oldest and the first entry of a path wins. A torn last segment
+// is cut off on open. Once there are more than maxSegments, or with --compact, the file is
+// rewritten with the latest entries only. The byte order and layout are the native ones,
+// another machine starts over.
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace probe {
+
+namespace fs = std::filesystem;
+
+/// Cache layout
+
+inline constexpr char cacheMagic[8] = {'M', 'D', 'K', 'P', 'R', 'O', 'B', 'E'};
+inline constexpr uint32_t cacheVersion = 1;
+inline constexpr uint32_t cacheByteOrder = 0x01020304;
+inline constexpr uint64_t segmentEnd = 0x444e45474553444dull; // "MDSEGEND" on little endian
+inline constexpr size_t maxSegments = 16;
+
+struct CacheFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+};
+
+struct SegmentHeader
+{
+    uint64_t size; // including the header and segmentEnd
+    uint64_t entries;
+    uint64_t buckets; // a power of 2
+    uint64_t table; // offset of the buckets
+};
+
+struct Bucket
+{
+    uint64_t hash;
+    uint64_t entry; // offset in the segment, 0 if empty
+};
+
+// Offset relative to the entry, the text is null terminated.
+struct StringRef
+{
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct CachedMetadata
+{
+    StringRef key;
+    StringRef value;
+};
+
+struct CachedChapter
+{
+    int64_t startTime;
+    int64_t endTime;
+    StringRef title;
+};
+
+// extra_data is not cached.
+struct CachedVideoStream
+{
+    int64_t startTime;
+    int64_t duration;
+    int64_t frames;
+    int64_t bitRate;
+    int32_t index;
+    int32_t rotation;
+    StringRef codec;
+    StringRef formatName;
+    uint32_t codecTag;
+    int32_t profile;
+    int32_t level;
+    float frameRate;
+    int32_t format;
+    int32_t width;
+    int32_t height;
+    int32_t bFrames;
+    uint32_t metadataBegin;
+    uint32_t metadataCount;
+};
+
+struct CachedAudioStream
+{
+    int64_t startTime;
+    int64_t duration;
+    int64_t frames;
+    int64_t bitRate;
+    int32_t index;
+    StringRef codec;
+    uint32_t codecTag;
+    int32_t profile;
+    int32_t level;
+    float frameRate;
+    uint8_t isFloat;
+    uint8_t isUnsigned;
+    uint8_t isPlanar;
+    int32_t rawSampleSize;
+    int32_t channels;
+    int32_t sampleRate;
+    int32_t blockAlign;
+    int32_t frameSize;
+    uint32_t metadataBegin;
+    uint32_t metadataCount;
+};
+
+enum EntryFlag : uint32_t {
+    EntryFlag_Failed = 1, // MDK could not open the file
+};
+
+// Followed by the arrays and the strings it refers to.
+struct CacheEntry
+{
+    uint64_t hash; // of the path
+    int64_t fileSize;
+    int64_t modified; // fs::file_time_type ticks
+    uint32_t size; // of the whole entry, a multiple of 8
+    uint32_t flags;
+    StringRef path;
+    int64_t startTime;
+    int64_t duration;
+    int64_t bitRate;
+    int64_t mediaSize;
+    StringRef format;
+    int32_t streams;
+    uint32_t videoOffset;
+    uint32_t videoCount;
+    uint32_t audioOffset;
+    uint32_t audioCount;
+    uint32_t chapterOffset;
+    uint32_t chapterCount;
+    uint32_t metadataOffset;
+    uint32_t metadataCount; // of the media and all streams
+    uint32_t mediaMetadataCount; // the first ones
+};
+
+static_assert(std::is_trivially_copyable_v<CacheEntry> && (alignof(CacheEntry) == 8));
+static_assert((sizeof(SegmentHeader) % 8) == 0 && (sizeof(CacheFileHeader) % 8) == 0);
+
+inline size_t alignUp(const size_t value)
+{
+    return (value + 7) & ~size_t(7);
+}
+
+inline uint64_t hashPath(const std::string_view path)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char c : path) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+inline std::string_view text(const CacheEntry *entry, const StringRef value)
+{
+    return {reinterpret_cast<const char *>(entry) + value.offset, value.size};
+}
+
+template<typename T>
+inline const T *array(const CacheEntry *entry, const uint32_t offset)
+{
+    return reinterpret_cast<const T *>(reinterpret_cast<const unsigned char *>(entry) + offset);
+}
+
+/// Cache file
+
+// Read only mapping of a whole file.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const fs::path &path)
+    {
+        close();
+#ifdef _WIN32
+        const HANDLE file = CreateFileW(path.c_str(),
+                                        GENERIC_READ,
+                                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                        nullptr,
+                                        OPEN_EXISTING,
+                                        FILE_ATTRIBUTE_NORMAL,
+                                        nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER size = {};
+        if (!GetFileSizeEx(file, &size) || (size.QuadPart == 0)) {
+            CloseHandle(file);
+            return size.QuadPart == 0;
+        }
+        const HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping) {
+            return false;
+        }
+        data_ = static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+        if (!data_) {
+            return false;
+        }
+        size_ = static_cast<size_t>(size.QuadPart);
+#else
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info = {};
+        if ((fstat(fd, &info) != 0) || (info.st_size == 0)) {
+            ::close(fd);
+            return info.st_size == 0;
+        }
+        void *data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        data_ = static_cast<const unsigned char *>(data);
+        size_ = static_cast<size_t>(info.st_size);
+#endif
+        return true;
+    }
+
+    void close()
+    {
+        if (!data_) {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+#else
+        munmap(const_cast<unsigned char *>(data_), size_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    const unsigned char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const unsigned char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+inline std::vector<unsigned char> buildSegment(const std::vector<const CacheEntry *> &entries)
+{
+    size_t entriesSize = 0;
+    for (const CacheEntry *entry : entries) {
+        entriesSize += entry->size;
+    }
+    uint64_t buckets = 1;
+    while (buckets < (entries.size() * 2)) {
+        buckets *= 2;
+    }
+    SegmentHeader header = {};
+    header.entries = entries.size();
+    header.buckets = buckets;
+    header.table = sizeof(SegmentHeader) + entriesSize;
+    header.size = header.table + buckets * sizeof(Bucket) + sizeof(segmentEnd);
+
+    std::vector<unsigned char> data(header.size);
+    std::memcpy(data.data(), &header, sizeof(header));
+    auto table = reinterpret_cast<Bucket *>(data.data() + header.table);
+    size_t offset = sizeof(SegmentHeader);
+    for (const CacheEntry *entry : entries) {
+        std::memcpy(data.data() + offset, entry, entry->size);
+        uint64_t bucket = entry->hash & (buckets - 1);
+        while (table[bucket].entry) {
+            bucket = (bucket + 1) & (buckets - 1);
+        }
+        table[bucket] = {entry->hash, offset};
+        offset += entry->size;
+    }
+    std::memcpy(data.data() + header.size - sizeof(segmentEnd), &segmentEnd, sizeof(segmentEnd));
+    return data;
+}
+
+// find() is thread safe, and so is append() which adds segments behind the mapping. The
+// entries appended are not visible to find(), they are newer than what is looked up anyway.
+// Exclusive lock of a file, waiting for other processes which hold it. Runs sharing a cache
+// lock <cache>.lock, the cache itself is replaced by compact().
+class FileLock
+{
+public:
+    explicit FileLock(const fs::path &path)
+    {
+#ifdef _WIN32
+        handle_ = CreateFileW(path.c_str(),
+                              GENERIC_READ | GENERIC_WRITE,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr,
+                              OPEN_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+        OVERLAPPED overlapped = {};
+        if ((handle_ != INVALID_HANDLE_VALUE)
+            && !LockFileEx(handle_, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped)) {
+            CloseHandle(handle_);
+            handle_ = INVALID_HANDLE_VALUE;
+        }
+#else
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        int result = -1;
+        while ((fd_ >= 0) && ((result = flock(fd_, LOCK_EX)) != 0) && (errno == EINTR)) {
+        }
+        if ((fd_ >= 0) && (result != 0)) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+#endif
+    }
+    FileLock(const FileLock &) = delete;
+    FileLock &operator=(const FileLock &) = delete;
+
+    // Closing releases the lock.
+    ~FileLock()
+    {
+#ifdef _WIN32
+        if (handle_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(handle_);
+        }
+#else
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+#endif
+    }
+
+    bool locked() const
+    {
+#ifdef _WIN32
+        return handle_ != INVALID_HANDLE_VALUE;
+#else
+        return fd_ >= 0;
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE handle_ = INVALID_HANDLE_VALUE;
+#else
+    int fd_ = -1;
+#endif
+};
+
+inline unsigned long currentProcessId()
+{
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return static_cast<unsigned long>(getpid());
+#endif
+}
+
+// Several runs may share a cache: appending, truncating a torn tail and compacting are done
+// under a FileLock, so that they see each other's complete segments only.
+class ProbeCache
+{
+public:
+    bool open(const fs::path &path)
+    {
+        path_ = path;
+        std::error_code ec;
+        if (!fs::exists(path_, ec)) {
+            return !ec;
+        }
+        // Not locked on a read only medium, a torn tail is left alone then.
+        const FileLock lock(lockPath());
+        if (!file_.open(path_)) {
+            return false;
+        }
+        const size_t validSize = scan();
+        if ((validSize == 0) && (file_.size() > 0)) {
+            std::fprintf(stderr, "%s is not a cache of this build and machine\n", path_.u8string().c_str());
+            return false;
+        }
+        if ((validSize < file_.size()) && lock.locked()) {
+            // A torn segment of an interrupted run.
+            file_.close();
+            segments_.clear();
+            fs::resize_file(path_, validSize, ec);
+            if (ec || !file_.open(path_)) {
+                return false;
+            }
+            scan();
+        }
+        return true;
+    }
+
+    const CacheEntry *find(const std::string_view path, const uint64_t hash) const
+    {
+        for (auto it = segments_.crbegin(); it != segments_.crend(); ++it) {
+            const unsigned char *segment = *it;
+            SegmentHeader header;
+            std::memcpy(&header, segment, sizeof(header));
+            const auto table = reinterpret_cast<const Bucket *>(segment + header.table);
+            for (uint64_t bucket = hash & (header.buckets - 1); table[bucket].entry;
+                 bucket = (bucket + 1) & (header.buckets - 1)) {
+                if (table[bucket].hash != hash) {
+                    continue;
+                }
+                const auto entry = reinterpret_cast<const CacheEntry *>(segment + table[bucket].entry);
+                if (text(entry, entry->path) == path) {
+                    return entry;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    bool append(const std::vector<const CacheEntry *> &entries)
+    {
+        if (entries.empty()) {
+            return true;
+        }
+        const std::vector<unsigned char> segment = buildSegment(entries);
+        std::lock_guard<std::mutex> locker(appendMutex_);
+        const FileLock lock(lockPath());
+        if (!lock.locked() || !write(path_, segment)) {
+            return false;
+        }
+        ++appended_;
+        return true;
+    }
+
+    size_t segments() const { return segments_.size() + appended_; }
+
+    // Calls f(const CacheEntry *) for the latest entry of every path in the mapping, newest first.
+    // The paths of a segment are unique, only the ones of the newer segments are remembered.
+    template<typename F>
+    void forEachLatest(F f) const
+    {
+        std::unordered_multimap<uint64_t, const CacheEntry *> newer;
+        for (auto it = segments_.crbegin(); it != segments_.crend(); ++it) {
+            const bool oldest = (it + 1) == segments_.crend();
+            SegmentHeader header;
+            std::memcpy(&header, *it, sizeof(header));
+            for (uint64_t offset = sizeof(SegmentHeader); offset < header.table;) {
+                const auto entry = reinterpret_cast<const CacheEntry *>(*it + offset);
+                offset += entry->size;
+                const auto range = newer.equal_range(entry->hash);
+                if (std::any_of(range.first, range.second, [entry](const auto &value) {
+                        return text(value.second, value.second->path) == text(entry, entry->path);
+                    })) {
+                    continue;
+                }
+                f(entry);
+                if (!oldest) {
+                    newer.emplace(entry->hash, entry);
+                }
+            }
+        }
+    }
+
+    // Rewrites the file with the latest entry of every path, including the ones other runs
+    // appended meanwhile. Unmaps the file, so the entries found before are invalid afterwards.
+    bool compact()
+    {
+        const FileLock lock(lockPath());
+        if (!lock.locked()) {
+            return false;
+        }
+        file_.close();
+        segments_.clear();
+        appended_ = 0;
+        std::error_code ec;
+        if (!fs::exists(path_, ec)) {
+            return true;
+        }
+        if (!file_.open(path_)) {
+            return false;
+        }
+        scan();
+        std::vector<const CacheEntry *> latest;
+        forEachLatest([&latest](const CacheEntry *entry) { latest.push_back(entry); });
+        if (latest.empty()) {
+            return true;
+        }
+        fs::path temporary = path_;
+        temporary += "." + std::to_string(currentProcessId()) + ".tmp";
+        if (!write(temporary, buildSegment(latest))) {
+            fs::remove(temporary, ec);
+            return false;
+        }
+        file_.close();
+        segments_.clear();
+        fs::rename(temporary, path_, ec);
+        if (ec) {
+            fs::remove(temporary, ec);
+            return false;
+        }
+        if (!file_.open(path_)) {
+            return false;
+        }
+        scan();
+        return true;
+    }
+
+private:
+    fs::path lockPath() const
+    {
+        fs::path path = path_;
+        path += ".lock";
+        return path;
+    }
+
+    // Appends a segment to the file at path, with the file header if it's empty.
+    static bool write(const fs::path &path, const std::vector<unsigned char> &segment)
+    {
+        std::error_code ec;
+        const bool created = !fs::exists(path, ec) || (fs::file_size(path, ec) == 0);
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        if (created) {
+            CacheFileHeader header = {};
+            std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+            header.version = cacheVersion;
+            header.byteOrder = cacheByteOrder;
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        }
+        out.write(reinterpret_cast<const char *>(segment.data()),
+                  static_cast<std::streamsize>(segment.size()));
+        out.flush();
+        return static_cast<bool>(out);
+    }
+
+    // Collects the complete segments, returns the size of the valid part of the file.
+    size_t scan()
+    {
+        segments_.clear();
+        const unsigned char *data = file_.data();
+        const size_t size = file_.size();
+        CacheFileHeader header;
+        if (size < sizeof(header)) {
+            return 0;
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) || (header.version != cacheVersion)
+            || (header.byteOrder != cacheByteOrder)) {
+            return 0;
+        }
+        size_t offset = sizeof(header);
+        while ((size - offset) >= sizeof(SegmentHeader)) {
+            SegmentHeader segment;
+            std::memcpy(&segment, data + offset, sizeof(segment));
+            uint64_t end = 0;
+            const bool complete = (segment.size <= (size - offset)) && ((segment.size % 8) == 0)
+                                  && (segment.buckets > 0)
+                                  && ((segment.buckets & (segment.buckets - 1)) == 0)
+                                  && (segment.table >= sizeof(SegmentHeader))
+                                  && (segment.table + segment.buckets * sizeof(Bucket) + sizeof(end)
+                                      == segment.size);
+            if (!complete) {
+                break;
+            }
+            std::memcpy(&end, data + offset + segment.size - sizeof(end), sizeof(end));
+            if (end != segmentEnd) {
+                break;
+            }
+            segments_.push_back(data + offset);
+            offset += segment.size;
+        }
+        return offset;
+    }
+
+    fs::path path_;
+    MappedFile file_;
+    std::vector<const unsigned char *> segments_;
+    std::mutex appendMutex_;
+    size_t appended_ = 0;
+};
+
+} // namespace probe
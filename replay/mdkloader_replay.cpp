@@ -0,0 +1,102 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2020 by wangwenx190 (Yuhang Zhao)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Replays a capture of mdkloader_captureFlush() against the stub MDK, or any other MDK
+// library, and prints the result as JSON.
+//
+//   mdkloader_replay [--library path] [--original-timing] [--repeat N] capture.bin
+//
+// As fast as possible by default, so that the duration of a fixed capture tracks the
+// overhead of the loader and of MDK. With --original-timing every recorded thread is
+// replayed on a thread of its own, at the recorded times.
+
+#include "mdkloader.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+int main(int argc, char *argv[])
+{
+    const char *library = MDKLOADER_REPLAY_STUB;
+    const char *capture = nullptr;
+    int repeat = 1;
+    mdkloaderReplayOptions options = {};
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = (i + 1) < argc;
+        if (!std::strcmp(argv[i], "--library") && hasValue) {
+            library = argv[++i];
+        } else if (!std::strcmp(argv[i], "--original-timing")) {
+            options.originalTiming = true;
+        } else if (!std::strcmp(argv[i], "--repeat") && hasValue) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (!capture && (argv[i][0] != '-')) {
+            capture = argv[i];
+        } else {
+            capture = nullptr;
+            break;
+        }
+    }
+    if (!capture) {
+        std::fprintf(stderr,
+                     "Usage: %s [--library path] [--original-timing] [--repeat N] capture.bin\n",
+                     argv[0]);
+        return 1;
+    }
+    if (!mdkloader_load(library)) {
+        std::fprintf(stderr, "Failed to load %s\n", library);
+        return 1;
+    }
+
+    mdkloaderReplayResult result = {};
+    std::vector<long long> durations;
+    for (int i = 0; i < repeat; ++i) {
+        if (!mdkloader_replay(capture, &options, &result)) {
+            std::fprintf(stderr, "Failed to replay %s\n", capture);
+            mdkloader_cleanup();
+            return 1;
+        }
+        durations.push_back(static_cast<long long>(result.duration));
+    }
+    mdkloader_cleanup();
+
+    std::sort(durations.begin(), durations.end());
+    std::printf("{\n  \"capture\": \"%s\",\n  \"library\": \"%s\",\n  \"original_timing\": %s,\n",
+                capture,
+                library,
+                options.originalTiming ? "true" : "false");
+    std::printf("  \"threads\": %d,\n  \"calls\": %llu,\n  \"skipped\": %llu,\n  \"dropped\": %llu,\n",
+                result.threads,
+                static_cast<unsigned long long>(result.calls),
+                static_cast<unsigned long long>(result.skipped),
+                static_cast<unsigned long long>(result.dropped));
+    std::printf("  \"duration_us\": {\"median\": %lld, \"min\": %lld, \"max\": %lld, \"samples\": %zu},\n",
+                durations[durations.size() / 2],
+                durations.front(),
+                durations.back(),
+                durations.size());
+    std::printf("  \"max_lateness_us\": %lld\n}\n", static_cast<long long>(result.maxLateness));
+    return 0;
+}
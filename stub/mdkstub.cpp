@@ -0,0 +1,1308 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2020 by wangwenx190 (Yuhang Zhao)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// A synthetic MDK implementing the C ABI of mdk/c/*.h without any real media.
+// Players "decode" a generated stream and deliver frames with real plane
+// buffers through onVideo at the configured resolution, pixel format and
+// rate, report MediaInfo with metadata, and emit events. Latency and faults
+// are injected deterministically, so that the loader and any frame processing
+// code can be benchmarked on a plain machine.
+//
+// Options, from lowest to highest priority:
+// - built-in defaults
+// - global options: MDK_setGlobalOptionString/Int32("stub.<name>", value)
+// - the query of the media url: setMedia("stub://clip?width=1280&fps=60")
+//
+//   width, height     frame size (1920x1080)
+//   format            pixel format name, e.g. yuv420p, nv12, rgba (yuv420p)
+//   fps               frame rate, 0 to deliver frames as fast as possible (30)
+//   duration          media duration in ms (10000)
+//   fill              write a pattern into every frame, 0 or 1 (0)
+//   metadata          number of extra MediaInfo metadata entries (4)
+//   open_ms           latency of prepare() in ms (0)
+//   seek_ms           latency of a seek in ms (0)
+//   decode_us         CPU time burnt per frame in us (0)
+//   fail_open         prepare() fails, 0 or 1 (0)
+//   fail_seek         every seek fails, 0 or 1 (0)
+//   drop_every        every Nth frame fails to decode and is dropped (0, never)
+//
+// Global only:
+//   stub.call_ns          CPU time burnt by every exported function in ns (0)
+//   stub.frame_fail_every every Nth mdkVideoFrameAPI_new() returns null (0, never)
+//
+// Objects remember the MDKSTUB_VERSION of the build which created them,
+// releasing them with another build aborts.
+
+#include "mdk/c/MediaInfo.h"
+#include "mdk/c/Player.h"
+#include "mdk/c/VideoFrame.h"
+#include "mdk/c/global.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef MDKSTUB_VERSION
+#define MDKSTUB_VERSION MDK_VERSION
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+void busyWait(const std::chrono::nanoseconds duration)
+{
+    if (duration.count() <= 0) {
+        return;
+    }
+    const auto end = Clock::now() + duration;
+    while (Clock::now() < end) {
+    }
+}
+
+std::atomic<int64_t> callLatency = {0};
+std::atomic<int64_t> frameFailEvery = {0};
+std::atomic<int64_t> frameAllocations = {0};
+
+// Every exported function starts with this.
+void simulateCall()
+{
+    busyWait(std::chrono::nanoseconds(callLatency.load(std::memory_order_relaxed)));
+}
+
+std::mutex logMutex;
+mdkLogHandler logHandler = {};
+std::atomic<MDK_LogLevel> logLevel = {MDK_LogLevel_Info};
+
+void log(const MDK_LogLevel level, const char *message)
+{
+    if (level > logLevel.load(std::memory_order_relaxed)) {
+        return;
+    }
+    std::lock_guard<std::mutex> locker(logMutex);
+    if (logHandler.cb) {
+        logHandler.cb(level, message, logHandler.opaque);
+    }
+}
+
+struct FormatInfo
+{
+    const char *name;
+    MDK_PixelFormat format;
+    int planes;
+    int bytesPerPixel[4];
+    // log2 of the subsampling of each plane
+    int shiftX[4];
+    int shiftY[4];
+};
+
+const FormatInfo formatInfos[] = {
+    {"yuv420p", MDK_PixelFormat_YUV420P, 3, {1, 1, 1}, {0, 1, 1}, {0, 1, 1}},
+    {"nv12", MDK_PixelFormat_NV12, 2, {1, 2}, {0, 1}, {0, 1}},
+    {"yuv422p", MDK_PixelFormat_YUV422P, 3, {1, 1, 1}, {0, 1, 1}, {0, 0, 0}},
+    {"yuv444p", MDK_PixelFormat_YUV444P, 3, {1, 1, 1}, {0, 0, 0}, {0, 0, 0}},
+    {"p010le", MDK_PixelFormat_P010LE, 2, {2, 4}, {0, 1}, {0, 1}},
+    {"p016le", MDK_PixelFormat_P016LE, 2, {2, 4}, {0, 1}, {0, 1}},
+    {"yuv420p10le", MDK_PixelFormat_YUV420P10LE, 3, {2, 2, 2}, {0, 1, 1}, {0, 1, 1}},
+    {"uyvy422", MDK_PixelFormat_UYVY422, 1, {2}, {0}, {0}},
+    {"rgb24", MDK_PixelFormat_RGB24, 1, {3}, {0}, {0}},
+    {"rgba", MDK_PixelFormat_RGBA, 1, {4}, {0}, {0}},
+    {"rgbx", MDK_PixelFormat_RGBX, 1, {4}, {0}, {0}},
+    {"bgra", MDK_PixelFormat_BGRA, 1, {4}, {0}, {0}},
+    {"bgrx", MDK_PixelFormat_BGRX, 1, {4}, {0}, {0}},
+    {"rgb565le", MDK_PixelFormat_RGB565LE, 1, {2}, {0}, {0}},
+    {"rgb48le", MDK_PixelFormat_RGB48LE, 1, {6}, {0}, {0}},
+    {"gbrp", MDK_PixelFormat_GBRP, 3, {1, 1, 1}, {0, 0, 0}, {0, 0, 0}},
+    {"gbrp10le", MDK_PixelFormat_GBRP10LE, 3, {2, 2, 2}, {0, 0, 0}, {0, 0, 0}},
+    {"xyz12le", MDK_PixelFormat_XYZ12LE, 1, {6}, {0}, {0}},
+};
+
+const FormatInfo *findFormat(const MDK_PixelFormat format)
+{
+    for (const FormatInfo &info : formatInfos) {
+        if (info.format == format) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+const FormatInfo *findFormat(const std::string &name)
+{
+    for (const FormatInfo &info : formatInfos) {
+        if (name == info.name) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+/// VideoFrame
+
+struct AlignedFree
+{
+    void operator()(uint8_t *data) const { ::operator delete[](data, std::align_val_t(64)); }
+};
+
+struct StubFrame
+{
+    struct Plane
+    {
+        const uint8_t *data = nullptr;
+        int stride = 0;
+        // Either owned, or a user buffer released through its deleter.
+        std::unique_ptr<uint8_t[], AlignedFree> owned;
+        void *buf = nullptr;
+        void (*bufDeleter)(void **pBuf) = nullptr;
+
+        void reset()
+        {
+            if (bufDeleter) {
+                bufDeleter(&buf);
+            }
+            *this = {};
+        }
+    };
+
+    ~StubFrame()
+    {
+        for (Plane &plane : planes) {
+            plane.reset();
+        }
+    }
+
+    int planeWidth(const int plane) const
+    {
+        if ((plane < 0) || !info) {
+            return width;
+        }
+        const int shift = info->shiftX[plane];
+        return (width + (1 << shift) - 1) >> shift;
+    }
+
+    int planeHeight(const int plane) const
+    {
+        if ((plane < 0) || !info) {
+            return height;
+        }
+        const int shift = info->shiftY[plane];
+        return (height + (1 << shift) - 1) >> shift;
+    }
+
+    void allocate()
+    {
+        if (!info || (width <= 0) || (height <= 0)) {
+            return;
+        }
+        for (int i = 0; i < info->planes; ++i) {
+            Plane &plane = planes[i];
+            plane.reset();
+            // Rows aligned to 64 bytes like a real decoder would.
+            plane.stride = ((planeWidth(i) * info->bytesPerPixel[i]) + 63) & ~63;
+            const size_t size = static_cast<size_t>(plane.stride) * planeHeight(i);
+            plane.owned.reset(new (std::align_val_t(64)) uint8_t[size]);
+            plane.data = plane.owned.get();
+        }
+    }
+
+    mdkVideoFrameAPI api = {};
+    int version = MDKSTUB_VERSION;
+    int width = 0;
+    int height = 0;
+    MDK_PixelFormat format = MDK_PixelFormat_Unknown;
+    const FormatInfo *info = nullptr;
+    double timestamp = -1;
+    Plane planes[4];
+};
+
+StubFrame *frameOf(mdkVideoFrame *object)
+{
+    return reinterpret_cast<StubFrame *>(object);
+}
+
+mdkVideoFrameAPI *createFrame(int width, int height, MDK_PixelFormat format);
+
+mdkVideoFrameAPI *convertFrame(mdkVideoFrame *object, MDK_PixelFormat format, int width, int height)
+{
+    const StubFrame *source = frameOf(object);
+    mdkVideoFrameAPI *api = createFrame((width > 0) ? width : source->width,
+                                        (height > 0) ? height : source->height,
+                                        format);
+    StubFrame *frame = frameOf(api->object);
+    frame->timestamp = source->timestamp;
+    if ((frame->format == source->format) && (frame->width == source->width)
+        && (frame->height == source->height) && frame->info) {
+        for (int i = 0; i < frame->info->planes; ++i) {
+            if (!source->planes[i].data) {
+                continue;
+            }
+            const int rowSize = std::min(frame->planes[i].stride, source->planes[i].stride);
+            for (int row = 0; row < frame->planeHeight(i); ++row) {
+                std::memcpy(frame->planes[i].owned.get() + (row * frame->planes[i].stride),
+                            source->planes[i].data + (row * source->planes[i].stride),
+                            rowSize);
+            }
+        }
+    }
+    // Otherwise the planes are left as allocated, there is no pixel conversion.
+    return api;
+}
+
+mdkVideoFrameAPI *createFrame(int width, int height, MDK_PixelFormat format)
+{
+    auto frame = new StubFrame;
+    frame->width = std::max(width, 0);
+    frame->height = std::max(height, 0);
+    frame->format = format;
+    frame->info = findFormat(format);
+    frame->allocate();
+
+    mdkVideoFrameAPI &api = frame->api;
+    api.object = reinterpret_cast<mdkVideoFrame *>(frame);
+    api.planeCount = [](mdkVideoFrame *object) {
+        const StubFrame *frame = frameOf(object);
+        return frame->info ? frame->info->planes : 0;
+    };
+    api.width = [](mdkVideoFrame *object, int plane) { return frameOf(object)->planeWidth(plane); };
+    api.height = [](mdkVideoFrame *object, int plane) { return frameOf(object)->planeHeight(plane); };
+    api.format = [](mdkVideoFrame *object) { return frameOf(object)->format; };
+    api.addBuffer = [](mdkVideoFrame *object,
+                       const uint8_t *data,
+                       int stride,
+                       void *buf,
+                       void (*bufDeleter)(void **pBuf),
+                       int plane) {
+        StubFrame *frame = frameOf(object);
+        if (plane < 0) {
+            // The first plane without data.
+            for (plane = 0; (plane < 4) && frame->planes[plane].data; ++plane) {
+            }
+        }
+        if ((plane >= 4) || !data) {
+            return false;
+        }
+        StubFrame::Plane &target = frame->planes[plane];
+        target.reset();
+        target.data = data;
+        target.stride = (stride > 0) ? stride : (frame->planeWidth(plane) * (frame->info ? frame->info->bytesPerPixel[plane] : 1));
+        target.buf = buf;
+        target.bufDeleter = bufDeleter;
+        return true;
+    };
+    api.setBuffers = [](mdkVideoFrame *object, uint8_t const **const data, int *strides) {
+        StubFrame *frame = frameOf(object);
+        const int planes = frame->info ? frame->info->planes : 0;
+        for (int i = 0; i < planes; ++i) {
+            StubFrame::Plane &plane = frame->planes[i];
+            plane.reset();
+            plane.data = data ? data[i] : nullptr;
+            plane.stride = (strides && (strides[i] > 0))
+                               ? strides[i]
+                               : (frame->planeWidth(i) * frame->info->bytesPerPixel[i]);
+            if (strides) {
+                strides[i] = plane.stride;
+            }
+        }
+    };
+    api.bufferData = [](mdkVideoFrame *object, int plane) -> const uint8_t * {
+        return ((plane >= 0) && (plane < 4)) ? frameOf(object)->planes[plane].data : nullptr;
+    };
+    api.bytesPerLine = [](mdkVideoFrame *object, int plane) {
+        return ((plane >= 0) && (plane < 4)) ? frameOf(object)->planes[plane].stride : 0;
+    };
+    api.setTimestamp = [](mdkVideoFrame *object, double t) { frameOf(object)->timestamp = t; };
+    api.timestamp = [](mdkVideoFrame *object) { return frameOf(object)->timestamp; };
+    api.to = convertFrame;
+    api.toHost = [](mdkVideoFrame *object) {
+        return convertFrame(object, frameOf(object)->format, -1, -1);
+    };
+    api.fromGL = []() -> mdkVideoFrameAPI * { return nullptr; };
+    api.fromMetal = []() -> mdkVideoFrameAPI * { return nullptr; };
+    api.fromD3D11 = []() -> mdkVideoFrameAPI * { return nullptr; };
+    api.fromVk = []() -> mdkVideoFrameAPI * { return nullptr; };
+    return &api;
+}
+
+void destroyFrame(mdkVideoFrameAPI **value)
+{
+    if (!value || !*value) {
+        return;
+    }
+    StubFrame *frame = frameOf((*value)->object);
+    if (frame->version != MDKSTUB_VERSION) {
+        std::abort();
+    }
+    delete frame;
+    *value = nullptr;
+}
+
+/// Options and MediaInfo
+
+struct StubConfig
+{
+    int width = 1920;
+    int height = 1080;
+    const FormatInfo *format = &formatInfos[0];
+    double fps = 30;
+    int64_t duration = 10000;
+    bool fill = false;
+    int metadata = 4;
+    int64_t openLatency = 0;
+    int64_t seekLatency = 0;
+    int64_t decodeCost = 0;
+    bool failOpen = false;
+    bool failSeek = false;
+    int64_t dropEvery = 0;
+};
+
+std::mutex globalOptionsMutex;
+std::map<std::string, std::string> globalOptions;
+
+void applyOption(StubConfig &config, const std::string &key, const std::string &value)
+{
+    const long long number = std::atoll(value.c_str());
+    if (key == "width") {
+        config.width = static_cast<int>(number);
+    } else if (key == "height") {
+        config.height = static_cast<int>(number);
+    } else if (key == "format") {
+        if (const FormatInfo *format = findFormat(value)) {
+            config.format = format;
+        }
+    } else if (key == "fps") {
+        config.fps = std::atof(value.c_str());
+    } else if (key == "duration") {
+        config.duration = number;
+    } else if (key == "fill") {
+        config.fill = (number != 0);
+    } else if (key == "metadata") {
+        config.metadata = static_cast<int>(number);
+    } else if (key == "open_ms") {
+        config.openLatency = number;
+    } else if (key == "seek_ms") {
+        config.seekLatency = number;
+    } else if (key == "decode_us") {
+        config.decodeCost = number;
+    } else if (key == "fail_open") {
+        config.failOpen = (number != 0);
+    } else if (key == "fail_seek") {
+        config.failSeek = (number != 0);
+    } else if (key == "drop_every") {
+        config.dropEvery = number;
+    }
+}
+
+StubConfig configFor(const std::string &url)
+{
+    StubConfig config;
+    {
+        std::lock_guard<std::mutex> locker(globalOptionsMutex);
+        for (const auto &option : globalOptions) {
+            if (option.first.compare(0, 5, "stub.") == 0) {
+                applyOption(config, option.first.substr(5), option.second);
+            }
+        }
+    }
+    const size_t query = url.find('?');
+    if (query == std::string::npos) {
+        return config;
+    }
+    size_t begin = query + 1;
+    while (begin < url.size()) {
+        size_t end = url.find('&', begin);
+        if (end == std::string::npos) {
+            end = url.size();
+        }
+        const std::string pair = url.substr(begin, end - begin);
+        const size_t equal = pair.find('=');
+        if (equal != std::string::npos) {
+            applyOption(config, pair.substr(0, equal), pair.substr(equal + 1));
+        }
+        begin = end + 1;
+    }
+    return config;
+}
+
+using Metadata = std::vector<std::pair<std::string, std::string>>;
+
+// See mdkStringMapEntry: priv is the index of the next entry plus one.
+bool findMetadata(const Metadata *metadata, mdkStringMapEntry *entry)
+{
+    simulateCall();
+    if (!metadata || !entry) {
+        return false;
+    }
+    size_t index = 0;
+    if (entry->priv) {
+        index = reinterpret_cast<uintptr_t>(entry->priv);
+    } else if (entry->key) {
+        for (; (index < metadata->size()) && ((*metadata)[index].first != entry->key); ++index) {
+        }
+    }
+    if (index >= metadata->size()) {
+        return false;
+    }
+    entry->key = (*metadata)[index].first.c_str();
+    entry->value = (*metadata)[index].second.c_str();
+    entry->priv = reinterpret_cast<void *>(static_cast<uintptr_t>(index + 1));
+    return true;
+}
+
+// Pointed to by the priv members of the MediaInfo structs.
+struct StubStream
+{
+    Metadata metadata;
+    StubConfig config;
+};
+
+struct StubMedia
+{
+    explicit StubMedia(const std::string &url, const StubConfig &config)
+    {
+        media.metadata = {{"title", url}, {"encoder", "mdkstub"}};
+        for (int i = 0; i < config.metadata; ++i) {
+            media.metadata.emplace_back("key" + std::to_string(i), "value" + std::to_string(i));
+        }
+        media.config = config;
+        video.metadata = {{"language", "und"}, {"handler_name", "VideoHandler"}};
+        video.config = config;
+        audio.metadata = {{"language", "und"}, {"handler_name", "SoundHandler"}};
+        audio.config = config;
+
+        const auto frames = static_cast<int64_t>(config.duration * config.fps / 1000.0);
+        videoInfo.index = 0;
+        videoInfo.duration = config.duration;
+        videoInfo.frames = frames;
+        videoInfo.priv = &video;
+        audioInfo.index = 1;
+        audioInfo.duration = config.duration;
+        audioInfo.frames = config.duration * 48000 / 1000 / 1024;
+        audioInfo.priv = &audio;
+        info.duration = config.duration;
+        info.bit_rate = static_cast<int64_t>(config.width) * config.height * 12 / 100
+                        * static_cast<int64_t>(std::max(config.fps, 1.0));
+        info.size = info.bit_rate / 8 * config.duration / 1000;
+        info.format = "stub";
+        info.streams = 2;
+        info.video = &videoInfo;
+        info.nb_video = 1;
+        info.audio = &audioInfo;
+        info.nb_audio = 1;
+        info.priv = &media;
+    }
+
+    StubStream media;
+    StubStream video;
+    StubStream audio;
+    mdkVideoStreamInfo videoInfo = {};
+    mdkAudioStreamInfo audioInfo = {};
+    mdkMediaInfo info = {};
+};
+
+/// Player
+
+// mdk/Player.h always sets cb, a null opaque means there is no callback.
+template<typename Callback>
+bool isSet(const Callback &callback)
+{
+    return callback.cb && callback.opaque;
+}
+
+struct StubPlayer
+{
+    ~StubPlayer() { stop(true); }
+
+    bool onWorkerThread() const { return worker.get_id() == std::this_thread::get_id(); }
+
+    // Must not be called with mutex held. Joins the worker unless called
+    // from it, e.g. from a callback.
+    void stop(const bool join)
+    {
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            quit = true;
+        }
+        cond.notify_all();
+        if (join && worker.joinable() && !onWorkerThread()) {
+            worker.join();
+        }
+    }
+
+    void setState(const MDK_State value)
+    {
+        mdkStateChangedCallback callback = {};
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            if (state == value) {
+                return;
+            }
+            state = value;
+            callback = stateCallback;
+        }
+        cond.notify_all();
+        if (isSet(callback)) {
+            callback.cb(value, callback.opaque);
+        }
+    }
+
+    void setStatus(const MDK_MediaStatus value)
+    {
+        std::vector<mdkMediaStatusChangedCallback> callbacks;
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            status = value;
+            callbacks = statusCallbacks;
+        }
+        for (const mdkMediaStatusChangedCallback &callback : callbacks) {
+            callback.cb(value, callback.opaque);
+        }
+    }
+
+    void sendEvent(const int64_t error, const char *category, const char *detail)
+    {
+        mdkMediaEvent event = {};
+        event.error = error;
+        event.category = category;
+        event.detail = detail;
+        event.decoder.stream = 0;
+        std::vector<mdkMediaEventCallback> callbacks;
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            for (const auto &callback : eventCallbacks) {
+                callbacks.push_back(callback.second);
+            }
+        }
+        for (const mdkMediaEventCallback &callback : callbacks) {
+            if (callback.cb(&event, callback.opaque)) {
+                break;
+            }
+        }
+    }
+
+    // Sleeps, but wakes up for quit.
+    bool sleepFor(const int64_t ms)
+    {
+        std::unique_lock<std::mutex> locker(mutex);
+        return !cond.wait_for(locker, std::chrono::milliseconds(ms), [this] { return quit; });
+    }
+
+    void startWorker(const int64_t startPosition, const mdkPrepareCallback prepareCallback)
+    {
+        stop(true);
+        if (worker.joinable()) {
+            // prepare() from a callback of the previous worker.
+            worker.detach();
+        }
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            quit = false;
+            seekPending = false;
+            snapshotPending = false;
+            frameIndex = 0;
+        }
+        worker = std::thread([this, startPosition, prepareCallback] {
+            run(startPosition, prepareCallback);
+        });
+    }
+
+    void run(const int64_t startPosition, const mdkPrepareCallback prepareCallback)
+    {
+        setStatus(MDK_MediaStatus_Loading);
+        if ((config.openLatency > 0) && !sleepFor(config.openLatency)) {
+            return;
+        }
+        if (config.failOpen) {
+            log(MDK_LogLevel_Warning, "mdkstub: injected open failure");
+            setStatus(MDK_MediaStatus_Invalid);
+            sendEvent(-1, "reader.open", "injected fault");
+            if (isSet(prepareCallback)) {
+                bool boost = true;
+                prepareCallback.cb(-1, &boost, prepareCallback.opaque);
+            }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            media = std::make_unique<StubMedia>(url, config);
+            position = std::max<int64_t>(0, std::min(startPosition, config.duration));
+        }
+        setStatus(MDK_MediaStatus(MDK_MediaStatus_Loaded | MDK_MediaStatus_Prepared));
+        sendEvent(0, "decoder.video", "mdkstub");
+        sendEvent(100, "reader.buffering", "");
+        if (isSet(prepareCallback)) {
+            bool boost = true;
+            if (!prepareCallback.cb(position, &boost, prepareCallback.opaque)) {
+                setStatus(MDK_MediaStatus_Unloaded);
+                return;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            if (state != MDK_State_Playing) {
+                state = MDK_State_Paused;
+            }
+        }
+        decodeLoop();
+    }
+
+    void decodeLoop()
+    {
+        auto nextFrame = Clock::now();
+        for (;;) {
+            std::unique_lock<std::mutex> locker(mutex);
+            const auto ready = [this] {
+                return quit || seekPending || snapshotPending || (state == MDK_State_Playing);
+            };
+            cond.wait(locker, ready);
+            if (quit) {
+                return;
+            }
+            if (seekPending) {
+                seekPending = false;
+                const int64_t target = seekTarget;
+                const mdkSeekCallback callback = seekCallback;
+                locker.unlock();
+                performSeek(target, callback);
+                nextFrame = Clock::now();
+                continue;
+            }
+            if (snapshotPending) {
+                snapshotPending = false;
+                locker.unlock();
+                performSnapshot();
+                continue;
+            }
+            // Playing. Wait for the frame time, unless interrupted.
+            if ((config.fps > 0)
+                && cond.wait_until(locker, nextFrame, [this] {
+                       return quit || seekPending || snapshotPending || (state != MDK_State_Playing);
+                   })) {
+                continue;
+            }
+            const double interval = (config.fps > 0) ? (1000.0 / (config.fps * rate)) : 0.0;
+            const int64_t timestamp = position;
+            locker.unlock();
+            if (timestamp >= config.duration) {
+                setStatus(MDK_MediaStatus_End);
+                setState(MDK_State_Stopped);
+                return;
+            }
+            deliverFrame(timestamp);
+            nextFrame += std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double, std::milli>(interval));
+            if (Clock::now() > (nextFrame + std::chrono::milliseconds(100))) {
+                // Too far behind, e.g. after being paused. Don't burst.
+                nextFrame = Clock::now();
+            }
+            const auto step = static_cast<int64_t>(1000.0 / std::max(config.fps, 1.0));
+            std::lock_guard<std::mutex> positionLocker(mutex);
+            if (position == timestamp) {
+                position = timestamp + std::max<int64_t>(step, 1);
+            }
+        }
+    }
+
+    void deliverFrame(const int64_t timestamp)
+    {
+        busyWait(std::chrono::microseconds(config.decodeCost));
+        const int64_t index = ++frameIndex;
+        if ((config.dropEvery > 0) && ((index % config.dropEvery) == 0)) {
+            sendEvent(-1, "decoder.video", "injected fault");
+            return;
+        }
+        mdkVideoFrameAPI *frame = createFrame(config.width, config.height, config.format->format);
+        StubFrame *stubFrame = frameOf(frame->object);
+        stubFrame->timestamp = timestamp / 1000.0;
+        if (config.fill) {
+            for (int i = 0; i < config.format->planes; ++i) {
+                const StubFrame::Plane &plane = stubFrame->planes[i];
+                std::memset(plane.owned.get(),
+                            static_cast<int>((index + i * 64) & 0xff),
+                            static_cast<size_t>(plane.stride) * stubFrame->planeHeight(i));
+            }
+        }
+        mdkVideoCallback callback;
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            callback = videoCallback;
+            lastFrameTime = stubFrame->timestamp;
+        }
+        if (isSet(callback)) {
+            callback.cb(&frame, 0, callback.opaque);
+        }
+        // Rendered and released. The callback may have replaced the frame.
+        destroyFrame(&frame);
+    }
+
+    void performSeek(const int64_t target, const mdkSeekCallback callback)
+    {
+        const MDK_MediaStatus previous = status;
+        setStatus(MDK_MediaStatus(previous | MDK_MediaStatus_Seeking));
+        if ((config.seekLatency > 0) && !sleepFor(config.seekLatency)) {
+            return;
+        }
+        int64_t result = -1;
+        if (!config.failSeek) {
+            std::lock_guard<std::mutex> locker(mutex);
+            position = std::max<int64_t>(0, std::min(target, config.duration));
+            result = position;
+        } else {
+            log(MDK_LogLevel_Warning, "mdkstub: injected seek failure");
+        }
+        setStatus(previous);
+        if (isSet(callback)) {
+            callback.cb(result, callback.opaque);
+        }
+    }
+
+    void performSnapshot()
+    {
+        mdkSnapshotRequest request;
+        mdkSnapshotCallback callback;
+        double frameTime;
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            request = snapshotRequest;
+            callback = snapshotCallback;
+            frameTime = lastFrameTime;
+        }
+        runSnapshot(request, callback, frameTime, config.width, config.height);
+    }
+
+    static void runSnapshot(mdkSnapshotRequest request,
+                            const mdkSnapshotCallback callback,
+                            const double frameTime,
+                            const int width,
+                            const int height)
+    {
+        if (!isSet(callback)) {
+            return;
+        }
+        std::unique_ptr<uint8_t[]> buffer;
+        if (!request.data) {
+            request.width = (request.width > 0) ? request.width : width;
+            request.height = (request.height > 0) ? request.height : height;
+            request.stride = request.width * 4;
+            buffer.reset(new uint8_t[static_cast<size_t>(request.stride) * request.height]());
+            request.data = buffer.get();
+        }
+        const bool valid = (request.width > 0) && (request.height > 0);
+        std::free(callback.cb(valid ? &request : nullptr, frameTime, callback.opaque));
+    }
+
+    mdkPlayerAPI api = {};
+    int version = MDKSTUB_VERSION;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread worker;
+    bool quit = false;
+
+    std::string url;
+    StubConfig config;
+    std::unique_ptr<StubMedia> media;
+    MDK_State state = MDK_State_Stopped;
+    MDK_MediaStatus status = MDK_MediaStatus_NoMedia;
+    int64_t position = 0;
+    float rate = 1;
+    int64_t frameIndex = 0;
+    double lastFrameTime = -1;
+
+    bool seekPending = false;
+    int64_t seekTarget = 0;
+    mdkSeekCallback seekCallback = {};
+    bool snapshotPending = false;
+    mdkSnapshotRequest snapshotRequest = {};
+    mdkSnapshotCallback snapshotCallback = {};
+
+    mdkCurrentMediaChangedCallback mediaChangedCallback = {};
+    mdkStateChangedCallback stateCallback = {};
+    std::vector<mdkMediaStatusChangedCallback> statusCallbacks; // added like MDK does, cleared by a null one
+    mdkVideoCallback videoCallback = {};
+    mdkRenderCallback renderCallback = {};
+    std::map<MDK_CallbackToken, mdkMediaEventCallback> eventCallbacks;
+    MDK_CallbackToken nextToken = 1;
+    std::map<std::string, std::string> properties;
+};
+
+StubPlayer *playerOf(mdkPlayer *object)
+{
+    return reinterpret_cast<StubPlayer *>(object);
+}
+
+bool seekPlayer(mdkPlayer *object, int64_t pos, MDK_SeekFlag flags, mdkSeekCallback cb)
+{
+    StubPlayer *player = playerOf(object);
+    mdkSeekCallback skipped = {};
+    {
+        std::lock_guard<std::mutex> locker(player->mutex);
+        if (!player->worker.joinable() || player->quit) {
+            return false;
+        }
+        if (player->seekPending) {
+            skipped = player->seekCallback;
+        }
+        player->seekPending = true;
+        player->seekTarget = (flags & MDK_SeekFlag_FromNow) ? (player->position + pos) : pos;
+        player->seekCallback = cb;
+    }
+    player->cond.notify_all();
+    // The unfinished previous seek is skipped.
+    if (isSet(skipped)) {
+        skipped.cb(-2, skipped.opaque);
+    }
+    return true;
+}
+
+void prepareMedia(mdkPlayer *object, int64_t startPosition, mdkPrepareCallback cb, MDKSeekFlag)
+{
+    StubPlayer *player = playerOf(object);
+    {
+        std::lock_guard<std::mutex> locker(player->mutex);
+        player->config = configFor(player->url);
+    }
+    player->startWorker(startPosition, cb);
+}
+
+void setPlayerState(mdkPlayer *object, MDK_State value)
+{
+    StubPlayer *player = playerOf(object);
+    if (value == MDK_State_Stopped) {
+        player->stop(true);
+        player->setState(MDK_State_Stopped);
+        return;
+    }
+    bool running;
+    {
+        std::lock_guard<std::mutex> locker(player->mutex);
+        running = player->worker.joinable() && !player->quit;
+    }
+    if (!running) {
+        // Playing without prepare() loads the media first.
+        prepareMedia(object, 0, {}, MDK_SeekFlag_Default);
+    }
+    player->setState(value);
+}
+
+const mdkPlayerAPI *createPlayer()
+{
+    auto player = new StubPlayer;
+    mdkPlayerAPI &api = player->api;
+    api.object = reinterpret_cast<mdkPlayer *>(player);
+    api.setMute = [](mdkPlayer *, bool) {};
+    api.setVolume = [](mdkPlayer *, float) {};
+    api.setMedia = [](mdkPlayer *object, const char *url) {
+        StubPlayer *player = playerOf(object);
+        mdkCurrentMediaChangedCallback callback;
+        {
+            std::lock_guard<std::mutex> locker(player->mutex);
+            player->url = url ? url : "";
+            callback = player->mediaChangedCallback;
+        }
+        if (isSet(callback)) {
+            callback.cb(callback.opaque);
+        }
+    };
+    api.setMediaForType = [](mdkPlayer *, const char *, MDK_MediaType) {};
+    api.url = [](mdkPlayer *object) -> const char * {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        return player->url.c_str();
+    };
+    api.setPreloadImmediately = [](mdkPlayer *, bool) {};
+    api.setNextMedia = [](mdkPlayer *, const char *, int64_t, MDKSeekFlag) {};
+    api.currentMediaChanged = [](mdkPlayer *object, mdkCurrentMediaChangedCallback cb) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        player->mediaChangedCallback = cb;
+    };
+    api.setAudioBackends = [](mdkPlayer *, const char **) {};
+    api.setAudioDecoders = [](mdkPlayer *, const char **) {};
+    api.setVideoDecoders = [](mdkPlayer *, const char **) {};
+    api.setTimeout = [](mdkPlayer *, int64_t, mdkTimeoutCallback) {};
+    api.prepare = prepareMedia;
+    api.mediaInfo = [](mdkPlayer *object) -> const mdkMediaInfo * {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        return player->media ? &player->media->info : nullptr;
+    };
+    api.setState = setPlayerState;
+    api.state = [](mdkPlayer *object) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        return player->state;
+    };
+    api.onStateChanged = [](mdkPlayer *object, mdkStateChangedCallback cb) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        player->stateCallback = cb;
+    };
+    api.waitFor = [](mdkPlayer *object, MDK_State value, long timeout) {
+        StubPlayer *player = playerOf(object);
+        std::unique_lock<std::mutex> locker(player->mutex);
+        const auto reached = [player, value] { return player->state == value; };
+        if (timeout < 0) {
+            player->cond.wait(locker, reached);
+            return true;
+        }
+        return player->cond.wait_for(locker, std::chrono::milliseconds(timeout), reached);
+    };
+    api.mediaStatus = [](mdkPlayer *object) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        return player->status;
+    };
+    api.onMediaStatusChanged = [](mdkPlayer *object, mdkMediaStatusChangedCallback cb) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        if (isSet(cb)) {
+            player->statusCallbacks.push_back(cb);
+        } else {
+            player->statusCallbacks.clear();
+        }
+    };
+    api.updateNativeSurface = [](mdkPlayer *, void *, int, int, MDK_SurfaceType) {};
+    api.createSurface = [](mdkPlayer *, void *, MDK_SurfaceType) {};
+    api.resizeSurface = [](mdkPlayer *, int, int) {};
+    api.showSurface = [](mdkPlayer *) {};
+    api.getVideoFrame = []() {};
+    api.setVideoSurfaceSize = [](mdkPlayer *, int, int, void *) {};
+    api.setVideoViewport = [](mdkPlayer *, float, float, float, float, void *) {};
+    api.setAspectRatio = [](mdkPlayer *, float, void *) {};
+    api.rotate = [](mdkPlayer *, int, void *) {};
+    api.scale = [](mdkPlayer *, float, float, void *) {};
+    api.renderVideo = [](mdkPlayer *object, void *) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        return player->lastFrameTime;
+    };
+    api.setBackgroundColor = [](mdkPlayer *, float, float, float, float, void *) {};
+    api.setRenderCallback = [](mdkPlayer *object, mdkRenderCallback cb) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        player->renderCallback = cb;
+    };
+    api.onVideo = [](mdkPlayer *object, mdkVideoCallback cb) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        player->videoCallback = cb;
+    };
+    api.onAudio = [](mdkPlayer *) {};
+    api.beforeVideoRender = [](mdkPlayer *, void (*)(mdkVideoFrameAPI *, void *)) {};
+    api.afterVideoRender = [](mdkPlayer *, void (*)(mdkVideoFrameAPI *, void *)) {};
+    api.position = [](mdkPlayer *object) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        return player->position;
+    };
+    api.seekWithFlags = seekPlayer;
+    api.seek = [](mdkPlayer *object, int64_t pos, mdkSeekCallback cb) {
+        return seekPlayer(object, pos, MDK_SeekFlag_Default, cb);
+    };
+    api.setPlaybackRate = [](mdkPlayer *object, float value) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        player->rate = (value > 0) ? value : 1;
+    };
+    api.playbackRate = [](mdkPlayer *object) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        return player->rate;
+    };
+    api.buffered = [](mdkPlayer *, int64_t *bytes) -> int64_t {
+        if (bytes) {
+            *bytes = 0;
+        }
+        return 0;
+    };
+    api.switchBitrate = [](mdkPlayer *, const char *, int64_t, SwitchBitrateCallback cb) {
+        if (isSet(cb)) {
+            cb.cb(false, cb.opaque);
+        }
+    };
+    api.switchBitrateSingleConnection = [](mdkPlayer *, const char *, SwitchBitrateCallback) {
+        return false;
+    };
+    api.onEvent = [](mdkPlayer *object, mdkMediaEventCallback cb, MDK_CallbackToken *token) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        if (!cb.cb) {
+            if (token) {
+                player->eventCallbacks.erase(*token);
+            } else {
+                player->eventCallbacks.clear();
+            }
+            return;
+        }
+        const MDK_CallbackToken key = player->nextToken++;
+        player->eventCallbacks[key] = cb;
+        if (token) {
+            *token = key;
+        }
+    };
+    api.setBufferRange = [](mdkPlayer *, int64_t, int64_t, bool) {};
+    api.snapshot = [](mdkPlayer *object,
+                      mdkSnapshotRequest *request,
+                      mdkSnapshotCallback cb,
+                      void *) {
+        StubPlayer *player = playerOf(object);
+        const mdkSnapshotRequest value = request ? *request : mdkSnapshotRequest{};
+        {
+            std::lock_guard<std::mutex> locker(player->mutex);
+            if (player->worker.joinable() && !player->quit) {
+                player->snapshotPending = true;
+                player->snapshotRequest = value;
+                player->snapshotCallback = cb;
+                player->cond.notify_all();
+                return;
+            }
+        }
+        // Nothing loaded, fail on a thread of its own as the callback expects.
+        std::thread([cb] {
+            if (isSet(cb)) {
+                std::free(cb.cb(nullptr, -1, cb.opaque));
+            }
+        }).join();
+    };
+    api.setProperty = [](mdkPlayer *object, const char *key, const char *value) {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        if (key) {
+            player->properties[key] = value ? value : "";
+        }
+    };
+    api.getProperty = [](mdkPlayer *object, const char *key) -> const char * {
+        StubPlayer *player = playerOf(object);
+        std::lock_guard<std::mutex> locker(player->mutex);
+        const auto it = key ? player->properties.find(key) : player->properties.end();
+        return (it != player->properties.end()) ? it->second.c_str() : nullptr;
+    };
+    api.record = [](mdkPlayer *, const char *, const char *) {};
+    api.setLoopRange = [](mdkPlayer *, int, int64_t, int64_t) {};
+    api.setLoop = [](mdkPlayer *, int) {};
+    api.onLoop = [](mdkPlayer *, mdkLoopCallback, MDK_CallbackToken *token) {
+        if (token) {
+            *token = 0;
+        }
+    };
+    api.setRange = [](mdkPlayer *, int64_t, int64_t) {};
+    api.setRenderAPI = [](mdkPlayer *, mdkRenderAPI *, void *) {};
+    api.renderAPI = [](mdkPlayer *, void *) -> mdkRenderAPI * { return nullptr; };
+    api.mapPoint = [](mdkPlayer *, MDK_MapDirection, float *, float *, float *, void *) {};
+    api.onSync = [](mdkPlayer *, mdkSyncCallback, int) {};
+    api.setVideoEffect = [](mdkPlayer *, MDK_VideoEffect, const float *, void *) {};
+    return &api;
+}
+
+} // namespace
+
+extern "C" {
+
+int MDK_version()
+{
+    simulateCall();
+    return MDKSTUB_VERSION;
+}
+
+void *MDK_javaVM(void *vm)
+{
+    simulateCall();
+    return vm;
+}
+
+void MDK_setLogLevel(MDK_LogLevel value)
+{
+    simulateCall();
+    logLevel.store(value, std::memory_order_relaxed);
+}
+
+MDK_LogLevel MDK_logLevel()
+{
+    simulateCall();
+    return logLevel.load(std::memory_order_relaxed);
+}
+
+void MDK_setLogHandler(mdkLogHandler handler)
+{
+    simulateCall();
+    std::lock_guard<std::mutex> locker(logMutex);
+    logHandler = handler;
+}
+
+void MDK_setGlobalOptionString(const char *key, const char *value)
+{
+    simulateCall();
+    if (!key) {
+        return;
+    }
+    const std::string name = key;
+    const long long number = value ? std::atoll(value) : 0;
+    if (name == "stub.call_ns") {
+        callLatency.store(number, std::memory_order_relaxed);
+    } else if (name == "stub.frame_fail_every") {
+        frameFailEvery.store(number, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> locker(globalOptionsMutex);
+    globalOptions[name] = value ? value : "";
+}
+
+void MDK_setGlobalOptionInt32(const char *key, int value)
+{
+    MDK_setGlobalOptionString(key, std::to_string(value).c_str());
+}
+
+void MDK_setGlobalOptionPtr(const char *, void *)
+{
+    simulateCall();
+}
+
+char *MDK_strdup(const char *strSource)
+{
+    simulateCall();
+    if (!strSource) {
+        return nullptr;
+    }
+    const size_t size = std::strlen(strSource) + 1;
+    auto copy = static_cast<char *>(std::malloc(size));
+    if (copy) {
+        std::memcpy(copy, strSource, size);
+    }
+    return copy;
+}
+
+void MDK_AudioStreamCodecParameters(const mdkAudioStreamInfo *asi, mdkAudioCodecParameters *p)
+{
+    simulateCall();
+    if (!p) {
+        return;
+    }
+    // The C++ API passes a struct without the reserved tail.
+    std::memset(p, 0, offsetof(mdkAudioCodecParameters, reserved));
+    if (!asi || !asi->priv) {
+        return;
+    }
+    p->codec = "pcm_f32le";
+    p->bit_rate = 48000 * 2 * 32;
+    p->is_float = true;
+    p->raw_sample_size = 4;
+    p->channels = 2;
+    p->sample_rate = 48000;
+    p->block_align = 8;
+    p->frame_size = 1024;
+}
+
+bool MDK_AudioStreamMetadata(const mdkAudioStreamInfo *asi, mdkStringMapEntry *sme)
+{
+    return findMetadata(asi && asi->priv ? &static_cast<const StubStream *>(asi->priv)->metadata
+                                         : nullptr,
+                        sme);
+}
+
+void MDK_VideoStreamCodecParameters(const mdkVideoStreamInfo *vsi, mdkVideoCodecParameters *p)
+{
+    simulateCall();
+    if (!p) {
+        return;
+    }
+    std::memset(p, 0, offsetof(mdkVideoCodecParameters, reserved));
+    if (!vsi || !vsi->priv) {
+        return;
+    }
+    const StubConfig &config = static_cast<const StubStream *>(vsi->priv)->config;
+    p->codec = "mdkstub";
+    p->bit_rate = static_cast<int64_t>(config.width) * config.height * 12 / 100;
+    p->frame_rate = static_cast<float>(config.fps);
+    p->format = config.format->format;
+    p->format_name = config.format->name;
+    p->width = config.width;
+    p->height = config.height;
+}
+
+bool MDK_VideoStreamMetadata(const mdkVideoStreamInfo *vsi, mdkStringMapEntry *sme)
+{
+    return findMetadata(vsi && vsi->priv ? &static_cast<const StubStream *>(vsi->priv)->metadata
+                                         : nullptr,
+                        sme);
+}
+
+bool MDK_MediaMetadata(const mdkMediaInfo *mi, mdkStringMapEntry *sme)
+{
+    return findMetadata(mi && mi->priv ? &static_cast<const StubStream *>(mi->priv)->metadata
+                                       : nullptr,
+                        sme);
+}
+
+const mdkPlayerAPI *mdkPlayerAPI_new()
+{
+    simulateCall();
+    return createPlayer();
+}
+
+void mdkPlayerAPI_delete(const mdkPlayerAPI **value)
+{
+    simulateCall();
+    if (!value || !*value) {
+        return;
+    }
+    StubPlayer *player = playerOf((*value)->object);
+    if (player->version != MDKSTUB_VERSION) {
+        std::abort();
+    }
+    delete player;
+    *value = nullptr;
+}
+
+void MDK_foreignGLContextDestroyed()
+{
+    simulateCall();
+}
+
+mdkVideoFrameAPI *mdkVideoFrameAPI_new(int width, int height, MDK_PixelFormat format)
+{
+    simulateCall();
+    const int64_t failEvery = frameFailEvery.load(std::memory_order_relaxed);
+    if ((failEvery > 0) && (((frameAllocations.fetch_add(1) + 1) % failEvery) == 0)) {
+        return nullptr;
+    }
+    return createFrame(width, height, format);
+}
+
+void mdkVideoFrameAPI_delete(mdkVideoFrameAPI **value)
+{
+    simulateCall();
+    destroyFrame(value);
+}
+
+} // extern "C"